@@ -0,0 +1,46 @@
+// Version d'OpenGL
+#version 150
+
+// Donnees d'entree (CompactVertex de Object)
+in vec3 in_position;    // position quantifiee sur 16 bits par axe
+in vec2 in_normal;      // normale octaedrique, sur 16 bits signes par coordonnee
+
+// Donnees de sortie
+out vec2 vert_texCoord;
+out vec3 vert_normal;
+
+out vec3 light_dir;
+
+// Parametres
+uniform mat4 ViewMatrix;
+uniform mat4 ProjectionMatrix;
+uniform vec3 PositionOrigin;    // position du point quantifie (0, 0, 0)
+uniform vec3 PositionStep;      // taille d'une cellule de quantification
+
+// Inverse de QuantizedMesh::EncodeOctahedral
+vec3 DecodeOctahedral(vec2 p)
+{
+  p = max(p / 32767.0, vec2(-1.0));
+  vec3 n = vec3(p, 1.0 - abs(p.x) - abs(p.y));
+  if(n.z < 0.0)
+  {
+    vec2 s = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    n.xy = (1.0 - abs(n.yx)) * s;
+  }
+  return normalize(n);
+}
+
+// Fonction appellee pour chaque sommet
+void main()
+{
+  vec3 position = PositionOrigin + in_position * PositionStep;
+  gl_Position = ProjectionMatrix * ViewMatrix * vec4(position * 0.5, 1.0);
+
+  vert_normal = DecodeOctahedral(in_normal);
+
+  light_dir = vec3(0.0, 0.0, -1.0);
+  light_dir = normalize(light_dir);
+  light_dir = (inverse(ViewMatrix) * vec4(light_dir, 0.0)).xyz;
+
+  vert_texCoord = vec2(0.0);
+}
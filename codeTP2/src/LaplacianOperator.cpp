@@ -0,0 +1,1219 @@
+#include <LaplacianOperator.h>
+#include <MeshHE.h>
+#include <Trace.h>
+
+#include <algorithm>
+
+using namespace glm;
+using namespace std;
+
+const glm::uint LaplacianOperator::BLOCK_SIZE;
+const float LaplacianOperator::WEIGHT_TOLERANCE = 0.01f;
+const glm::uint LaplacianOperator::DENSE_REFRESH_RATIO;
+
+
+//***************
+// Assembly
+
+/**
+ * @brief LaplacianOperator::Build
+ * The rows follow the vertex order of the mesh partition (row r is the
+ * vertex GetVertexOrder()[r], the columns are ranks in this order) and the
+ * sparsity pattern is the 1-ring adjacency of the mesh (in the same order),
+ * border rows are left empty. The rows are filled by the threads which
+ * process them, so that the matrix pages are first touched on their node.
+ * @param mesh
+ * @param weights
+ * @param tolerance     Move of a vertex, in mean edge lengths, after which RefreshWeights recomputes the geometric weights around it
+ */
+void LaplacianOperator::Build(const MeshHE &mesh, const LaplacianWeights weights, const float tolerance)
+{
+    TRACE_ZONE("laplacian assembly");
+
+    const MeshPartition& partition = mesh.GetPartition();
+    const vector<glm::uint>& order = partition.GetVertexOrder();
+    const vector<glm::uint>& ranks = partition.GetVertexRanks();
+
+    int nb_rows = mesh.NbVertices();
+    bool geometric = (weights != UNIFORM_WEIGHTS);
+    m_weights = weights;
+    m_weight_tolerance = tolerance;
+
+    m_offsets.assign(nb_rows+1, 0);
+
+    for(int r = 0; r < nb_rows; r++)
+    {
+        Vertex v(order[r]);
+        m_offsets[r+1] = m_offsets[r] + (mesh.IsAtBorder(v) ? 0 : mesh.GetNbNeighbors(v));
+    }
+
+    m_columns.resize(m_offsets[nb_rows]);
+    m_values.resize(m_offsets[nb_rows]);
+    m_diagonal.resize(nb_rows);
+    m_row_scales.resize(nb_rows);
+    m_entry_he.resize(geometric ? m_offsets[nb_rows] : 0);
+
+    #pragma omp parallel for schedule(static)
+    for(int r = 0; r < nb_rows; r++)
+    {
+        const glm::uint* neighbors = mesh.GetNeighbors(Vertex(order[r]));
+        glm::uint nb_entries = m_offsets[r+1] - m_offsets[r];
+
+        for(glm::uint k = 0; k < nb_entries; k++)
+        {
+            m_columns[m_offsets[r] + k] = ranks[neighbors[k]];
+        }
+        m_diagonal[r] = (nb_entries == 0) ? 0.0f : 1.0f;
+        m_row_scales[r] = (nb_entries == 0) ? 1.0f : float(nb_entries);
+
+        // Interior 1-rings are closed fans, walked in the same order as the cached 1-ring
+        if(geometric && nb_entries > 0)
+        {
+            glm::uint he = mesh.m_vertex_he[order[r]];
+            for(glm::uint k = 0; k < nb_entries; k++)
+            {
+                m_entry_he[m_offsets[r] + k] = he;
+                he = mesh.m_he_next[mesh.m_he_twin[he]];
+            }
+        }
+    }
+
+    m_part_blocks.resize(partition.NbParts()+1);
+    for(glm::uint p = 0; p < partition.NbParts(); p++)
+        m_part_blocks[p] = partition.PartBegin(p) / BLOCK_SIZE;
+    m_part_blocks.back() = (nb_rows + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    if(geometric)
+    {
+        // Tolerance in distance, from the mean edge length
+        int nb_half_edges = mesh.NbHalfEdges();
+        double sum_lengths = 0.0;
+
+        #pragma omp parallel for schedule(static) reduction(+:sum_lengths)
+        for(int he = 0; he < nb_half_edges; he++)
+            sum_lengths += length(mesh.m_positions[mesh.m_he_vertex[mesh.m_he_next[he]]] - mesh.m_positions[mesh.m_he_vertex[he]]);
+
+        float distance = (nb_half_edges > 0) ? tolerance * float(sum_lengths / nb_half_edges) : 0.0f;
+        m_refresh_distance2 = distance * distance;
+
+        m_weight_positions = mesh.m_positions;
+        m_vertex_stale.assign(mesh.NbVertices(), 0);
+        m_stale_vertices.clear();
+        m_row_epochs.assign(nb_rows, 0);
+        m_epoch = 0;
+        m_he_terms.resize(mesh.NbHalfEdges());
+
+        int nb_faces = mesh.NbFaces();
+
+        #pragma omp parallel for schedule(static)
+        for(int f = 0; f < nb_faces; f++)
+            ComputeFaceTerms(mesh, f);
+
+        #pragma omp parallel for schedule(static)
+        for(int r = 0; r < nb_rows; r++)
+            AssembleRow(mesh, r);
+
+        m_nb_refreshed_rows = nb_rows;
+    }
+    else
+    {
+        m_entry_he.clear();
+        m_he_terms.clear();
+        m_weight_positions.clear();
+        m_vertex_stale.clear();
+        m_stale_vertices.clear();
+        m_row_epochs.clear();
+        BuildUniformRows(mesh);
+    }
+
+    BuildBlocks();
+}
+
+/// First stale vertex (smallest index) of face f, NULL_INDEX if there is none
+static inline glm::uint FirstStaleVertex(const MeshHE& mesh, const vector<glm::uint8>& stale, const glm::uint f)
+{
+    glm::uint first = NULL_INDEX;
+    for(glm::uint he = 3*f; he < 3*f + 3; he++)
+    {
+        glm::uint v = mesh.m_he_vertex[he];
+        if(stale[v] && v < first)
+            first = v;
+    }
+    return first;
+}
+
+/// First stale vertex (smallest index) of the closed 1-ring of u, NULL_INDEX if there is none
+static inline glm::uint FirstStaleNeighbor(const MeshHE& mesh, const vector<glm::uint8>& stale, const glm::uint u)
+{
+    glm::uint first = stale[u] ? u : NULL_INDEX;
+    const glm::uint* neighbors = mesh.GetNeighbors(Vertex(u));
+    for(glm::uint k = 0; k < mesh.GetNbNeighbors(Vertex(u)); k++)
+    {
+        if(stale[neighbors[k]] && neighbors[k] < first)
+            first = neighbors[k];
+    }
+    return first;
+}
+
+/**
+ * @brief LaplacianOperator::RefreshWeights
+ * A vertex is stale when it moved by more than the tolerance since the terms
+ * around it were last computed. The terms of the faces with a stale vertex
+ * are recomputed, then the rows with a stale vertex in their closed 1-ring,
+ * then their copies in the halos. When few vertices are stale, only their
+ * neighborhoods are visited; otherwise most rows need it anyway, and all of
+ * them are recomputed (cheaper than testing each one).
+ * The refreshed rows are stamped with the number of the refresh, so that
+ * nothing has to be cleared afterwards.
+ * Uniform weights do not depend on the positions: nothing to do.
+ * With a zero tolerance, the operator is the same as after a full Build.
+ */
+void LaplacianOperator::RefreshWeights(const MeshHE &mesh)
+{
+    if(m_weights == UNIFORM_WEIGHTS)
+        return;
+
+    TRACE_ZONE("laplacian weights refresh");
+
+    glm::uint nb_vertices = mesh.NbVertices();
+    const vector<vec3>& p = mesh.m_positions;
+
+    int nb_stale = 0;
+
+    #pragma omp parallel for schedule(static) reduction(+:nb_stale)
+    for(int v = 0; v < int(nb_vertices); v++)
+    {
+        vec3 d = p[v] - m_weight_positions[v];
+        bool stale = dot(d, d) > m_refresh_distance2;
+        m_vertex_stale[v] = stale;
+        if(stale)
+        {
+            m_weight_positions[v] = p[v];
+            nb_stale++;
+        }
+    }
+
+    m_nb_refreshed_rows = 0;
+    if(nb_stale == 0)
+        return;
+
+    if(++m_epoch == 0)
+    {
+        fill(m_row_epochs.begin(), m_row_epochs.end(), 0);
+        m_epoch = 1;
+    }
+
+    if(glm::uint(nb_stale) > nb_vertices / DENSE_REFRESH_RATIO)
+        m_nb_refreshed_rows = RefreshAll(mesh);
+    else
+        m_nb_refreshed_rows = RefreshStaleNeighborhoods(mesh);
+
+    int nb_halo = m_halo.size();
+
+    #pragma omp parallel for schedule(static)
+    for(int h = 0; h < nb_halo; h++)
+    {
+        glm::uint g = m_halo[h];
+        if(m_row_epochs[g] == m_epoch)
+            copy(m_values.begin() + m_offsets[g], m_values.begin() + m_offsets[g+1], m_halo_values.begin() + m_halo_rows[h]);
+    }
+
+    TRACE_COUNTER("refreshed rows", m_nb_refreshed_rows);
+}
+
+glm::uint LaplacianOperator::RefreshAll(const MeshHE &mesh)
+{
+    int nb_faces = mesh.NbFaces();
+    int nb_rows = NbRows();
+
+    m_weight_positions = mesh.m_positions;
+
+    #pragma omp parallel for schedule(static)
+    for(int f = 0; f < nb_faces; f++)
+        ComputeFaceTerms(mesh, f);
+
+    #pragma omp parallel for schedule(static)
+    for(int r = 0; r < nb_rows; r++)
+    {
+        AssembleRow(mesh, r);
+        m_row_epochs[r] = m_epoch;
+    }
+
+    return nb_rows;
+}
+
+/**
+ * @brief LaplacianOperator::RefreshStaleNeighborhoods
+ * Each face and each row is handled by its first stale vertex only, so that
+ * the threads never write the same entries.
+ */
+glm::uint LaplacianOperator::RefreshStaleNeighborhoods(const MeshHE &mesh)
+{
+    glm::uint nb_vertices = mesh.NbVertices();
+    const vector<glm::uint>& ranks = mesh.GetPartition().GetVertexRanks();
+    int nb_refreshed = 0;
+
+    m_stale_vertices.clear();
+    for(glm::uint v = 0; v < nb_vertices; v++)
+    {
+        if(m_vertex_stale[v])
+            m_stale_vertices.push_back(v);
+    }
+    int nb_stale = m_stale_vertices.size();
+
+    // Faces around the stale vertices
+    #pragma omp parallel for schedule(static)
+    for(int i = 0; i < nb_stale; i++)
+    {
+        glm::uint v = m_stale_vertices[i];
+        for(glm::uint c = mesh.m_corner_offsets[v]; c < mesh.m_corner_offsets[v+1]; c++)
+        {
+            glm::uint f = mesh.m_corners[c] / 3;
+            if(FirstStaleVertex(mesh, m_vertex_stale, f) == v)
+                ComputeFaceTerms(mesh, f);
+        }
+    }
+
+    // Interior rows with a stale vertex: v itself and the ends of the half edges
+    // leaving v (an interior vertex u has both half edges of the edge (u, v))
+    #pragma omp parallel for schedule(static) reduction(+:nb_refreshed)
+    for(int i = 0; i < nb_stale; i++)
+    {
+        glm::uint v = m_stale_vertices[i];
+        for(glm::uint c = mesh.m_corner_offsets[v]; c <= mesh.m_corner_offsets[v+1]; c++)
+        {
+            glm::uint u = (c < mesh.m_corner_offsets[v+1]) ? mesh.m_he_vertex[mesh.m_he_next[mesh.m_corners[c]]] : v;
+            if(mesh.IsAtBorder(Vertex(u)) || FirstStaleNeighbor(mesh, m_vertex_stale, u) != v)
+                continue;
+
+            AssembleRow(mesh, ranks[u]);
+            m_row_epochs[ranks[u]] = m_epoch;
+            nb_refreshed++;
+        }
+    }
+
+    return nb_refreshed;
+}
+
+void LaplacianOperator::Clear()
+{
+    m_offsets.clear();
+    m_columns.clear();
+    m_values.clear();
+    m_diagonal.clear();
+    m_row_scales.clear();
+    m_part_blocks.clear();
+
+    m_entry_he.clear();
+    m_he_terms.clear();
+    m_weight_positions.clear();
+    m_vertex_stale.clear();
+    m_stale_vertices.clear();
+    m_row_epochs.clear();
+    m_epoch = 0;
+    m_nb_refreshed_rows = 0;
+
+    m_halo_offsets.clear();
+    m_halo.clear();
+    m_local_columns.clear();
+    m_halo_rows.clear();
+    m_halo_columns.clear();
+    m_halo_values.clear();
+    m_halo_diagonal.clear();
+    m_max_local_size = 0;
+}
+
+void LaplacianOperator::BuildUniformRows(const MeshHE &)
+{
+    int nb_rows = NbRows();
+
+    #pragma omp parallel for schedule(static)
+    for(int v = 0; v < nb_rows; v++)
+    {
+        glm::uint nb_entries = m_offsets[v+1] - m_offsets[v];
+        for(glm::uint k = m_offsets[v]; k < m_offsets[v+1]; k++)
+        {
+            m_values[k] = 1.0f / nb_entries;
+        }
+    }
+}
+
+/**
+ * @brief LaplacianOperator::ComputeFaceTerms
+ * The half edges of face f are 3f, 3f+1 and 3f+2 (a->b, b->c, c->a). The
+ * three corners share the norm of the cross product (twice the area): the
+ * cotangent at a is dot(b-a, c-a) / |cross| and the tangent of half the angle
+ * at a is (|b-a| |c-a| - dot(b-a, c-a)) / |cross|. Degenerate faces give 0.
+ */
+void LaplacianOperator::ComputeFaceTerms(const MeshHE &mesh, const glm::uint f)
+{
+    const vector<vec3>& p = mesh.m_positions;
+
+    glm::uint he = 3*f;
+    const vec3& pa = p[mesh.m_he_vertex[he]];
+    const vec3& pb = p[mesh.m_he_vertex[he+1]];
+    const vec3& pc = p[mesh.m_he_vertex[he+2]];
+
+    vec3 ab = pb - pa;
+    vec3 bc = pc - pb;
+    vec3 ca = pa - pc;
+    float s = length(cross(ab, ca));
+    float inv_s = (s > 1e-12f) ? 1.0f / s : 0.0f;
+
+    // Dot products of the two edges leaving each corner
+    float dot_a = -dot(ab, ca);
+    float dot_b = -dot(bc, ab);
+    float dot_c = -dot(ca, bc);
+
+    if(m_weights == COTANGENT_WEIGHTS)
+    {
+        m_he_terms[he]   = dot_c * inv_s;      // opposite to a->b
+        m_he_terms[he+1] = dot_a * inv_s;      // opposite to b->c
+        m_he_terms[he+2] = dot_b * inv_s;      // opposite to c->a
+    }
+    else
+    {
+        float l_ab = length(ab);
+        float l_bc = length(bc);
+        float l_ca = length(ca);
+        m_he_terms[he]   = (l_ab * l_ca - dot_a) * inv_s;     // at a
+        m_he_terms[he+1] = (l_bc * l_ab - dot_b) * inv_s;     // at b
+        m_he_terms[he+2] = (l_ca * l_bc - dot_c) * inv_s;     // at c
+    }
+}
+
+/**
+ * @brief LaplacianOperator::AssembleRow
+ * The entries of an interior row are the half edges h_t leaving v around its
+ * closed fan, h_t+1 being the half edge after the twin of h_t. The edge of
+ * h_t is shared by the face of h_t and the face of its twin, which is the
+ * half edge before h_t+1 (no lookup in the half edge arrays):
+ * - cotangent: w = (cot of the angle opposite to h_t + cot of the angle
+ *   opposite to its twin) / 2. Negative weights (obtuse angles) are clamped
+ *   to 0 to keep the explicit steps stable;
+ * - mean value: w = (tan of half the angle at v in the face of h_t + the
+ *   same in the face of h_t+1) / |p_n - p_v|.
+ * The row is then normalized by the sum of its weights, a row without any
+ * positive weight falls back to uniform.
+ */
+void LaplacianOperator::AssembleRow(const MeshHE &mesh, const glm::uint r)
+{
+    glm::uint begin = m_offsets[r];
+    glm::uint nb_entries = m_offsets[r+1] - begin;
+    if(nb_entries == 0)
+        return;
+
+    const vector<vec3>& p = mesh.m_positions;
+    const vector<glm::uint>& order = mesh.GetPartition().GetVertexOrder();
+    const vec3& pv = p[order[r]];
+
+    float sum = 0.0f;
+    for(glm::uint t = 0; t < nb_entries; t++)
+    {
+        glm::uint he = m_entry_he[begin + t];
+        glm::uint after = m_entry_he[begin + (t + 1 == nb_entries ? 0 : t + 1)];
+        float w;
+
+        if(m_weights == COTANGENT_WEIGHTS)
+        {
+            glm::uint twin = after - after % 3 + (after + 2) % 3;
+            w = 0.5f * (m_he_terms[he] + m_he_terms[twin]);
+            w = glm::max(w, 0.0f);
+        }
+        else
+        {
+            float l = length(p[order[m_columns[begin + t]]] - pv);
+            w = (l > 1e-12f) ? (m_he_terms[he] + m_he_terms[after]) / l : 0.0f;
+        }
+
+        m_values[begin + t] = w;
+        sum += w;
+    }
+
+    float inv_sum = (sum > 0.0f) ? 1.0f / sum : 0.0f;
+    for(glm::uint t = 0; t < nb_entries; t++)
+    {
+        m_values[begin + t] = (sum > 0.0f) ? m_values[begin + t] * inv_sum : 1.0f / nb_entries;
+    }
+    m_row_scales[r] = (sum > 0.0f) ? sum : float(nb_entries);
+}
+
+/**
+ * @brief LaplacianOperator::BuildBlocks
+ * For each block of BLOCK_SIZE rows, lists the sorted outside columns (halo)
+ * and renumbers the columns locally: a row of the block keeps its rank in the
+ * block, a halo vertex gets BLOCK_SIZE + its rank in the halo.
+ * The rows of the halo vertices are also copied contiguously.
+ */
+void LaplacianOperator::BuildBlocks()
+{
+    glm::uint nb_rows = NbRows();
+    int nb_blocks = (nb_rows + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    m_halo_offsets.assign(nb_blocks+1, 0);
+    m_local_columns.resize(m_columns.size());
+
+    #pragma omp parallel
+    {
+        vector<glm::uint> ranks(nb_rows, NULL_INDEX);      // rank in the halo of the current block
+
+        // Halo sizes, so that the halos are written in place in m_halo
+        #pragma omp for schedule(static)
+        for(int b = 0; b < nb_blocks; b++)
+        {
+            glm::uint begin = b * BLOCK_SIZE;
+            glm::uint end = glm::min(begin + BLOCK_SIZE, nb_rows);
+            glm::uint count = 0;
+
+            for(glm::uint k = m_offsets[begin]; k < m_offsets[end]; k++)
+            {
+                glm::uint j = m_columns[k];
+                if((j < begin || j >= end) && ranks[j] == NULL_INDEX)
+                {
+                    ranks[j] = 0;
+                    count++;
+                }
+            }
+            m_halo_offsets[b+1] = count;
+
+            for(glm::uint k = m_offsets[begin]; k < m_offsets[end]; k++)
+                ranks[m_columns[k]] = NULL_INDEX;
+        }
+
+        #pragma omp single
+        {
+            m_max_local_size = 0;
+            for(int b = 0; b < nb_blocks; b++)
+            {
+                m_max_local_size = glm::max(m_max_local_size, BLOCK_SIZE + m_halo_offsets[b+1]);
+                m_halo_offsets[b+1] += m_halo_offsets[b];
+            }
+            m_halo.resize(m_halo_offsets[nb_blocks]);
+        }
+
+        #pragma omp for schedule(static)
+        for(int b = 0; b < nb_blocks; b++)
+        {
+            glm::uint begin = b * BLOCK_SIZE;
+            glm::uint end = glm::min(begin + BLOCK_SIZE, nb_rows);
+            glm::uint* halo = m_halo.data() + m_halo_offsets[b];
+            glm::uint halo_size = m_halo_offsets[b+1] - m_halo_offsets[b];
+            glm::uint count = 0;
+
+            for(glm::uint k = m_offsets[begin]; k < m_offsets[end]; k++)
+            {
+                glm::uint j = m_columns[k];
+                if((j < begin || j >= end) && ranks[j] == NULL_INDEX)
+                {
+                    ranks[j] = 0;
+                    halo[count++] = j;
+                }
+            }
+
+            sort(halo, halo + halo_size);
+            for(glm::uint h = 0; h < halo_size; h++)
+                ranks[halo[h]] = h;
+
+            for(glm::uint k = m_offsets[begin]; k < m_offsets[end]; k++)
+            {
+                glm::uint j = m_columns[k];
+                m_local_columns[k] = (j >= begin && j < end) ? j - begin : BLOCK_SIZE + ranks[j];
+            }
+
+            for(glm::uint h = 0; h < halo_size; h++)
+                ranks[halo[h]] = NULL_INDEX;
+        }
+    }
+
+    int nb_halo = m_halo.size();
+    m_halo_rows.assign(nb_halo+1, 0);
+    m_halo_diagonal.resize(nb_halo);
+    for(int h = 0; h < nb_halo; h++)
+    {
+        m_halo_rows[h+1] = m_halo_rows[h] + m_offsets[m_halo[h]+1] - m_offsets[m_halo[h]];
+        m_halo_diagonal[h] = m_diagonal[m_halo[h]];
+    }
+
+    m_halo_columns.resize(m_halo_rows[nb_halo]);
+    m_halo_values.resize(m_halo_rows[nb_halo]);
+
+    #pragma omp parallel for schedule(static)
+    for(int h = 0; h < nb_halo; h++)
+    {
+        glm::uint g = m_halo[h];
+        copy(m_columns.begin() + m_offsets[g], m_columns.begin() + m_offsets[g+1], m_halo_columns.begin() + m_halo_rows[h]);
+        copy(m_values.begin() + m_offsets[g], m_values.begin() + m_offsets[g+1], m_halo_values.begin() + m_halo_rows[h]);
+    }
+}
+
+
+
+//***************
+// Filters
+
+void LaplacianOperator::Multiply(const SoAPositions &src, SoAPositions &dst, const int nb_threads) const
+{
+    const SmoothingKernels& kernels = GetSmoothingKernels();
+
+    glm::uint nb_rows = NbRows();
+    int nb_parts = NbParts();
+
+    #pragma omp parallel for schedule(static) num_threads(MeshHE::NbThreads(nb_threads))
+    for(int part = 0; part < nb_parts; part++)
+    {
+        for(int b = m_part_blocks[part]; b < int(m_part_blocks[part+1]); b++)
+        {
+            glm::uint begin = b * BLOCK_SIZE;
+            glm::uint nb = glm::min(BLOCK_SIZE, nb_rows - begin);
+
+            kernels.spmv(src.X(), src.Y(), src.Z(), src.X() + begin, src.Y() + begin, src.Z() + begin,
+                         &m_offsets[begin], m_columns.data(), m_values.data(), &m_diagonal[begin],
+                         nb, dst.X() + begin, dst.Y() + begin, dst.Z() + begin);
+        }
+    }
+}
+
+void LaplacianOperator::Step(const float lambda, const SoAPositions &src, SoAPositions &dst, const int nb_threads) const
+{
+    const SmoothingKernels& kernels = GetSmoothingKernels();
+
+    glm::uint nb_rows = NbRows();
+    int nb_parts = NbParts();
+
+    #pragma omp parallel num_threads(MeshHE::NbThreads(nb_threads))
+    {
+        TRACE_ZONE("laplacian step");
+        SoAPositions lap;
+        lap.Resize(BLOCK_SIZE);
+
+        #pragma omp for schedule(static)
+        for(int part = 0; part < nb_parts; part++)
+        {
+            for(int b = m_part_blocks[part]; b < int(m_part_blocks[part+1]); b++)
+            {
+                glm::uint begin = b * BLOCK_SIZE;
+                glm::uint nb = glm::min(BLOCK_SIZE, nb_rows - begin);
+
+                kernels.spmv(src.X(), src.Y(), src.Z(), src.X() + begin, src.Y() + begin, src.Z() + begin,
+                             &m_offsets[begin], m_columns.data(), m_values.data(), &m_diagonal[begin],
+                             nb, lap.X(), lap.Y(), lap.Z());
+                kernels.update(src.X() + begin, src.Y() + begin, src.Z() + begin, lap.X(), lap.Y(), lap.Z(),
+                               lambda, nb, dst.X() + begin, dst.Y() + begin, dst.Z() + begin);
+            }
+        }
+    }
+}
+
+/**
+ * @brief LaplacianOperator::TaubinStep
+ * Applies the polynomial filter (I + mu L)(I + lambda L) block by block:
+ * the intermediate positions y = (I + lambda L) src are only computed for the
+ * rows of the block and its halo, in a per thread buffer, then the block
+ * rows of dst are computed from them. src and dst are each swept once
+ * instead of twice, at the cost of recomputing y on the halos.
+ * The halo rows go through the same kernels as the block rows, so the result
+ * is bit-identical to two successive calls to Step.
+ */
+void LaplacianOperator::TaubinStep(const float lambda, const float mu, const SoAPositions &src, SoAPositions &dst, const int nb_threads) const
+{
+    const SmoothingKernels& kernels = GetSmoothingKernels();
+
+    glm::uint nb_rows = NbRows();
+    int nb_parts = NbParts();
+
+    #pragma omp parallel num_threads(MeshHE::NbThreads(nb_threads))
+    {
+        TRACE_ZONE("taubin step");
+        SoAPositions y, lap;
+        y.Resize(m_max_local_size);
+        lap.Resize(m_max_local_size);
+
+        #pragma omp for schedule(static)
+        for(int part = 0; part < nb_parts; part++)
+        {
+            for(int b = m_part_blocks[part]; b < int(m_part_blocks[part+1]); b++)
+            {
+                glm::uint begin = b * BLOCK_SIZE;
+                glm::uint nb = glm::min(BLOCK_SIZE, nb_rows - begin);
+
+                // y on the rows of the block
+                kernels.spmv(src.X(), src.Y(), src.Z(), src.X() + begin, src.Y() + begin, src.Z() + begin,
+                             &m_offsets[begin], m_columns.data(), m_values.data(), &m_diagonal[begin],
+                             nb, lap.X(), lap.Y(), lap.Z());
+                kernels.update(src.X() + begin, src.Y() + begin, src.Z() + begin, lap.X(), lap.Y(), lap.Z(),
+                               lambda, nb, y.X(), y.Y(), y.Z());
+
+                // y on the halo (positions gathered, then updated in place)
+                glm::uint h0 = m_halo_offsets[b];
+                glm::uint nb_halo = m_halo_offsets[b+1] - h0;
+                float* hx = y.X() + BLOCK_SIZE;
+                float* hy = y.Y() + BLOCK_SIZE;
+                float* hz = y.Z() + BLOCK_SIZE;
+
+                for(glm::uint h = 0; h < nb_halo; h++)
+                {
+                    glm::uint g = m_halo[h0 + h];
+                    hx[h] = src.X()[g];
+                    hy[h] = src.Y()[g];
+                    hz[h] = src.Z()[g];
+                }
+                if(nb_halo > 0)
+                {
+                    kernels.spmv(src.X(), src.Y(), src.Z(), hx, hy, hz,
+                                 &m_halo_rows[h0], m_halo_columns.data(), m_halo_values.data(), &m_halo_diagonal[h0],
+                                 nb_halo, lap.X(), lap.Y(), lap.Z());
+                    kernels.update(hx, hy, hz, lap.X(), lap.Y(), lap.Z(),
+                                   lambda, nb_halo, hx, hy, hz);
+                }
+
+                // dst on the rows of the block, from y
+                kernels.spmv(y.X(), y.Y(), y.Z(), y.X(), y.Y(), y.Z(),
+                             &m_offsets[begin], m_local_columns.data(), m_values.data(), &m_diagonal[begin],
+                             nb, lap.X(), lap.Y(), lap.Z());
+                kernels.update(y.X(), y.Y(), y.Z(), lap.X(), lap.Y(), lap.Z(),
+                               mu, nb, dst.X() + begin, dst.Y() + begin, dst.Z() + begin);
+            }
+        }
+    }
+}
+
+
+
+//***************
+// Implicit step
+
+/**
+ * @brief LaplacianOperator::SolveImplicit
+ * Backward Euler step of the diffusion: solves (I - lambda_dt L) dst = src.
+ * Each row i of the system is scaled by m_row_scales[i] and the fixed (border)
+ * vertices are moved to the right hand side, which gives a symmetric positive
+ * definite system for the other vertices:
+ *     s_i (1 + lambda_dt) x_i - lambda_dt sum_j s_i w_ij x_j = s_i src_i     (j not fixed)
+ * It is solved by conjugate gradient with a Jacobi (diagonal) preconditioner,
+ * x, y and z being three independent solves sharing each sweep over the
+ * matrix. Mean value weights do not give a symmetric system, it is then
+ * solved by BiCGSTAB (see SolveBiCGStab).
+ * The dot products are summed per block then in block order, so the
+ * result does not depend on the scheduling, only on the row order (the
+ * partition).
+ * @param lambda_dt     Diffusion time step (any positive value is stable)
+ * @param src           Positions before the step
+ * @param dst           Initial guess, then solution (fixed vertices are copied from src)
+ * @param tolerance     Stops when |residual| <= tolerance * |right hand side| on each coordinate
+ * @param max_iter      Maximum number of iterations
+ * @return number of iterations performed (max_iter if the solver did not converge)
+ */
+glm::uint LaplacianOperator::SolveImplicit(const float lambda_dt, const SoAPositions &src, SoAPositions &dst,
+                                           const float tolerance, const glm::uint max_iter, const int nb_threads) const
+{
+    TRACE_ZONE("implicit solve");
+
+    const SmoothingKernels& kernels = GetSmoothingKernels();
+
+    glm::uint nb_rows = NbRows();
+    int nb_blocks = (nb_rows + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    int nb_parts = NbParts();
+    int nb_used_threads = MeshHE::NbThreads(nb_threads);
+
+    const float* sx[3] = { src.X(), src.Y(), src.Z() };
+
+    // Scaled symmetric system. The diagonal is stored negated for the spmv kernel
+    // (l = sum values * p - diagonal * p_i), fixed rows are identity rows.
+    vector<float> a_values(m_values.size());
+    vector<float> a_diagonal(nb_rows);
+    vector<float> inv_diagonal(nb_rows);
+    SoAPositions b;
+    b.Resize(nb_rows);
+
+    float* bc[3] = { b.X(), b.Y(), b.Z() };
+    float* xc[3] = { dst.X(), dst.Y(), dst.Z() };
+
+    #pragma omp parallel for schedule(static) num_threads(nb_used_threads)
+    for(int i = 0; i < int(nb_rows); i++)
+    {
+        if(m_diagonal[i] == 0.0f)
+        {
+            a_diagonal[i] = -1.0f;
+            inv_diagonal[i] = 1.0f;
+            for(int c = 0; c < 3; c++)
+            {
+                bc[c][i] = sx[c][i];
+                xc[c][i] = sx[c][i];
+            }
+            continue;
+        }
+
+        float s = m_row_scales[i];
+        a_diagonal[i] = -s * (1.0f + lambda_dt * m_diagonal[i]);
+        inv_diagonal[i] = -1.0f / a_diagonal[i];
+
+        float rhs[3] = { s * sx[0][i], s * sx[1][i], s * sx[2][i] };
+        for(glm::uint k = m_offsets[i]; k < m_offsets[i+1]; k++)
+        {
+            glm::uint j = m_columns[k];
+            float a = lambda_dt * s * m_values[k];
+            if(m_diagonal[j] == 0.0f)
+            {
+                a_values[k] = 0.0f;
+                for(int c = 0; c < 3; c++)
+                    rhs[c] += a * sx[c][j];
+            }
+            else
+            {
+                a_values[k] = -a;
+            }
+        }
+        for(int c = 0; c < 3; c++)
+            bc[c][i] = rhs[c];
+    }
+
+    if(m_weights == MEAN_VALUE_WEIGHTS)
+        return SolveBiCGStab(a_values, a_diagonal, inv_diagonal, b, dst, tolerance, max_iter, nb_threads);
+
+    SoAPositions r, z, p, q;
+    r.Resize(nb_rows);
+    z.Resize(nb_rows);
+    p.Resize(nb_rows);
+    q.Resize(nb_rows);
+
+    float* rc[3] = { r.X(), r.Y(), r.Z() };
+    float* zc[3] = { z.X(), z.Y(), z.Z() };
+    float* pc[3] = { p.X(), p.Y(), p.Z() };
+    float* qc[3] = { q.X(), q.Y(), q.Z() };
+
+    // One partial sum per block and per quantity
+    vector<double> partials(nb_blocks * 9);
+
+    // r = b - A x, z = M^-1 r, p = z
+    #pragma omp parallel for schedule(static) num_threads(nb_used_threads)
+    for(int part = 0; part < nb_parts; part++)
+    {
+        for(int blk = m_part_blocks[part]; blk < int(m_part_blocks[part+1]); blk++)
+        {
+            glm::uint begin = blk * BLOCK_SIZE;
+            glm::uint end = glm::min(begin + BLOCK_SIZE, nb_rows);
+
+            kernels.spmv(dst.X(), dst.Y(), dst.Z(), dst.X() + begin, dst.Y() + begin, dst.Z() + begin,
+                         &m_offsets[begin], m_columns.data(), a_values.data(), &a_diagonal[begin],
+                         end - begin, q.X() + begin, q.Y() + begin, q.Z() + begin);
+
+            double* part = &partials[blk * 9];
+            for(int k = 0; k < 9; k++)
+                part[k] = 0.0;
+
+            for(int c = 0; c < 3; c++)
+            {
+                for(glm::uint i = begin; i < end; i++)
+                {
+                    rc[c][i] = bc[c][i] - qc[c][i];
+                    zc[c][i] = inv_diagonal[i] * rc[c][i];
+                    pc[c][i] = zc[c][i];
+                    part[c]     += double(rc[c][i]) * zc[c][i];
+                    part[3 + c] += double(rc[c][i]) * rc[c][i];
+                    part[6 + c] += double(bc[c][i]) * bc[c][i];
+                }
+            }
+        }
+    }
+
+    double rz[3], rr[3], bb[3];
+    bool active[3];
+    for(int c = 0; c < 3; c++)
+    {
+        rz[c] = rr[c] = bb[c] = 0.0;
+        for(int blk = 0; blk < nb_blocks; blk++)
+        {
+            rz[c] += partials[blk * 9 + c];
+            rr[c] += partials[blk * 9 + 3 + c];
+            bb[c] += partials[blk * 9 + 6 + c];
+        }
+        active[c] = rr[c] > double(tolerance) * tolerance * bb[c];
+    }
+
+    glm::uint iter = 0;
+    while(iter < max_iter && (active[0] || active[1] || active[2]))
+    {
+        // q = A p
+        #pragma omp parallel for schedule(static) num_threads(nb_used_threads)
+        for(int part = 0; part < nb_parts; part++)
+        {
+            for(int blk = m_part_blocks[part]; blk < int(m_part_blocks[part+1]); blk++)
+            {
+                glm::uint begin = blk * BLOCK_SIZE;
+                glm::uint end = glm::min(begin + BLOCK_SIZE, nb_rows);
+
+                kernels.spmv(p.X(), p.Y(), p.Z(), p.X() + begin, p.Y() + begin, p.Z() + begin,
+                             &m_offsets[begin], m_columns.data(), a_values.data(), &a_diagonal[begin],
+                             end - begin, q.X() + begin, q.Y() + begin, q.Z() + begin);
+
+                double* part = &partials[blk * 9];
+                for(int c = 0; c < 3; c++)
+                {
+                    part[c] = 0.0;
+                    for(glm::uint i = begin; i < end; i++)
+                        part[c] += double(pc[c][i]) * qc[c][i];
+                }
+            }
+        }
+
+        float alpha[3];
+        for(int c = 0; c < 3; c++)
+        {
+            double pq = 0.0;
+            for(int blk = 0; blk < nb_blocks; blk++)
+                pq += partials[blk * 9 + c];
+
+            if(active[c] && pq <= 0.0)     // breakdown (p already in the kernel)
+                active[c] = false;
+            alpha[c] = active[c] ? float(rz[c] / pq) : 0.0f;
+        }
+
+        // x += alpha p, r -= alpha q, z = M^-1 r
+        #pragma omp parallel for schedule(static) num_threads(nb_used_threads)
+        for(int part = 0; part < nb_parts; part++)
+        {
+            for(int blk = m_part_blocks[part]; blk < int(m_part_blocks[part+1]); blk++)
+            {
+                glm::uint begin = blk * BLOCK_SIZE;
+                glm::uint end = glm::min(begin + BLOCK_SIZE, nb_rows);
+
+                double* part = &partials[blk * 9];
+                for(int c = 0; c < 3; c++)
+                {
+                    part[c] = part[3 + c] = 0.0;
+                    if(!active[c])
+                        continue;
+
+                    for(glm::uint i = begin; i < end; i++)
+                    {
+                        xc[c][i] += alpha[c] * pc[c][i];
+                        rc[c][i] -= alpha[c] * qc[c][i];
+                        zc[c][i] = inv_diagonal[i] * rc[c][i];
+                        part[c]     += double(rc[c][i]) * zc[c][i];
+                        part[3 + c] += double(rc[c][i]) * rc[c][i];
+                    }
+                }
+            }
+        }
+
+        float beta[3];
+        for(int c = 0; c < 3; c++)
+        {
+            beta[c] = 0.0f;
+            if(!active[c])
+                continue;
+
+            double rz_new = 0.0;
+            rr[c] = 0.0;
+            for(int blk = 0; blk < nb_blocks; blk++)
+            {
+                rz_new += partials[blk * 9 + c];
+                rr[c] += partials[blk * 9 + 3 + c];
+            }
+            beta[c] = float(rz_new / rz[c]);
+            rz[c] = rz_new;
+            active[c] = rr[c] > double(tolerance) * tolerance * bb[c];
+        }
+        iter++;
+
+        if(!(active[0] || active[1] || active[2]))
+            break;
+
+        // p = z + beta p
+        #pragma omp parallel for schedule(static) num_threads(nb_used_threads)
+        for(int part = 0; part < nb_parts; part++)
+        {
+            for(int blk = m_part_blocks[part]; blk < int(m_part_blocks[part+1]); blk++)
+            {
+                glm::uint begin = blk * BLOCK_SIZE;
+                glm::uint end = glm::min(begin + BLOCK_SIZE, nb_rows);
+
+                for(int c = 0; c < 3; c++)
+                {
+                    if(!active[c])
+                        continue;
+                    for(glm::uint i = begin; i < end; i++)
+                        pc[c][i] = zc[c][i] + beta[c] * pc[c][i];
+                }
+            }
+        }
+    }
+
+    return iter;
+}
+
+/**
+ * @brief LaplacianOperator::SolveBiCGStab
+ * Solves A x = b for the system assembled by SolveImplicit (same storage:
+ * off diagonal values, negated diagonal, inverse diagonal) when it is not
+ * symmetric, by BiCGSTAB with the Jacobi preconditioner applied on the
+ * right. The system is strictly diagonally dominant (normalized rows), so
+ * the iterations converge like those of the conjugate gradient on the
+ * symmetric systems, each one costing two products instead of one.
+ * x, y and z are three independent solves sharing each sweep over the
+ * matrix, and the dot products are summed in block order as in
+ * SolveImplicit.
+ * @param x             Initial guess, then solution
+ * @return number of iterations performed (max_iter if the solver did not converge)
+ */
+glm::uint LaplacianOperator::SolveBiCGStab(const vector<float> &a_values, const vector<float> &a_diagonal, const vector<float> &inv_diagonal,
+                                           const SoAPositions &b, SoAPositions &x, const float tolerance, const glm::uint max_iter, const int nb_threads) const
+{
+    const SmoothingKernels& kernels = GetSmoothingKernels();
+
+    glm::uint nb_rows = NbRows();
+    int nb_blocks = (nb_rows + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    int nb_parts = NbParts();
+    int nb_used_threads = MeshHE::NbThreads(nb_threads);
+
+    // r : residual (s in the middle of an iteration), r0 : shadow residual,
+    // y = M^-1 p, z = M^-1 s, v = A y, t = A z
+    SoAPositions r, r0, p, v, y, z, t;
+    r.Resize(nb_rows);
+    r0.Resize(nb_rows);
+    p.Resize(nb_rows);
+    v.Resize(nb_rows);
+    y.Resize(nb_rows);
+    z.Resize(nb_rows);
+    t.Resize(nb_rows);
+
+    const float* bc[3] = { b.X(), b.Y(), b.Z() };
+    float* xc[3] = { x.X(), x.Y(), x.Z() };
+    float* rc[3] = { r.X(), r.Y(), r.Z() };
+    float* r0c[3] = { r0.X(), r0.Y(), r0.Z() };
+    float* pc[3] = { p.X(), p.Y(), p.Z() };
+    float* vc[3] = { v.X(), v.Y(), v.Z() };
+    float* yc[3] = { y.X(), y.Y(), y.Z() };
+    float* zc[3] = { z.X(), z.Y(), z.Z() };
+    float* tc[3] = { t.X(), t.Y(), t.Z() };
+
+    // One partial sum per block and per quantity
+    vector<double> partials(nb_blocks * 6);
+
+    // r = r0 = p = b - A x
+    #pragma omp parallel for schedule(static) num_threads(nb_used_threads)
+    for(int part = 0; part < nb_parts; part++)
+    {
+        for(int blk = m_part_blocks[part]; blk < int(m_part_blocks[part+1]); blk++)
+        {
+            glm::uint begin = blk * BLOCK_SIZE;
+            glm::uint end = glm::min(begin + BLOCK_SIZE, nb_rows);
+
+            kernels.spmv(x.X(), x.Y(), x.Z(), x.X() + begin, x.Y() + begin, x.Z() + begin,
+                         &m_offsets[begin], m_columns.data(), a_values.data(), &a_diagonal[begin],
+                         end - begin, v.X() + begin, v.Y() + begin, v.Z() + begin);
+
+            double* part = &partials[blk * 6];
+            for(int c = 0; c < 3; c++)
+            {
+                part[c] = part[3 + c] = 0.0;
+                for(glm::uint i = begin; i < end; i++)
+                {
+                    rc[c][i] = r0c[c][i] = pc[c][i] = bc[c][i] - vc[c][i];
+                    part[c]     += double(rc[c][i]) * rc[c][i];
+                    part[3 + c] += double(bc[c][i]) * bc[c][i];
+                }
+            }
+        }
+    }
+
+    double rho[3], rr[3], bb[3];
+    float alpha[3], omega[3];
+    bool active[3];
+    for(int c = 0; c < 3; c++)
+    {
+        rr[c] = bb[c] = 0.0;
+        for(int blk = 0; blk < nb_blocks; blk++)
+        {
+            rr[c] += partials[blk * 6 + c];
+            bb[c] += partials[blk * 6 + 3 + c];
+        }
+        rho[c] = rr[c];
+        alpha[c] = omega[c] = 0.0f;
+        active[c] = rr[c] > double(tolerance) * tolerance * bb[c];
+    }
+
+    glm::uint iter = 0;
+    while(iter < max_iter && (active[0] || active[1] || active[2]))
+    {
+        // y = M^-1 p, v = A y
+        #pragma omp parallel for schedule(static) num_threads(nb_used_threads)
+        for(int part = 0; part < nb_parts; part++)
+        {
+            for(int blk = m_part_blocks[part]; blk < int(m_part_blocks[part+1]); blk++)
+            {
+                glm::uint begin = blk * BLOCK_SIZE;
+                glm::uint end = glm::min(begin + BLOCK_SIZE, nb_rows);
+
+                for(int c = 0; c < 3; c++)
+                {
+                    for(glm::uint i = begin; i < end; i++)
+                        yc[c][i] = inv_diagonal[i] * pc[c][i];
+                }
+            }
+        }
+
+        #pragma omp parallel for schedule(static) num_threads(nb_used_threads)
+        for(int part = 0; part < nb_parts; part++)
+        {
+            for(int blk = m_part_blocks[part]; blk < int(m_part_blocks[part+1]); blk++)
+            {
+                glm::uint begin = blk * BLOCK_SIZE;
+                glm::uint end = glm::min(begin + BLOCK_SIZE, nb_rows);
+
+                kernels.spmv(y.X(), y.Y(), y.Z(), y.X() + begin, y.Y() + begin, y.Z() + begin,
+                             &m_offsets[begin], m_columns.data(), a_values.data(), &a_diagonal[begin],
+                             end - begin, v.X() + begin, v.Y() + begin, v.Z() + begin);
+
+                double* part = &partials[blk * 6];
+                for(int c = 0; c < 3; c++)
+                {
+                    part[c] = 0.0;
+                    for(glm::uint i = begin; i < end; i++)
+                        part[c] += double(r0c[c][i]) * vc[c][i];
+                }
+            }
+        }
+
+        for(int c = 0; c < 3; c++)
+        {
+            double r0v = 0.0;
+            for(int blk = 0; blk < nb_blocks; blk++)
+                r0v += partials[blk * 6 + c];
+
+            if(active[c] && r0v == 0.0)     // breakdown
+                active[c] = false;
+            alpha[c] = active[c] ? float(rho[c] / r0v) : 0.0f;
+        }
+
+        // s = r - alpha v (in r), z = M^-1 s, t = A z
+        #pragma omp parallel for schedule(static) num_threads(nb_used_threads)
+        for(int part = 0; part < nb_parts; part++)
+        {
+            for(int blk = m_part_blocks[part]; blk < int(m_part_blocks[part+1]); blk++)
+            {
+                glm::uint begin = blk * BLOCK_SIZE;
+                glm::uint end = glm::min(begin + BLOCK_SIZE, nb_rows);
+
+                for(int c = 0; c < 3; c++)
+                {
+                    for(glm::uint i = begin; i < end; i++)
+                    {
+                        rc[c][i] -= alpha[c] * vc[c][i];
+                        zc[c][i] = inv_diagonal[i] * rc[c][i];
+                    }
+                }
+            }
+        }
+
+        #pragma omp parallel for schedule(static) num_threads(nb_used_threads)
+        for(int part = 0; part < nb_parts; part++)
+        {
+            for(int blk = m_part_blocks[part]; blk < int(m_part_blocks[part+1]); blk++)
+            {
+                glm::uint begin = blk * BLOCK_SIZE;
+                glm::uint end = glm::min(begin + BLOCK_SIZE, nb_rows);
+
+                kernels.spmv(z.X(), z.Y(), z.Z(), z.X() + begin, z.Y() + begin, z.Z() + begin,
+                             &m_offsets[begin], m_columns.data(), a_values.data(), &a_diagonal[begin],
+                             end - begin, t.X() + begin, t.Y() + begin, t.Z() + begin);
+
+                double* part = &partials[blk * 6];
+                for(int c = 0; c < 3; c++)
+                {
+                    part[c] = part[3 + c] = 0.0;
+                    for(glm::uint i = begin; i < end; i++)
+                    {
+                        part[c]     += double(tc[c][i]) * rc[c][i];
+                        part[3 + c] += double(tc[c][i]) * tc[c][i];
+                    }
+                }
+            }
+        }
+
+        for(int c = 0; c < 3; c++)
+        {
+            double ts = 0.0, tt = 0.0;
+            for(int blk = 0; blk < nb_blocks; blk++)
+            {
+                ts += partials[blk * 6 + c];
+                tt += partials[blk * 6 + 3 + c];
+            }
+            omega[c] = (active[c] && tt > 0.0) ? float(ts / tt) : 0.0f;
+        }
+
+        // x += alpha y + omega z, r = s - omega t
+        #pragma omp parallel for schedule(static) num_threads(nb_used_threads)
+        for(int part = 0; part < nb_parts; part++)
+        {
+            for(int blk = m_part_blocks[part]; blk < int(m_part_blocks[part+1]); blk++)
+            {
+                glm::uint begin = blk * BLOCK_SIZE;
+                glm::uint end = glm::min(begin + BLOCK_SIZE, nb_rows);
+
+                double* part = &partials[blk * 6];
+                for(int c = 0; c < 3; c++)
+                {
+                    part[c] = part[3 + c] = 0.0;
+                    if(!active[c])
+                        continue;
+
+                    for(glm::uint i = begin; i < end; i++)
+                    {
+                        xc[c][i] += alpha[c] * yc[c][i] + omega[c] * zc[c][i];
+                        rc[c][i] -= omega[c] * tc[c][i];
+                        part[c]     += double(r0c[c][i]) * rc[c][i];
+                        part[3 + c] += double(rc[c][i]) * rc[c][i];
+                    }
+                }
+            }
+        }
+
+        float beta[3];
+        for(int c = 0; c < 3; c++)
+        {
+            beta[c] = 0.0f;
+            if(!active[c])
+                continue;
+
+            double rho_new = 0.0;
+            rr[c] = 0.0;
+            for(int blk = 0; blk < nb_blocks; blk++)
+            {
+                rho_new += partials[blk * 6 + c];
+                rr[c] += partials[blk * 6 + 3 + c];
+            }
+            active[c] = rr[c] > double(tolerance) * tolerance * bb[c];
+            if(active[c] && (rho_new == 0.0 || omega[c] == 0.0f))     // breakdown
+                active[c] = false;
+            if(active[c])
+                beta[c] = float((rho_new / rho[c]) * (alpha[c] / omega[c]));
+            rho[c] = rho_new;
+        }
+        iter++;
+
+        if(!(active[0] || active[1] || active[2]))
+            break;
+
+        // p = r + beta (p - omega v)
+        #pragma omp parallel for schedule(static) num_threads(nb_used_threads)
+        for(int part = 0; part < nb_parts; part++)
+        {
+            for(int blk = m_part_blocks[part]; blk < int(m_part_blocks[part+1]); blk++)
+            {
+                glm::uint begin = blk * BLOCK_SIZE;
+                glm::uint end = glm::min(begin + BLOCK_SIZE, nb_rows);
+
+                for(int c = 0; c < 3; c++)
+                {
+                    if(!active[c])
+                        continue;
+                    for(glm::uint i = begin; i < end; i++)
+                        pc[c][i] = rc[c][i] + beta[c] * (pc[c][i] - omega[c] * vc[c][i]);
+                }
+            }
+        }
+    }
+
+    return iter;
+}
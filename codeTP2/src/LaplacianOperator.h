@@ -0,0 +1,120 @@
+#ifndef LAPLACIAN_OPERATOR_H
+#define LAPLACIAN_OPERATOR_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp> // uint8
+
+#include <vector>
+
+#include "SimdKernels.h"
+
+class MeshHE;
+
+
+/// Weighting schemes of the laplacian operator
+enum LaplacianWeights
+{
+    UNIFORM_WEIGHTS,        /// umbrella operator : every neighbor weights 1/valence
+    COTANGENT_WEIGHTS,      /// (cot alpha + cot beta) / 2, normalized by row
+    MEAN_VALUE_WEIGHTS      /// (tan(gamma/2) + tan(delta/2)) / |p_j - p_i|, normalized by row (always positive, but the scaled rows are not symmetric)
+};
+
+
+/**
+ * @brief The LaplacianOperator class.
+ * Laplacian of a MeshHE assembled once as a sparse matrix in compressed
+ * sparse row form: (L p)_i = sum_j w_ij p_j - d_i p_i.
+ * The rows are normalized (d_i = sum_j w_ij = 1), border rows are empty with
+ * d_i = 0 so that border vertices stay fixed.
+ * The rows are stored in the vertex order of the MeshPartition of the mesh
+ * (the positions given to the filters must be in this order, see
+ * SoAPositions::Load), and each thread sweeps the blocks of one part.
+ * The rows are also cut in blocks of BLOCK_SIZE vertices, each block knowing
+ * its halo (the outside vertices of its 1-rings): this allows to apply a
+ * product of two smoothing steps in a single sweep over the vertices.
+ * Geometric weights are assembled from terms cached per half edge (the
+ * cotangent of the angle opposite to it, or the tangent of half the angle at
+ * its origin, in its face). RefreshWeights only recomputes the terms of the
+ * faces around the vertices moved by more than a tolerance since their last
+ * update, and the rows around these faces, so that following the positions
+ * costs little more than the uniform weights.
+ */
+class LaplacianOperator
+{
+public:
+
+    static const glm::uint BLOCK_SIZE = 1024;   /// Number of rows processed at once by a thread
+    static const float WEIGHT_TOLERANCE;        /// Default move, in mean edge lengths, after which the weights around a vertex are recomputed
+    static const glm::uint DENSE_REFRESH_RATIO = 8;     /// RefreshWeights recomputes everything when more than 1/DENSE_REFRESH_RATIO of the vertices are stale
+
+    LaplacianOperator() : m_weights(UNIFORM_WEIGHTS), m_epoch(0), m_weight_tolerance(WEIGHT_TOLERANCE), m_refresh_distance2(0.0f), m_nb_refreshed_rows(0), m_max_local_size(0) {}
+
+    void Build(const MeshHE& mesh, const LaplacianWeights weights, const float tolerance = WEIGHT_TOLERANCE);  /// Assembles the operator for the current positions of mesh
+    void RefreshWeights(const MeshHE& mesh);    /// Recomputes the geometric weights around the vertices moved by more than the tolerance since their last update
+    void Clear();
+
+    glm::uint NbRows() const { return m_diagonal.size(); }
+    glm::uint NbParts() const { return m_part_blocks.empty() ? 0 : m_part_blocks.size() - 1; }
+    LaplacianWeights GetWeights() const { return m_weights; }
+    float GetWeightTolerance() const { return m_weight_tolerance; }
+    glm::uint NbRefreshedRows() const { return m_nb_refreshed_rows; }   /// Rows recomputed by the last RefreshWeights
+    bool HasSmallHalos() const { return 4 * m_halo.size() <= m_diagonal.size(); }   /// True when TaubinStep is worth it (halos under 1/4 of the rows, i.e. a local vertex order)
+
+    // Filters (src and dst must be different buffers)
+    void Multiply(const SoAPositions& src, SoAPositions& dst, const int nb_threads) const;                                       /// dst = L src
+    void Step(const float lambda, const SoAPositions& src, SoAPositions& dst, const int nb_threads) const;                      /// dst = (I + lambda L) src
+    void TaubinStep(const float lambda, const float mu, const SoAPositions& src, SoAPositions& dst, const int nb_threads) const; /// dst = (I + mu L)(I + lambda L) src, in one sweep
+
+    // Implicit step
+    glm::uint SolveImplicit(const float lambda_dt, const SoAPositions& src, SoAPositions& dst,                 /// Solves (I - lambda_dt L) dst = src by preconditioned conjugate gradient (BiCGSTAB for mean value weights),
+                            const float tolerance, const glm::uint max_iter, const int nb_threads) const;      /// dst holding the initial guess. Returns the number of iterations
+
+public:
+
+    // Matrix
+    std::vector<glm::uint> m_offsets;           /// Start of each row in m_columns / m_values (NbRows()+1 entries)
+    std::vector< glm::uint, UninitializedAllocator<glm::uint> > m_columns;  /// Column (rank of the neighbor vertex) of each non zero entry
+    std::vector< float, UninitializedAllocator<float> > m_values;           /// Weight w_ij of each non zero entry
+    std::vector<float> m_diagonal;              /// d_i of each row
+    std::vector<float> m_row_scales;            /// Normalization factor of each row (valence, or sum of the geometric weights) : scaled rows are symmetric (except for mean value weights)
+
+    LaplacianWeights m_weights;                 /// Weighting scheme used by the last Build
+
+    // Geometric weights cache
+    std::vector<glm::uint> m_entry_he;          /// Half edge from the row vertex to the column vertex of each non zero entry
+    std::vector<float> m_he_terms;              /// Term of the face of each half edge in the weights of its edge (cotangent of the opposite angle, or tangent of half the angle at its origin)
+    std::vector<glm::vec3> m_weight_positions;  /// Position of each vertex when the terms around it were last computed
+    std::vector<glm::uint8> m_vertex_stale;     /// Vertices moved beyond the tolerance (by the current RefreshWeights)
+    std::vector<glm::uint> m_stale_vertices;    /// Same vertices, as a list
+    std::vector<glm::uint> m_row_epochs;        /// Last RefreshWeights which recomputed each row
+    glm::uint m_epoch;                          /// Number of the current RefreshWeights
+    float m_weight_tolerance;                   /// Tolerance given to the last Build, in mean edge lengths
+    float m_refresh_distance2;                  /// Squared tolerance, in distance
+    glm::uint m_nb_refreshed_rows;
+
+    // Parts
+    std::vector<glm::uint> m_part_blocks;       /// First block of each part of the partition, and the number of blocks
+
+    // Blocks
+    std::vector<glm::uint> m_halo_offsets;      /// Start of the halo of each block in m_halo
+    std::vector<glm::uint> m_halo;              /// Outside vertices referenced by the rows of each block
+    std::vector< glm::uint, UninitializedAllocator<glm::uint> > m_local_columns;    /// m_columns renumbered inside the block : row of the block, or BLOCK_SIZE + rank in the halo
+    std::vector<glm::uint> m_halo_rows;         /// Start of the row of each m_halo entry in m_halo_columns / m_halo_values (m_halo.size()+1 entries)
+    std::vector<glm::uint> m_halo_columns;      /// Copy of the rows of the halo vertices, contiguous so that they can be processed in batch
+    std::vector<float> m_halo_values;
+    std::vector<float> m_halo_diagonal;
+    glm::uint m_max_local_size;                 /// Largest block + halo size
+
+private:
+
+    void BuildUniformRows(const MeshHE& mesh);
+    void ComputeFaceTerms(const MeshHE& mesh, const glm::uint f);      /// m_he_terms of the three half edges of face f
+    void AssembleRow(const MeshHE& mesh, const glm::uint r);            /// Normalized geometric weights of row r, from m_he_terms
+    glm::uint RefreshAll(const MeshHE& mesh);                           /// Recomputes all the terms and rows, returns the number of rows refreshed
+    glm::uint RefreshStaleNeighborhoods(const MeshHE& mesh);            /// Only visits the neighborhoods of the stale vertices
+    void BuildBlocks();
+    glm::uint SolveBiCGStab(const std::vector<float>& a_values, const std::vector<float>& a_diagonal, const std::vector<float>& inv_diagonal,    /// Non symmetric systems of SolveImplicit
+                            const SoAPositions& b, SoAPositions& x, const float tolerance, const glm::uint max_iter, const int nb_threads) const;
+};
+
+#endif // LAPLACIAN_OPERATOR_H
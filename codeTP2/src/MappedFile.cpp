@@ -0,0 +1,68 @@
+#include <MappedFile.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+void MappedFile::Close()
+{
+    if(m_mapped)
+        munmap((void*)m_data, m_size);
+
+    m_data = NULL;
+    m_size = 0;
+    m_mapped = false;
+    vector<char>().swap(m_buffer);
+}
+
+/**
+ * @brief MappedFile::Open
+ * The file opened before, if any, is closed first.
+ */
+bool MappedFile::Open(const char* filename)
+{
+    Close();
+
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    struct stat st;
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data != MAP_FAILED)
+        {
+            madvise(data, st.st_size, MADV_WILLNEED);
+            m_data = (const char*)data;
+            m_size = st.st_size;
+            m_mapped = true;
+            close(fd);
+            return true;
+        }
+    }
+
+    char buffer[1 << 16];
+    ssize_t nb_read;
+    while((nb_read = read(fd, buffer, sizeof(buffer))) > 0)
+        m_buffer.insert(m_buffer.end(), buffer, buffer + nb_read);
+    close(fd);
+
+    if(nb_read < 0)
+    {
+        Close();
+        return false;
+    }
+    m_data = m_buffer.empty() ? "" : &m_buffer[0];
+    m_size = m_buffer.size();
+    return true;
+}
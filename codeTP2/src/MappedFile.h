@@ -0,0 +1,38 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <vector>
+#include <cstddef>
+
+
+/**
+ * @brief The MappedFile class.
+ * Read only view of a whole file, memory mapped when possible
+ * (read in a buffer otherwise, e.g. for pipes).
+ */
+class MappedFile
+{
+public:
+
+    MappedFile() : m_data(NULL), m_size(0), m_mapped(false) {}
+    ~MappedFile();
+
+    bool Open(const char* filename);            /// Maps the file, returns false if it cannot be read
+    void Close();                               /// Releases the mapping (or the buffer)
+
+    const char* Begin() const { return m_data; }
+    const char* End() const   { return m_data + m_size; }
+    size_t Size() const       { return m_size; }
+
+private:
+
+    MappedFile(const MappedFile&);              /// Not copyable
+    MappedFile& operator=(const MappedFile&);
+
+    const char* m_data;
+    size_t m_size;
+    bool m_mapped;
+    std::vector<char> m_buffer;                 /// Storage when the file could not be mapped
+};
+
+#endif // MAPPED_FILE_H
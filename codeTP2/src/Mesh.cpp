@@ -1,9 +1,16 @@
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <algorithm>
 #include <math.h>
+#ifdef _OPENMP
 #include <omp.h>
+#endif
 
 #include <Mesh.h>
+#include <MappedFile.h>
+#include <OffParsing.h>
+#include <Trace.h>
 
 using namespace glm;
 using namespace std;
@@ -22,72 +29,230 @@ vec3 Mesh::get_normal(unsigned int i) {
 }
 
 
-Mesh::Mesh(const char* filename) 
+Mesh::Mesh(const char* filename)
 {
-	int j = 0;
-    unsigned int tmp;
-	float *n;
-	FILE *file;
-	int   error;
-	float r;
-
-	if((file=fopen(filename,"r"))==NULL) 
-	{
-		std::cout << "Unable to read : " << filename << std::endl;
-	}
+    if(!LoadOFF(filename))
+        exit(EXIT_FAILURE);
+}
 
-	// create mesh
-	vertices = vector<vec3>();
-    normals  = vector<vec3>();
-	faces    = vector<unsigned int>();
+Mesh::~Mesh() {}
 
-    glm::uint nb_vertices, nb_faces;
 
-	error = fscanf(file,"OFF\n%d %d %d\n",&(nb_vertices),&(nb_faces),&tmp);
-	if(error==EOF) 
-	{
-		std::cout << "Unable to read : " << filename << std::endl;
-	}
+//***************
+// OFF loading
 
-	vertices.resize(nb_vertices);
-    normals.resize(nb_vertices);
-	faces.resize(nb_faces*3);
+/// First error met by a parsing chunk
+struct ParseError
+{
+    ParseError() : line(NULL_LINE) {}
+
+    static const glm::uint NULL_LINE = 0xFFFFFFFF;
+    glm::uint line;             /// Line number in the file (1 based)
+    std::string message;
+};
+
+/**
+ * @brief Mesh::LoadOFF
+ * Loads a triangular mesh from an OFF file.
+ * The file is memory mapped; after the header, the data is cut in chunks of
+ * whole lines parsed in parallel: a first pass counts the data lines of each
+ * chunk (comments and empty lines are skipped), which tells each chunk the
+ * index of its first vertex / face, then a second pass parses the numbers
+ * with std::from_chars directly into the preallocated arrays.
+ * Errors are printed with their line number and leave the mesh empty.
+ * @param filename
+ * @return false if the file could not be read or is not a valid triangular OFF file
+ */
+bool Mesh::LoadOFF(const char* filename)
+{
+    TRACE_ZONE("load OFF");
 
-	// reading vertices
-	for(int i=0;i<nb_vertices;++i) 
-	{
-		error = fscanf(file,"%f %f %f\n",&(vertices[i][0]),&(vertices[i][1]),&(vertices[i][2]));
-		if(error==EOF) 
-		{
-			std::cout << "Unable to read vertices of : " << filename << std::endl;
-			exit(EXIT_FAILURE);
-		}
-	}
+    vertices.clear();
+    normals.clear();
+    faces.clear();
 
-	// reading faces
-	j = 0;
-	for(int i=0;i<nb_faces;++i) 
-	{
-        error = fscanf(file,"%d %d %d %d\n",&tmp,&(faces[j]),&(faces[j+1]),&(faces[j+2]));
-
-		if(error==EOF) 
-		{
-			std::cout << "Unable to read faces of : " << filename << std::endl;
-			exit(EXIT_FAILURE);
-		}
-
-		if(tmp!=3) 
-		{
-			printf("Error : face %d is not a triangle (%d polygonal face!)\n",i/3,tmp);
-			exit(EXIT_FAILURE);
-		}
-		j += 3;
-	}
+    MappedFile file;
+    if(!file.Open(filename))
+    {
+        std::cerr << "Unable to read : " << filename << std::endl;
+        return false;
+    }
+
+    const char* c = file.Begin();
+    const char* end = file.End();
+    glm::uint nb_header_lines = 1;
+
+    // Header : "OFF" then the numbers of vertices, faces and edges
+    c = SkipSpacesAndComments(c, end, nb_header_lines);
+    if(!IsOFFKeyword(c, end))
+    {
+        std::cerr << filename << ":" << nb_header_lines << ": missing OFF header" << std::endl;
+        return false;
+    }
+    c += 3;
+
+    glm::uint counts[3];
+    for(int i = 0; i < 3; i++)
+    {
+        c = SkipSpacesAndComments(c, end, nb_header_lines);
+        if(!ParseNumber(c, end, counts[i]))
+        {
+            std::cerr << filename << ":" << nb_header_lines << ": invalid element counts" << std::endl;
+            return false;
+        }
+    }
+    glm::uint nb_vertices = counts[0];
+    glm::uint nb_faces = counts[1];
+
+    while(c < end && *c != '\n')
+        c++;
+    if(c < end)
+    {
+        c++;
+        nb_header_lines++;
+    }
+
+    // Each element needs at least two characters (a digit and a newline)
+    if(size_t(nb_vertices) + nb_faces > size_t(end - c))
+    {
+        std::cerr << filename << ": " << nb_vertices << " vertices and " << nb_faces << " faces announced, but the file is too small" << std::endl;
+        return false;
+    }
+
+    vertices.resize(nb_vertices);
+    faces.resize(3*size_t(nb_faces));
+
+    // Chunks of whole lines
+    const size_t min_chunk_size = 1 << 16;
+    int nb_threads = 1;
+#ifdef _OPENMP
+    nb_threads = omp_get_max_threads();
+#endif
+    size_t nb_chunks = std::max(size_t(1), std::min(size_t(4 * nb_threads), size_t(end - c) / min_chunk_size));
+
+    std::vector<const char*> chunks(nb_chunks+1);
+    chunks[0] = c;
+    chunks[nb_chunks] = end;
+    for(size_t i = 1; i < nb_chunks; i++)
+    {
+        const char* p = std::max(chunks[i-1], c + (end - c) * i / nb_chunks);
+        while(p < end && p[-1] != '\n')
+            p++;
+        chunks[i] = p;
+    }
+
+    // First pass : numbers of lines and of data lines of each chunk
+    std::vector<glm::uint> chunk_lines(nb_chunks+1, 0);
+    std::vector<glm::uint> chunk_data(nb_chunks+1, 0);
+
+    #pragma omp parallel for schedule(dynamic)
+    for(int i = 0; i < int(nb_chunks); i++)
+    {
+        const char* p = chunks[i];
+        while(p < chunks[i+1])
+        {
+            const char* eol = (const char*)memchr(p, '\n', chunks[i+1] - p);
+            if(!eol)
+                eol = chunks[i+1];
+
+            if(IsDataLine(p, eol))
+                chunk_data[i+1]++;
+            chunk_lines[i+1]++;
+            p = eol + 1;
+        }
+    }
+
+    chunk_lines[0] = nb_header_lines;
+    for(size_t i = 0; i < nb_chunks; i++)
+    {
+        chunk_lines[i+1] += chunk_lines[i];
+        chunk_data[i+1] += chunk_data[i];
+    }
+
+    if(chunk_data[nb_chunks] < size_t(nb_vertices) + nb_faces)
+    {
+        std::cerr << filename << ": unexpected end of file (" << chunk_data[nb_chunks] << " data lines for "
+                  << nb_vertices << " vertices and " << nb_faces << " faces)" << std::endl;
+        vertices.clear();
+        faces.clear();
+        return false;
+    }
+
+    // Second pass : parsing
+    std::vector<ParseError> errors(nb_chunks);
+
+    #pragma omp parallel for schedule(dynamic)
+    for(int i = 0; i < int(nb_chunks); i++)
+    {
+        const char* p = chunks[i];
+        glm::uint line = chunk_lines[i];
+        glm::uint element = chunk_data[i];
+
+        while(p < chunks[i+1] && element < nb_vertices + nb_faces)
+        {
+            const char* eol = (const char*)memchr(p, '\n', chunks[i+1] - p);
+            if(!eol)
+                eol = chunks[i+1];
+
+            if(IsDataLine(p, eol))
+            {
+                if(element < nb_vertices)
+                {
+                    vec3& v = vertices[element];
+                    if(!ParseNumber(p, eol, v.x) || !ParseNumber(p, eol, v.y) || !ParseNumber(p, eol, v.z))
+                    {
+                        errors[i].line = line;
+                        errors[i].message = "invalid vertex";
+                        break;
+                    }
+                }
+                else
+                {
+                    glm::uint face = element - nb_vertices;
+                    glm::uint degree;
+                    glm::uint* f = &faces[3*size_t(face)];
+                    if(!ParseNumber(p, eol, degree) || (degree == 3 && (!ParseNumber(p, eol, f[0]) || !ParseNumber(p, eol, f[1]) || !ParseNumber(p, eol, f[2]))))
+                    {
+                        errors[i].line = line;
+                        errors[i].message = "invalid face";
+                        break;
+                    }
+                    if(degree != 3)
+                    {
+                        errors[i].line = line;
+                        errors[i].message = "face " + std::to_string(face) + " is not a triangle (" + std::to_string(degree) + " polygonal face)";
+                        break;
+                    }
+                    if(f[0] >= nb_vertices || f[1] >= nb_vertices || f[2] >= nb_vertices)
+                    {
+                        errors[i].line = line;
+                        errors[i].message = "vertex index out of range in face " + std::to_string(face);
+                        break;
+                    }
+                }
+                element++;
+            }
+            line++;
+            p = eol + 1;
+        }
+    }
+
+    for(size_t i = 0; i < nb_chunks; i++)
+    {
+        if(errors[i].line != ParseError::NULL_LINE)
+        {
+            std::cerr << filename << ":" << errors[i].line << ": " << errors[i].message << std::endl;
+            vertices.clear();
+            faces.clear();
+            return false;
+        }
+    }
 
-    fclose(file);
+    normals.resize(nb_vertices);
+    return true;
 }
 
-Mesh::~Mesh() {}
+
 
 
 vector< vec3 > Mesh::computeBB() const 
@@ -429,68 +594,303 @@ void Mesh::ComputeNormals()
     }
 }
 
-void Mesh::RemoveDouble(float epsilon)
+//***************
+// Vertex welding
+
+/// Vertex sorted by the hash of its grid cell
+struct CellEntry
 {
-    vector<unsigned int> dbl;
-    for(unsigned int i=0; i<vertices.size(); i++)
-        dbl.push_back(i);
+    glm::uint key;
+    glm::uint vertex;
+    vec3 position;
+};
 
-    for(unsigned int i=0; i<vertices.size()-1; i++)
-    {
-        if(dbl[i] != i)
-            continue;
+/// Slot of the open addressing table of the cells
+struct CellSlot
+{
+    glm::uint key;
+    glm::uint start;            /// First entry of the cell in the sorted entries, NULL_CELL for an empty slot
+};
+
+static const glm::uint NULL_CELL = 0xFFFFFFFF;
 
-        for(unsigned int j=i+1; j<vertices.size(); j++)
+static inline glm::uint CellKey(glm::int64 x, glm::int64 y, glm::int64 z)
+{
+    // splitmix64 finalizer of the packed coordinates: distinct cells only share
+    // a key by a (harmless) collision
+    glm::uint64 h = glm::uint64(x) * 0x9E3779B97F4A7C15ull ^ glm::uint64(y) * 0xC2B2AE3D27D4EB4Full ^ glm::uint64(z) * 0x165667B19E3779F9ull;
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+    return glm::uint(h ^ (h >> 32));
+}
+
+static inline glm::int64 CellCoordinate(const float x, const double inv_cell_size)
+{
+    double c = floor(double(x) * inv_cell_size);
+    return glm::int64(std::max(-1e15, std::min(1e15, c)));     // also maps NaN to a valid cell
+}
+
+/**
+ * Sorts the entries by key with a stable LSD radix sort (4 passes of 8 bits);
+ * they are initially in vertex order, so they end up sorted by (key, vertex).
+ * Each thread counts then scatters a contiguous range of entries.
+ */
+static void SortByCell(vector<CellEntry>& cells)
+{
+    int nb_entries = cells.size();
+    int nb_threads = 1;
+#ifdef _OPENMP
+    nb_threads = std::max(1, std::min(omp_get_max_threads(), nb_entries / 16384));
+#endif
+    vector<CellEntry> tmp(nb_entries);
+    vector<glm::uint> counts(256 * nb_threads);
+
+    for(int shift = 0; shift < 32; shift += 8)
+    {
+        #pragma omp parallel num_threads(nb_threads)
         {
-            if(length(vertices[i] - vertices[j]) < epsilon)
+            int t = 0;
+#ifdef _OPENMP
+            t = omp_get_thread_num();
+#endif
+            int begin = glm::int64(nb_entries) * t / nb_threads;
+            int end = glm::int64(nb_entries) * (t+1) / nb_threads;
+            glm::uint* count = &counts[256 * t];
+
+            std::fill(count, count + 256, 0);
+            for(int i = begin; i < end; i++)
+                count[(cells[i].key >> shift) & 255]++;
+
+            #pragma omp barrier
+            #pragma omp single
             {
-                dbl[j] = i;
+                // Exclusive prefix sum in (digit, thread) order
+                glm::uint offset = 0;
+                for(int d = 0; d < 256; d++)
+                {
+                    for(int u = 0; u < nb_threads; u++)
+                    {
+                        glm::uint c = counts[256 * u + d];
+                        counts[256 * u + d] = offset;
+                        offset += c;
+                    }
+                }
             }
+
+            for(int i = begin; i < end; i++)
+                tmp[count[(cells[i].key >> shift) & 255]++] = cells[i];
         }
+        cells.swap(tmp);
+    }
+}
+
+static glm::uint FindRoot(vector<glm::uint>& parent, glm::uint v)
+{
+    while(parent[v] != v)
+    {
+        parent[v] = parent[parent[v]];
+        v = parent[v];
+    }
+    return v;
+}
+
+/**
+ * @brief Mesh::RemoveDouble
+ * Welds the vertices closer than epsilon (transitively: chains of close
+ * vertices become one vertex, the one of lowest index).
+ * The vertices are hashed on a grid of cells of size 4 epsilon and sorted by
+ * cell, so each vertex is only compared with the vertices of its own cell and
+ * of the neighbor cells it is closer than epsilon to (at most 7, 2.4 on
+ * average). An occupancy bitmap small enough to stay in cache skips most of
+ * the empty neighbor cells.
+ * The faces are remapped, and those which become degenerate (two identical
+ * vertices) are removed. The remaining vertices keep their relative order.
+ * @param epsilon
+ * @return the new index of each old vertex
+ */
+vector<glm::uint> Mesh::RemoveDouble(float epsilon)
+{
+    int nb_vertices = vertices.size();
+    vector<glm::uint> remap(nb_vertices);
+
+    double cell_size = 4.0 * epsilon;
+    double inv_cell_size = 1.0 / cell_size;
+    float epsilon2 = epsilon * epsilon;
+
+    // Vertices sorted by cell
+    vector<CellEntry> cells(nb_vertices);
+
+    #pragma omp parallel for schedule(static)
+    for(int i = 0; i < nb_vertices; i++)
+    {
+        const vec3& p = vertices[i];
+        cells[i].key = CellKey(CellCoordinate(p.x, inv_cell_size), CellCoordinate(p.y, inv_cell_size), CellCoordinate(p.z, inv_cell_size));
+        cells[i].vertex = i;
+        cells[i].position = p;
     }
 
+    SortByCell(cells);
+
+    // Open addressing table of the non empty cells, and their occupancy bitmap
+    glm::uint table_size = 16;
+    while(table_size < 2 * glm::uint(nb_vertices))
+        table_size *= 2;
+    glm::uint nb_bits = 8 * table_size;
+    CellSlot empty_slot = { 0, NULL_CELL };
+    vector<CellSlot> table(table_size, empty_slot);
+    vector<glm::uint64> occupied(nb_bits / 64, 0);
 
-    for(unsigned int i=0; i<vertices.size(); i++)
+    for(int s = 0; s < nb_vertices; s++)
     {
-        while(dbl[dbl[i]] != dbl[i])
+        glm::uint key = cells[s].key;
+        if(s > 0 && key == cells[s-1].key)
+            continue;
+
+        glm::uint slot = key & (table_size - 1);
+        while(table[slot].start != NULL_CELL)
+            slot = (slot + 1) & (table_size - 1);
+        table[slot].key = key;
+        table[slot].start = s;
+        occupied[(key & (nb_bits - 1)) / 64] |= glm::uint64(1) << (key % 64);
+    }
+
+    // Pairs of vertices closer than epsilon (j > i), found in parallel in cell order
+    int nb_threads = 1;
+#ifdef _OPENMP
+    nb_threads = omp_get_max_threads();
+#endif
+    vector< vector< pair<glm::uint, glm::uint> > > thread_pairs(nb_threads);
+
+    #pragma omp parallel num_threads(nb_threads)
+    {
+        int t = 0;
+#ifdef _OPENMP
+        t = omp_get_thread_num();
+#endif
+        vector< pair<glm::uint, glm::uint> >& pairs = thread_pairs[t];
+
+        #pragma omp for schedule(static)
+        for(int s = 0; s < nb_vertices; s++)
         {
-            dbl[i] = dbl[dbl[i]];
+            const CellEntry& e = cells[s];
+
+            // Own cell : the vertices of lower index are just before
+            for(int t = s - 1; t >= 0 && cells[t].key == e.key; t--)
+            {
+                vec3 d = cells[t].position - e.position;
+                if(dot(d, d) < epsilon2)
+                    pairs.push_back(make_pair(e.vertex, cells[t].vertex));
+            }
+
+            glm::int64 c[3], first[3], last[3];
+            for(int k = 0; k < 3; k++)
+            {
+                c[k] = CellCoordinate(e.position[k], inv_cell_size);
+                first[k] = (double(e.position[k]) - epsilon) * inv_cell_size < double(c[k])     ? c[k] - 1 : c[k];
+                last[k]  = (double(e.position[k]) + epsilon) * inv_cell_size >= double(c[k] + 1) ? c[k] + 1 : c[k];
+            }
+
+            // Neighbor cells
+            for(glm::int64 x = first[0]; x <= last[0]; x++)
+            for(glm::int64 y = first[1]; y <= last[1]; y++)
+            for(glm::int64 z = first[2]; z <= last[2]; z++)
+            {
+                if(x == c[0] && y == c[1] && z == c[2])
+                    continue;
+
+                glm::uint key = CellKey(x, y, z);
+                if(!(occupied[(key & (nb_bits - 1)) / 64] & (glm::uint64(1) << (key % 64))))
+                    continue;
+
+                glm::uint slot = key & (table_size - 1);
+                while(table[slot].start != NULL_CELL && table[slot].key != key)
+                    slot = (slot + 1) & (table_size - 1);
+
+                for(glm::uint t = table[slot].start; t < glm::uint(nb_vertices) && cells[t].key == key && cells[t].vertex < e.vertex; t++)
+                {
+                    vec3 d = cells[t].position - e.position;
+                    if(dot(d, d) < epsilon2)
+                        pairs.push_back(make_pair(e.vertex, cells[t].vertex));
+                }
+            }
         }
     }
 
-    vector<vec3> new_vertices;
-    vector<int> corresp;
+    // Clusters (union find, the root is the lowest index)
+    vector<glm::uint> parent(nb_vertices);
+    for(int i = 0; i < nb_vertices; i++)
+        parent[i] = i;
 
-    for(unsigned int i=0; i<vertices.size(); i++)
+    for(int t = 0; t < nb_threads; t++)
     {
-        if(dbl[i] == i)
+        for(size_t k = 0; k < thread_pairs[t].size(); k++)
         {
-            corresp.push_back(new_vertices.size());
-            new_vertices.push_back(vertices[i]);
-            continue;
+            glm::uint a = FindRoot(parent, thread_pairs[t][k].first);
+            glm::uint b = FindRoot(parent, thread_pairs[t][k].second);
+            if(a < b)
+                parent[b] = a;
+            else if(b < a)
+                parent[a] = b;
         }
+    }
 
-        corresp.push_back(-1);
+    // New indices of the kept vertices, then of all the vertices
+    glm::uint nb_kept = 0;
+    for(int i = 0; i < nb_vertices; i++)
+    {
+        if(parent[i] == glm::uint(i))
+            remap[i] = nb_kept++;
     }
 
+    bool has_normals = normals.size() == vertices.size();
+    vector<vec3> new_vertices(nb_kept);
+    vector<vec3> new_normals(has_normals ? nb_kept : 0);
 
-    for(unsigned int i=0; i<vertices.size(); i++)
+    #pragma omp parallel for schedule(static)
+    for(int i = 0; i < nb_vertices; i++)
     {
-        while(corresp[i] == -1)
+        glm::uint root = i;
+        while(parent[root] != root)
+            root = parent[root];
+
+        if(root == glm::uint(i))
+        {
+            new_vertices[remap[i]] = vertices[i];
+            if(has_normals)
+                new_normals[remap[i]] = normals[i];
+        }
+        else
         {
-            corresp[i] = corresp[dbl[i]];
+            remap[i] = remap[root];     // roots are not modified by this loop
         }
     }
 
+    vertices.swap(new_vertices);
+    if(has_normals)
+        normals.swap(new_normals);
+
+    // Faces
+    int nb_faces = faces.size() / 3;
 
+    #pragma omp parallel for schedule(static)
+    for(int f = 0; f < 3 * nb_faces; f++)
+        faces[f] = remap[faces[f]];
 
-    for(unsigned int i=0; i<faces.size(); i++)
+    glm::uint nb_kept_faces = 0;
+    for(int f = 0; f < nb_faces; f++)
     {
-        faces[i] = corresp[faces[i]];
-    }
+        glm::uint a = faces[3*f], b = faces[3*f+1], c = faces[3*f+2];
+        if(a == b || b == c || c == a)
+            continue;
 
-    vertices = new_vertices;
+        faces[3*nb_kept_faces  ] = a;
+        faces[3*nb_kept_faces+1] = b;
+        faces[3*nb_kept_faces+2] = c;
+        nb_kept_faces++;
+    }
+    faces.resize(3 * nb_kept_faces);
 
+    return remap;
 }
 
 
@@ -14,7 +14,7 @@ public:
 
     // Constructors
     Mesh(){}
-    Mesh(const char* filename);
+    Mesh(const char* filename);                 /// Loads an OFF file (exits on error)
     ~Mesh();
 
     // Accessors
@@ -24,11 +24,12 @@ public:
 
     // utils
     void ComputeNormals();
-    void RemoveDouble(float epsilon = 1e-5);
+    std::vector<glm::uint> RemoveDouble(float epsilon = 1e-5);   /// Welds the vertices closer than epsilon, returns the new index of each old vertex
     std::vector< glm::vec3 > computeBB() const ;
     void normalize();
 
     // i/o
+    bool LoadOFF(const char* filename);         /// Loads a triangular OFF file, returns false (with a message on std::cerr) on error
     void write_obj(const char* filename) const;
 
     // primitives
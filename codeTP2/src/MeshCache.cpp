@@ -0,0 +1,373 @@
+#include <MeshCache.h>
+#include <MeshHE.h>
+#include <Mesh.h>
+#include <MappedFile.h>
+#include <Trace.h>
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+
+using namespace glm;
+using namespace std;
+
+const glm::uint MeshCache::VERSION;
+
+
+//***************
+// File layout
+
+static const char CACHE_MAGIC[8] = { 'M', 'E', 'S', 'H', 'H', 'E', 'C', '\n' };
+static const glm::uint32 CACHE_ENDIANNESS = 0x01020304;
+static const glm::uint64 SECTION_ALIGNMENT = 64;
+
+enum CacheSections
+{
+    POSITIONS_SECTION,          /// vec3 per vertex
+    NORMALS_SECTION,            /// vec3 per vertex
+    INDICES_SECTION,            /// Origin vertex of each half edge, i.e. the 3 vertices of each face
+    NEXT_SECTION,               /// Next half edge of each half edge
+    TWIN_SECTION,               /// Twin half edge of each half edge (NULL_INDEX on borders)
+    VERTEX_HE_SECTION,          /// Outgoing half edge of each vertex
+    NB_SECTIONS
+};
+
+struct CacheSection
+{
+    glm::uint64 offset;         /// From the start of the file, multiple of SECTION_ALIGNMENT
+    glm::uint64 size;           /// In bytes
+};
+
+struct CacheHeader
+{
+    char magic[8];
+    glm::uint32 version;
+    glm::uint32 endianness;     /// CACHE_ENDIANNESS as stored by the writer
+    glm::uint64 source_size;
+    glm::int64 source_mtime;
+    glm::uint64 source_hash;
+    glm::uint32 nb_vertices;
+    glm::uint32 nb_faces;
+    glm::uint32 nb_half_edges;
+    glm::uint32 nb_non_manifold_edges;
+    glm::uint64 payload_hash;   /// Hash of the sections, in order
+    CacheSection sections[NB_SECTIONS];
+};
+
+static_assert(sizeof(CacheHeader) == 64 + 16*NB_SECTIONS, "CacheHeader must not be padded");
+
+/// The cache files are little endian, they are simply disabled on big endian hosts
+static bool IsLittleEndian()
+{
+    const glm::uint32 one = 1;
+    return *(const char*)&one == 1;
+}
+
+static const glm::uint64 FNV_OFFSET_BASIS = 14695981039346656037ULL;
+
+/// FNV-1a (64 bits) fed with 8 bytes words rather than single bytes, which
+/// is 8 times less multiplications for the same sensitivity to any change
+static glm::uint64 HashBytes(const char* data, const size_t size, glm::uint64 hash)
+{
+    const char* c = data;
+    const char* end = data + size;
+    for(; c + 8 <= end; c += 8)
+    {
+        glm::uint64 word;
+        memcpy(&word, c, 8);
+        hash ^= word;
+        hash *= 1099511628211ULL;
+    }
+    for(; c < end; c++)
+    {
+        hash ^= (unsigned char)*c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static glm::uint64 AlignSection(const glm::uint64 offset)
+{
+    return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+}
+
+
+//***************
+// Cache
+
+/**
+ * @brief MeshCache::Load
+ * Same processing as a plain load (LoadOFF, normalize, ComputeNormals then
+ * half edge conversion), skipped when the cache of the file is up to date.
+ * @param off_filename
+ * @param mesh
+ * @return false if the mesh could not be loaded at all
+ */
+bool MeshCache::Load(const char* off_filename, MeshHE &mesh)
+{
+    TRACE_ZONE("mesh load");
+
+    MeshSourceKey key;
+    bool has_key = IsLittleEndian() && ComputeKey(off_filename, key);
+    string cache_filename = CacheFilename(off_filename);
+
+    if(has_key && Read(cache_filename.c_str(), key, mesh))
+        return true;
+
+    Mesh m;
+    if(!m.LoadOFF(off_filename))
+        return false;
+
+    m.normalize();
+    m.ComputeNormals();
+    mesh = MeshHE(m);
+
+    if(has_key && !Write(cache_filename.c_str(), key, mesh))
+    {
+        cerr << "Warning : unable to write the mesh cache " << cache_filename << endl;
+    }
+    return true;
+}
+
+bool MeshCache::ComputeKey(const char* filename, MeshSourceKey &key)
+{
+    struct stat st;
+    if(stat(filename, &st) != 0)
+        return false;
+
+    MappedFile file;
+    if(!file.Open(filename))
+        return false;
+
+    key.size = file.Size();
+    key.mtime = glm::int64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    key.hash = HashBytes(file.Begin(), file.Size(), FNV_OFFSET_BASIS);
+    return true;
+}
+
+/**
+ * @brief MeshCache::Read
+ * Checks the header, the key, the bounds and hash of the sections and the
+ * bounds of every index before filling the mesh, so that a stale or corrupted cache is simply
+ * ignored.
+ */
+bool MeshCache::Read(const char* cache_filename, const MeshSourceKey &key, MeshHE &mesh)
+{
+    TRACE_ZONE("read cache");
+
+    if(!IsLittleEndian())
+        return false;
+
+    MappedFile file;
+    if(!file.Open(cache_filename) || file.Size() < sizeof(CacheHeader))
+        return false;
+
+    CacheHeader header;
+    memcpy(&header, file.Begin(), sizeof(CacheHeader));
+
+    MeshSourceKey cache_key;
+    cache_key.size = header.source_size;
+    cache_key.mtime = header.source_mtime;
+    cache_key.hash = header.source_hash;
+
+    if(memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.version != VERSION
+            || header.endianness != CACHE_ENDIANNESS || !(cache_key == key)
+            || glm::uint64(header.nb_half_edges) != 3 * glm::uint64(header.nb_faces))
+        return false;
+
+    glm::uint nb_vertices = header.nb_vertices;
+    glm::uint nb_faces = header.nb_faces;
+    glm::uint nb_half_edges = header.nb_half_edges;
+
+    const glm::uint64 expected_sizes[NB_SECTIONS] = {
+        glm::uint64(nb_vertices) * sizeof(vec3),
+        glm::uint64(nb_vertices) * sizeof(vec3),
+        glm::uint64(nb_half_edges) * sizeof(glm::uint),
+        glm::uint64(nb_half_edges) * sizeof(glm::uint),
+        glm::uint64(nb_half_edges) * sizeof(glm::uint),
+        glm::uint64(nb_vertices) * sizeof(glm::uint)
+    };
+
+    for(int s = 0; s < NB_SECTIONS; s++)
+    {
+        const CacheSection& section = header.sections[s];
+        if(section.offset % SECTION_ALIGNMENT != 0 || section.size != expected_sizes[s]
+                || section.offset > file.Size() || section.size > file.Size() - section.offset)
+            return false;
+    }
+
+    const char* data = file.Begin();
+    const CacheSection* sections = header.sections;
+
+    glm::uint64 payload_hash = FNV_OFFSET_BASIS;
+    for(int s = 0; s < NB_SECTIONS; s++)
+        payload_hash = HashBytes(data + sections[s].offset, sections[s].size, payload_hash);
+
+    if(payload_hash != header.payload_hash)
+    {
+        cerr << "Warning : corrupted mesh cache " << cache_filename << ", ignored." << endl;
+        return false;
+    }
+
+    mesh.ClearRessources();
+    mesh.m_positions.resize(nb_vertices);
+    mesh.m_normals.resize(nb_vertices);
+    mesh.m_he_vertex.resize(nb_half_edges);
+    mesh.m_he_next.resize(nb_half_edges);
+    mesh.m_he_twin.resize(nb_half_edges);
+    mesh.m_vertex_he.resize(nb_vertices);
+
+    if(nb_vertices > 0)
+    {
+        memcpy(&mesh.m_positions[0].x, data + sections[POSITIONS_SECTION].offset, sections[POSITIONS_SECTION].size);
+        memcpy(&mesh.m_normals[0].x, data + sections[NORMALS_SECTION].offset, sections[NORMALS_SECTION].size);
+        memcpy(&mesh.m_vertex_he[0], data + sections[VERTEX_HE_SECTION].offset, sections[VERTEX_HE_SECTION].size);
+    }
+    if(nb_half_edges > 0)
+    {
+        memcpy(&mesh.m_he_vertex[0], data + sections[INDICES_SECTION].offset, sections[INDICES_SECTION].size);
+        memcpy(&mesh.m_he_next[0], data + sections[NEXT_SECTION].offset, sections[NEXT_SECTION].size);
+        memcpy(&mesh.m_he_twin[0], data + sections[TWIN_SECTION].offset, sections[TWIN_SECTION].size);
+    }
+
+    // Half edge 3*f+j belongs to face f and is followed by 3*f+(j+1)%3 ; the
+    // rest of the code relies on it, as on the symmetry of the twins, so both
+    // are checked along with the index ranges
+    mesh.m_he_face.resize(nb_half_edges);
+    mesh.m_face_he.resize(nb_faces);
+    bool valid = true;
+
+    #pragma omp parallel for reduction(&&:valid)
+    for(int he = 0; he < int(nb_half_edges); he++)
+    {
+        mesh.m_he_face[he] = he / 3;
+        if(he % 3 == 0)
+            mesh.m_face_he[he / 3] = he;
+
+        glm::uint next = he - he % 3 + (he + 1) % 3;
+        glm::uint twin = mesh.m_he_twin[he];
+
+        valid = valid && mesh.m_he_vertex[he] < nb_vertices && mesh.m_he_next[he] == next;
+
+        if(valid && twin != NULL_INDEX)
+        {
+            valid = twin < nb_half_edges && twin != glm::uint(he) && mesh.m_he_twin[twin] == glm::uint(he)
+                    && mesh.m_he_vertex[twin] == mesh.m_he_vertex[next]
+                    && mesh.m_he_vertex[twin - twin % 3 + (twin + 1) % 3] == mesh.m_he_vertex[he];
+        }
+    }
+
+    #pragma omp parallel for reduction(&&:valid)
+    for(int v = 0; v < int(nb_vertices); v++)
+    {
+        glm::uint he = mesh.m_vertex_he[v];
+        valid = valid && (he == NULL_INDEX || (he < nb_half_edges && mesh.m_he_vertex[he] == glm::uint(v)));
+    }
+
+    if(!valid)
+    {
+        cerr << "Warning : corrupted mesh cache " << cache_filename << ", ignored." << endl;
+        mesh.ClearRessources();
+        return false;
+    }
+
+    mesh.m_nb_non_manifold_edges = header.nb_non_manifold_edges;
+    mesh.RebuildCaches();
+    return true;
+}
+
+/**
+ * @brief MeshCache::Write
+ * The file is written under a temporary name then renamed, so that a reader
+ * never sees a partial cache.
+ */
+bool MeshCache::Write(const char* cache_filename, const MeshSourceKey &key, const MeshHE &mesh)
+{
+    if(!IsLittleEndian())
+        return false;
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(CacheHeader));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = VERSION;
+    header.endianness = CACHE_ENDIANNESS;
+    header.source_size = key.size;
+    header.source_mtime = key.mtime;
+    header.source_hash = key.hash;
+    header.nb_vertices = mesh.NbVertices();
+    header.nb_faces = mesh.NbFaces();
+    header.nb_half_edges = mesh.NbHalfEdges();
+    header.nb_non_manifold_edges = mesh.m_nb_non_manifold_edges;
+
+    const void* arrays[NB_SECTIONS] = {
+        mesh.m_positions.empty() ? NULL : &mesh.m_positions[0],
+        mesh.m_normals.empty() ? NULL : &mesh.m_normals[0],
+        mesh.m_he_vertex.empty() ? NULL : &mesh.m_he_vertex[0],
+        mesh.m_he_next.empty() ? NULL : &mesh.m_he_next[0],
+        mesh.m_he_twin.empty() ? NULL : &mesh.m_he_twin[0],
+        mesh.m_vertex_he.empty() ? NULL : &mesh.m_vertex_he[0]
+    };
+    const glm::uint64 sizes[NB_SECTIONS] = {
+        mesh.m_positions.size() * sizeof(vec3),
+        mesh.m_normals.size() * sizeof(vec3),
+        mesh.m_he_vertex.size() * sizeof(glm::uint),
+        mesh.m_he_next.size() * sizeof(glm::uint),
+        mesh.m_he_twin.size() * sizeof(glm::uint),
+        mesh.m_vertex_he.size() * sizeof(glm::uint)
+    };
+
+    glm::uint64 offset = AlignSection(sizeof(CacheHeader));
+    header.payload_hash = FNV_OFFSET_BASIS;
+    for(int s = 0; s < NB_SECTIONS; s++)
+    {
+        header.payload_hash = HashBytes((const char*)arrays[s], sizes[s], header.payload_hash);
+        header.sections[s].offset = offset;
+        header.sections[s].size = sizes[s];
+        offset = AlignSection(offset + sizes[s]);
+    }
+
+    string tmp_filename = string(cache_filename) + ".tmp";
+    FILE* file = fopen(tmp_filename.c_str(), "wb");
+    if(file == NULL)
+        return false;
+
+    static const char padding[SECTION_ALIGNMENT] = { 0 };
+    bool ok = fwrite(&header, sizeof(CacheHeader), 1, file) == 1;
+    glm::uint64 position = sizeof(CacheHeader);
+
+    for(int s = 0; s < NB_SECTIONS && ok; s++)
+    {
+        ok = fwrite(padding, 1, header.sections[s].offset - position, file) == header.sections[s].offset - position;
+        ok = ok && (sizes[s] == 0 || fwrite(arrays[s], 1, sizes[s], file) == sizes[s]);
+        position = header.sections[s].offset + sizes[s];
+    }
+
+    ok = (fclose(file) == 0) && ok;
+    if(!ok || rename(tmp_filename.c_str(), cache_filename) != 0)
+    {
+        remove(tmp_filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+string MeshCache::CacheFilename(const char* off_filename)
+{
+    const char* cache_dir = getenv("MESH_CACHE_DIR");
+    if(cache_dir == NULL || cache_dir[0] == '\0')
+        return string(off_filename) + ".mhe";
+
+    // Models of the same name in different directories get different caches
+    char* path = realpath(off_filename, NULL);
+    string full_path = (path == NULL) ? string(off_filename) : string(path);
+    free(path);
+
+    char path_hash[17];
+    snprintf(path_hash, sizeof(path_hash), "%016llx", (unsigned long long)HashBytes(full_path.data(), full_path.size(), FNV_OFFSET_BASIS));
+
+    const char* basename = strrchr(off_filename, '/');
+    basename = (basename == NULL) ? off_filename : basename + 1;
+    return string(cache_dir) + "/" + basename + "." + path_hash + ".mhe";
+}
@@ -0,0 +1,56 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp> // uint64
+
+#include <string>
+
+class MeshHE;
+
+
+/**
+ * @brief The MeshSourceKey struct.
+ * Identifies the content of a source file : a cache entry is only used if
+ * the three fields match the current source file.
+ */
+struct MeshSourceKey
+{
+    MeshSourceKey() : size(0), mtime(0), hash(0) {}
+
+    bool operator==(const MeshSourceKey& k) const { return size == k.size && mtime == k.mtime && hash == k.hash; }
+
+    glm::uint64 size;           /// Size of the file in bytes
+    glm::int64 mtime;           /// Modification time in nanoseconds
+    glm::uint64 hash;           /// FNV-1a hash of the content
+};
+
+
+/**
+ * @brief The MeshCache class.
+ * Binary cache of the meshes loaded from OFF files, with their half edges.
+ * The cache file is a little endian container : a fixed header (magic,
+ * version, source key, element counts and a table of sections) followed by
+ * one 64 bytes aligned section per array (positions, normals, vertex indices,
+ * next and twin half edges, outgoing half edge of each vertex). It is memory
+ * mapped and copied straight into the MeshHE arrays, so loading it does not
+ * parse anything nor match any twin.
+ * The cache of "model.off" is "model.off.mhe", written next to the model,
+ * or "model.off.<hash of its full path>.mhe" in the directory given by the
+ * MESH_CACHE_DIR environment variable.
+ */
+class MeshCache
+{
+public:
+
+    static const glm::uint VERSION = 1;         /// To increment each time the layout (or the processing of the meshes) changes
+
+    static bool Load(const char* off_filename, MeshHE& mesh);                                       /// Loads the normalized mesh, with its normals, from the cache if it is up to date, from the OFF file otherwise (the cache is then written)
+
+    static bool ComputeKey(const char* filename, MeshSourceKey& key);                               /// Key of the current content of a file
+    static bool Read(const char* cache_filename, const MeshSourceKey& key, MeshHE& mesh);           /// Loads a cache file, returns false if it is missing, invalid or made from another source
+    static bool Write(const char* cache_filename, const MeshSourceKey& key, const MeshHE& mesh);    /// Writes a cache file (atomically replaced)
+    static std::string CacheFilename(const char* off_filename);
+};
+
+#endif // MESH_CACHE_H
@@ -1,12 +1,16 @@
 #include <MeshHE.h>
 #include <Mesh.h>
+#include <SimdKernels.h>
+#include <Trace.h>
 
 #include <iostream>
-#include <map>
 #include <algorithm>
 #include "glm/ext.hpp"
 #include <stdlib.h>
 #include <time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace glm;
 using namespace std;
@@ -30,399 +34,630 @@ using namespace std;
  */
 MeshHE::MeshHE(const Mesh &m)
 {
-    m_vertices.reserve(m.vertices.size());
-    m_faces.reserve(m.faces.size());
-    m_half_edges.reserve(m.faces.size()*3);
+    m_positions = m.vertices;
+    m_normals = m.normals;
+    m_normals.resize(m_positions.size());
 
-    m_positions.reserve(m.vertices.size());
-    m_normals.reserve(m.vertices.size());
+    BuildConnectivity(m.faces, m.vertices.size());
 
-    for(glm::uint i=0; i<m.vertices.size(); i++)
+    if(m_nb_non_manifold_edges > 0)
     {
-        m_positions.push_back(m.vertices[i]);
-        m_normals.push_back(m.normals[i]);
-        Vertex* v = new Vertex (&m_positions[i], &m_normals[i]);
-        m_vertices.push_back(v);
+        cerr << "Warning : " << m_nb_non_manifold_edges << " non manifold edges, they are treated as borders." << endl;
     }
 
-    for(glm::uint i=0; i<m.faces.size() / 3; i++)
-    {
-        Face* f = new Face ();
-        m_faces.push_back(f);
+	/* initialize random seed: */
+	srand (time(NULL));
+}
 
-        std::vector<HalfEdge*> temp;
-        for(glm::uint j=0; j<3; j++)
-        {
-            HalfEdge* he = new HalfEdge();
-            m_vertices[m.faces[3*i+j]]->m_half_edge = he;
-            he->m_vertex = m_vertices[m.faces[3*i+j]];
-            he->m_face = f;
-            temp.push_back(he);
-        }
 
-        f->m_half_edge = temp.front();
+MeshHE::MeshHE(const MeshSnapshot &s) :
+    m_all_moved(true),
+    m_nb_non_manifold_edges(0)
+{
+    RestoreSnapshot(s);
+}
+
+
+/**
+ * @brief MeshHE::BuildConnectivity
+ * Builds all the half edges of a triangle mesh in linear time.
+ * Each half edge gets a packed (min, max) vertex pair key; the half edges are
+ * bucketed by their min vertex (counting sort) then sorted by max vertex inside
+ * each bucket, so that the two halves of an edge end up side by side.
+ * Edges shared by more than two faces, or by two faces with inconsistent
+ * orientations, are non manifold: they are left without twin and counted
+ * in m_nb_non_manifold_edges.
+ * @param faces triangle indices (3 per face)
+ * @param nb_vertices
+ */
+void MeshHE::BuildConnectivity(const vector<glm::uint> &faces, const glm::uint nb_vertices)
+{
+    TRACE_ZONE("half edge build");
+
+    int nb_faces = faces.size() / 3;
+    int nb_half_edges = 3*nb_faces;
+
+    m_vertex_he.assign(nb_vertices, NULL_INDEX);
+    m_face_he.resize(nb_faces);
+
+    m_he_next.resize(nb_half_edges);
+    m_he_twin.assign(nb_half_edges, NULL_INDEX);
+    m_he_vertex.resize(nb_half_edges);
+    m_he_face.resize(nb_half_edges);
+
+    m_nb_non_manifold_edges = 0;
+
+    #pragma omp parallel for
+    for(int i=0; i<nb_faces; i++)
+    {
+        m_face_he[i] = 3*i;
 
         for(glm::uint j=0; j<3; j++)
         {
-            temp[j]->m_next = temp[(j+1)%3];
+            glm::uint he = 3*i+j;
+            m_he_vertex[he] = faces[he];
+            m_he_face[he] = i;
+            m_he_next[he] = 3*i + (j+1)%3;
         }
+    }
 
-        m_half_edges.insert(m_half_edges.end(), temp.begin(), temp.end());
+    // The last half edge of each vertex is kept as its outgoing half edge
+    for(int he=0; he<nb_half_edges; he++)
+    {
+        m_vertex_he[faces[he]] = he;
     }
 
-    map<Vertex*, vector<HalfEdge*> > mapping;
+    // Edge keys : min vertex in the high 32 bits, max vertex in the low 32 bits
+    vector<glm::uint64> keys(nb_half_edges);
+    vector<glm::uint> bucket_start(nb_vertices+1, 0);
 
-    for(glm::uint i=0; i<m_vertices.size(); i++)
+    #pragma omp parallel for
+    for(int he=0; he<nb_half_edges; he++)
     {
-        mapping[m_vertices[i]] = vector<HalfEdge*>();
+        glm::uint u = m_he_vertex[he];
+        glm::uint w = m_he_vertex[m_he_next[he]];
+        glm::uint64 k = (glm::uint64(glm::min(u, w)) << 32) | glm::max(u, w);
+        keys[he] = k;
+
+        #pragma omp atomic
+        bucket_start[(k >> 32) + 1]++;
     }
 
-    for(glm::uint i=0; i<m_half_edges.size(); i++)
+    for(glm::uint i=0; i<nb_vertices; i++)
     {
-        mapping[m_half_edges[i]->m_vertex].push_back(m_half_edges[i]);
+        bucket_start[i+1] += bucket_start[i];
     }
 
-    for(glm::uint i0 = 0; i0 < m_half_edges.size(); i0++)
+    vector<glm::uint> cursor(bucket_start.begin(), bucket_start.end() - 1);
+    vector<glm::uint> sorted(nb_half_edges);
+
+    #pragma omp parallel for
+    for(int he=0; he<nb_half_edges; he++)
     {
-        HalfEdge* he = m_half_edges[i0];
-        if(he->m_twin != NULL)
-            continue;
+        glm::uint slot;
+        glm::uint& c = cursor[keys[he] >> 32];
 
-        vector<HalfEdge*> potential_twin = mapping.at(he->m_next->m_vertex);
+        #pragma omp atomic capture
+        slot = c++;
 
-        for(glm::uint i1 = 0; i1 < potential_twin.size(); i1++)
-        {
-            HalfEdge* he2 = potential_twin[i1];
+        sorted[slot] = he;
+    }
 
-            if(he2->m_twin != NULL)
-                continue;
+    int nb_non_manifold = 0;
 
-            if(he->m_vertex == he2->m_next->m_vertex
-            && he->m_next->m_vertex == he2->m_vertex)
+    #pragma omp parallel for reduction(+:nb_non_manifold) schedule(dynamic, 1024)
+    for(int v=0; v<int(nb_vertices); v++)
+    {
+        glm::uint* b = &sorted[0] + bucket_start[v];
+        glm::uint* e = &sorted[0] + bucket_start[v+1];
+
+        // Buckets are as small as the vertex valence: insertion sort on (key, he)
+        for(glm::uint* i = b + 1; i < e; i++)
+        {
+            glm::uint he = *i;
+            glm::uint* j = i;
+            while(j > b && (keys[*(j-1)] > keys[he] || (keys[*(j-1)] == keys[he] && *(j-1) > he)))
             {
-                he->m_twin = he2;
-                he2->m_twin = he;
-                break;
+                *j = *(j-1);
+                j--;
             }
+            *j = he;
         }
-    }
-	/* initialize random seed: */
-	srand (time(NULL));
-}
 
+        for(glm::uint* i = b; i < e; )
+        {
+            glm::uint* run_end = i + 1;
+            while(run_end < e && keys[*run_end] == keys[*i])
+                run_end++;
 
-MeshHE::~MeshHE()
-{
-    ClearRessources();
-}
+            glm::uint he0 = *i;
+            bool degenerate = (m_he_vertex[he0] == m_he_vertex[m_he_next[he0]]);
 
+            if(run_end - i == 2 && !degenerate)
+            {
+                glm::uint he1 = *(i+1);
+                if(m_he_vertex[he0] == m_he_vertex[m_he_next[he1]])
+                {
+                    m_he_twin[he0] = he1;
+                    m_he_twin[he1] = he0;
+                }
+                else
+                {
+                    nb_non_manifold++;
+                }
+            }
+            else if(run_end - i > 2 || degenerate)
+            {
+                nb_non_manifold++;
+            }
 
-void MeshHE::ClearRessources()
-{
-    for(glm::uint i_he = 0; i_he < m_half_edges.size(); i_he++)
-    {
-        delete m_half_edges[i_he];
+            i = run_end;
+        }
     }
 
-    for(glm::uint i_f = 0; i_f < m_faces.size(); i_f++)
-    {
-        delete m_faces[i_f];
-    }
+    m_nb_non_manifold_edges = nb_non_manifold;
 
-    for(glm::uint i_v = 0; i_v < m_vertices.size(); i_v++)
+    // Border vertices start their fan just after the incoming border half edge,
+    // so that turning around them from m_vertex_he visits the whole 1-ring
+    for(int he=0; he<nb_half_edges; he++)
     {
-        delete m_vertices[i_v];
+        if(m_he_twin[he] == NULL_INDEX)
+        {
+            glm::uint next = m_he_next[he];
+            m_vertex_he[m_he_vertex[next]] = next;
+        }
     }
 
-    m_positions.clear();
-    m_normals.clear();
+    RebuildCaches();
 }
 
-MeshHE& MeshHE::operator=(const MeshHE& m)
+/**
+ * @brief MeshHE::RebuildCaches
+ * Rebuilds everything that derives from the half edges: 1-rings, border
+ * flags, corners, partition and laplacian operator. The next ComputeNormals
+ * call recomputes all the normals.
+ */
+void MeshHE::RebuildCaches()
 {
-    ClearRessources();
+    TRACE_ZONE("rebuild caches");
+
+    BuildAdjacency();
+    BuildBorderFlags();
+    BuildCorners();
+    MarkAllMoved();
+    m_partition.Build(*this, NbThreads(0));
+    m_laplacian.Build(*this, m_laplacian.GetWeights(), m_laplacian.GetWeightTolerance());
+    m_implicit_delta.Resize(0);
+    m_topology.reset();
+}
 
-    m_vertices.reserve(m.m_vertices.size());
-    m_faces.reserve(m.m_faces.size());
-    m_half_edges.reserve(m.m_half_edges.size());
 
-    m_positions.reserve(m.m_vertices.size());
-    m_normals.reserve(m.m_vertices.size());
+/**
+ * @brief MeshHE::Renumber
+ * Permutes the positions and normals, and rebuilds the half edges from the
+ * faces taken in face_order. Each face keeps its first corner, so that
+ * gen_faces_array lists the same triangles, renumbered and in the new order.
+ * @param vertex_order permutation of the vertices (new index -> old index)
+ * @param face_order permutation of the faces (new index -> old index)
+ */
+void MeshHE::Renumber(const vector<glm::uint> &vertex_order, const vector<glm::uint> &face_order)
+{
+    TRACE_ZONE("renumber");
+
+    int nb_vertices = NbVertices();
+    int nb_faces = NbFaces();
+
+    vector<glm::uint> ranks(nb_vertices);
+    vector<vec3> positions(nb_vertices);
+    vector<vec3> normals(nb_vertices);
 
-    for(glm::uint i=0; i<m.m_vertices.size(); i++)
+    #pragma omp parallel for
+    for(int r=0; r<nb_vertices; r++)
     {
-        m_positions.push_back(*m.m_vertices[i]->m_position);
-        m_normals.push_back(*m.m_vertices[i]->m_normal);
-        Vertex* v = new Vertex (&m_positions[i], &m_normals[i]);
-        m_vertices.push_back(v);
+        glm::uint v = vertex_order[r];
+        ranks[v] = r;
+        positions[r] = m_positions[v];
+        normals[r] = m_normals[v];
     }
 
-    for(glm::uint i=0; i<m.m_faces.size(); i++)
+    vector<glm::uint> faces(3*nb_faces);
+
+    #pragma omp parallel for
+    for(int i=0; i<nb_faces; i++)
     {
-        Face* f = new Face();
-        m_faces.push_back(f);
+        glm::uint he = m_face_he[face_order[i]];
+        faces[3*i]   = ranks[m_he_vertex[he]];
+        faces[3*i+1] = ranks[m_he_vertex[m_he_next[he]]];
+        faces[3*i+2] = ranks[m_he_vertex[m_he_next[m_he_next[he]]]];
+    }
 
-        std::vector<HalfEdge*> temp;
+    m_positions.swap(positions);
+    m_normals.swap(normals);
 
-        HalfEdge* he0 = new HalfEdge();
-        m_vertices[m.m_faces[i]->m_half_edge->m_vertex->m_id]->m_half_edge = he0;
-        he0->m_vertex = m_vertices[m.m_faces[i]->m_half_edge->m_vertex->m_id];
-        he0->m_face = f;
-        temp.push_back(he0);
+    BuildConnectivity(faces, nb_vertices);
+}
 
-        HalfEdge* he1 = new HalfEdge();
-        m_vertices[m.m_faces[i]->m_half_edge->m_next->m_vertex->m_id]->m_half_edge = he1;
-        he1->m_vertex = m_vertices[m.m_faces[i]->m_half_edge->m_next->m_vertex->m_id];
-        he1->m_face = f;
-        temp.push_back(he1);
 
-        HalfEdge* he2 = new HalfEdge();
-        m_vertices[m.m_faces[i]->m_half_edge->m_next->m_next->m_vertex->m_id]->m_half_edge = he2;
-        he2->m_vertex = m_vertices[m.m_faces[i]->m_half_edge->m_next->m_next->m_vertex->m_id];
-        he2->m_face = f;
-        temp.push_back(he2);
+void MeshHE::ClearRessources()
+{
+    m_he_next.clear();
+    m_he_twin.clear();
+    m_he_vertex.clear();
+    m_he_face.clear();
 
-        f->m_half_edge = temp.front();
+    m_vertex_he.clear();
+    m_face_he.clear();
 
-        for(glm::uint j=0; j<3; j++)
-        {
-            temp[j]->m_next = temp[(j+1)%3];
-        }
+    m_adjacency_offsets.clear();
+    m_adjacency.clear();
 
-        m_half_edges.insert(m_half_edges.end(), temp.begin(), temp.end());
-    }
+    m_he_border.clear();
+    m_vertex_border.clear();
 
-    for(glm::uint i0 = 0; i0 < m_half_edges.size(); i0++)
-    {
-        HalfEdge* he = m_half_edges[i0];
-        if(he->m_twin != NULL)
-            continue;
+    m_corner_offsets.clear();
+    m_corners.clear();
+    m_face_normals.Resize(0);
+    m_corner_angles.clear();
+    m_vertex_moved.clear();
+    m_face_updated.clear();
+    m_all_moved = true;
 
-        for(glm::uint i1 = 0; i1 < m_half_edges.size(); i1++)
-        {
-            HalfEdge* he2 = m_half_edges[i1];
+    m_positions.clear();
+    m_normals.clear();
+    m_partition.Clear();
+    m_laplacian.Clear();
+    m_implicit_delta.Resize(0);
+    m_topology.reset();
+}
 
-            if(he2->m_twin != NULL)
-                continue;
+//***************
+// Snapshots
 
-            if(he->m_vertex == he2->m_next->m_vertex
-            && he->m_next->m_vertex == he2->m_vertex)
-            {
-                he->m_twin = he2;
-                he2->m_twin = he;
-                break;
-            }
-        }
+/**
+ * @brief MeshHE::TakeSnapshot
+ * The first snapshot after a connectivity change copies the connectivity
+ * into m_topology, the next ones only copy the positions and normals.
+ * Not const since it may set m_topology : like the other modifications of
+ * the mesh, it must not run concurrently with any other call on this mesh.
+ */
+MeshSnapshot MeshHE::TakeSnapshot()
+{
+    TRACE_ZONE("take snapshot");
+
+    if(!m_topology)
+    {
+        shared_ptr<MeshHE> topology = make_shared<MeshHE>();
+        topology->CopyConnectivity(*this);
+        m_topology = topology;
     }
+
+    MeshSnapshot snapshot;
+    snapshot.m_topology = m_topology;
+    snapshot.m_positions = make_shared< const vector<vec3> >(m_positions);
+    snapshot.m_normals = make_shared< const vector<vec3> >(m_normals);
+    return snapshot;
 }
 
 /**
- * @brief MeshHE::MeshHE
- * Deep copy is performed.
- * @param m
+ * @brief MeshHE::RestoreSnapshot
+ * All the normals are recomputed by the next ComputeNormals call, the
+ * implicit solver starts again without warm start.
+ * @return false if the snapshot is empty
  */
-MeshHE::MeshHE(const MeshHE& m)
+bool MeshHE::RestoreSnapshot(const MeshSnapshot &snapshot)
 {
-    m_vertices.reserve(m.m_vertices.size());
-    m_faces.reserve(m.m_faces.size());
-    m_half_edges.reserve(m.m_half_edges.size());
+    TRACE_ZONE("restore snapshot");
 
-    m_positions.reserve(m.m_vertices.size());
-    m_normals.reserve(m.m_vertices.size());
+    if(!snapshot.IsValid())
+        return false;
 
-    for(glm::uint i=0; i<m.m_vertices.size(); i++)
+    if(snapshot.m_topology != m_topology)
     {
-        m_positions.push_back(*m.m_vertices[i]->m_position);
-        m_normals.push_back(*m.m_vertices[i]->m_normal);
-        Vertex* v = new Vertex (&m_positions[i], &m_normals[i]);
-        m_vertices.push_back(v);
+        CopyConnectivity(*snapshot.m_topology);
+        m_topology = snapshot.m_topology;
+        m_face_normals.Resize(0);
+        m_corner_angles.clear();
     }
 
-    for(glm::uint i=0; i<m.m_faces.size(); i++)
-    {
-        Face* f = new Face();
-        m_faces.push_back(f);
-
-        std::vector<HalfEdge*> temp;
+    m_positions = snapshot.GetPositions();
+    m_normals = snapshot.GetNormals();
+    m_implicit_delta.Resize(0);
+    MarkAllMoved();
+    return true;
+}
 
-        HalfEdge* he0 = new HalfEdge();
-        m_vertices[m.m_faces[i]->m_half_edge->m_vertex->m_id]->m_half_edge = he0;
-        he0->m_vertex = m_vertices[m.m_faces[i]->m_half_edge->m_vertex->m_id];
-        he0->m_face = f;
-        temp.push_back(he0);
+void MeshHE::CopyConnectivity(const MeshHE &mesh)
+{
+    m_he_next = mesh.m_he_next;
+    m_he_twin = mesh.m_he_twin;
+    m_he_vertex = mesh.m_he_vertex;
+    m_he_face = mesh.m_he_face;
+    m_vertex_he = mesh.m_vertex_he;
+    m_face_he = mesh.m_face_he;
+
+    m_adjacency_offsets = mesh.m_adjacency_offsets;
+    m_adjacency = mesh.m_adjacency;
+    m_he_border = mesh.m_he_border;
+    m_vertex_border = mesh.m_vertex_border;
+
+    m_partition = mesh.m_partition;
+    m_laplacian = mesh.m_laplacian;
+
+    m_corner_offsets = mesh.m_corner_offsets;
+    m_corners = mesh.m_corners;
+    m_vertex_moved.assign(mesh.NbVertices(), 0);
+    m_all_moved = true;
+
+    m_nb_non_manifold_edges = mesh.m_nb_non_manifold_edges;
+}
 
-        HalfEdge* he1 = new HalfEdge();
-        m_vertices[m.m_faces[i]->m_half_edge->m_next->m_vertex->m_id]->m_half_edge = he1;
-        he1->m_vertex = m_vertices[m.m_faces[i]->m_half_edge->m_next->m_vertex->m_id];
-        he1->m_face = f;
-        temp.push_back(he1);
 
-        HalfEdge* he2 = new HalfEdge();
-        m_vertices[m.m_faces[i]->m_half_edge->m_next->m_next->m_vertex->m_id]->m_half_edge = he2;
-        he2->m_vertex = m_vertices[m.m_faces[i]->m_half_edge->m_next->m_next->m_vertex->m_id];
-        he2->m_face = f;
-        temp.push_back(he2);
+//***************
+// Smoothing
 
-        f->m_half_edge = temp.front();
+/**
+ * @brief MeshHE::BuildAdjacency
+ * Caches the 1-ring of every vertex in compressed sparse row form:
+ * the neighbors of v are m_adjacency[m_adjacency_offsets[v] .. m_adjacency_offsets[v+1]-1],
+ * in the order they are met when turning around v.
+ * Should be called again each time the connectivity changes.
+ */
+void MeshHE::BuildAdjacency()
+{
+    int nb_vertices = NbVertices();
 
-        for(glm::uint j=0; j<3; j++)
-        {
-            temp[j]->m_next = temp[(j+1)%3];
-        }
+    m_adjacency_offsets.assign(nb_vertices+1, 0);
 
-        m_half_edges.insert(m_half_edges.end(), temp.begin(), temp.end());
+    #pragma omp parallel for
+    for(int v=0; v<nb_vertices; v++)
+    {
+        m_adjacency_offsets[v+1] = CountVertexNeighbors(v);
     }
 
-    for(glm::uint i0 = 0; i0 < m_half_edges.size(); i0++)
+    for(int v=0; v<nb_vertices; v++)
     {
-        HalfEdge* he = m_half_edges[i0];
-        if(he->m_twin != NULL)
-            continue;
-
-        for(glm::uint i1 = 0; i1 < m_half_edges.size(); i1++)
-        {
-            HalfEdge* he2 = m_half_edges[i1];
+        m_adjacency_offsets[v+1] += m_adjacency_offsets[v];
+    }
 
-            if(he2->m_twin != NULL)
-                continue;
+    m_adjacency.resize(m_adjacency_offsets[nb_vertices]);
 
-            if(he->m_vertex == he2->m_next->m_vertex
-            && he->m_next->m_vertex == he2->m_vertex)
-            {
-                he->m_twin = he2;
-                he2->m_twin = he;
-                break;
-            }
-        }
+    #pragma omp parallel for
+    for(int v=0; v<nb_vertices; v++)
+    {
+        FillVertexNeighbors(v, &m_adjacency[0] + m_adjacency_offsets[v]);
     }
 }
 
-//***************
-// Smoothing
-bool EstEgal(const HalfEdge& he1,const HalfEdge& he2 ){
-      return (he1.m_vertex->m_id == he2.m_vertex->m_id);
-    }
-
-vector<Vertex*> MeshHE::GetVertexNeighborsNotBorder(const Vertex* v) const
-{
-    std::vector<Vertex*> liste_voisin ;
-	// cout << " Entre non bord" << endl;
-	HalfEdge* he0 = v->m_half_edge;
-	HalfEdge* he1 = he0-> m_twin;
-	liste_voisin.push_back(he1->m_vertex);
-	he0 = he1->m_next;
-	while(!(EstEgal(*(he0->m_twin),*he1))){
-		he0 = he0->m_twin;
-		liste_voisin.push_back(he0->m_vertex);
-		he0 = he0->m_next;
-	}
-    return liste_voisin;
+glm::uint MeshHE::CountVertexNeighbors(const glm::uint v) const
+{
+    glm::uint he_start = m_vertex_he[v];
+    if(he_start == NULL_INDEX)
+        return 0;
+
+    // m_vertex_he is the first half edge of the fan : its previous half edge is at border
+    glm::uint count = 0;
+    if(m_he_twin[m_he_next[m_he_next[he_start]]] == NULL_INDEX)
+        count++;
+
+    glm::uint he0 = he_start;
+    do{
+        count++;
+        he0 = m_he_twin[he0];
+        if(he0 == NULL_INDEX)
+            break;
+        he0 = m_he_next[he0];
+    }while(he0 != he_start);
+
+    return count;
 }
 
-vector<Vertex*> MeshHE::GetVertexNeighborsAtBorder(const Vertex* v) const
-{
-    std::vector<Vertex*> liste_voisin ;
-	// cout << " Entre non bord" << endl;
-	HalfEdge* he0 = v->m_half_edge;
-	//while the border edge is not reached loop clockwize
-	if(!IsAtBorder(he0)){
-		he0 = he0->m_twin;
-		liste_voisin.push_back(he0->m_vertex);
-		//liste_voisin.insert(liste_voisin.begin(),he0->m_vertex);
-		he0 = he0->m_next;
-		while((!IsAtBorder(he0))){
-			he0 = he0->m_twin;
-			liste_voisin.push_back(he0->m_vertex);
-			//liste_voisin.insert(liste_voisin.begin(),he0->m_vertex);
-			he0 = he0->m_next;
-		}
-	}
-	//while the border edge is not reached loop counter-clockwize
-	he0 = v->m_half_edge->m_next;
-	//liste_voisin.push_back(he0->m_vertex);
-	liste_voisin.insert(liste_voisin.begin(),he0->m_vertex);
-	he0 = he0->m_next;
-	//liste_voisin.push_back(he0->m_vertex);
-	liste_voisin.insert(liste_voisin.begin(),he0->m_vertex);
-	while(!IsAtBorder(he0)){
-		he0 = he0->m_twin;
-		he0 = he0->m_next;
-		he0 = he0->m_next;
-		//liste_voisin.push_back(he0->m_vertex);
-		liste_voisin.insert(liste_voisin.begin(),he0->m_vertex);
-	}
-    return liste_voisin;
+void MeshHE::FillVertexNeighbors(const glm::uint v, glm::uint *neighbors) const
+{
+    glm::uint he_start = m_vertex_he[v];
+    if(he_start == NULL_INDEX)
+        return;
+
+    if(m_he_twin[m_he_next[m_he_next[he_start]]] == NULL_INDEX)
+        *neighbors++ = m_he_vertex[m_he_next[m_he_next[he_start]]];
+
+    glm::uint he0 = he_start;
+    do{
+        *neighbors++ = m_he_vertex[m_he_next[he0]];
+        he0 = m_he_twin[he0];
+        if(he0 == NULL_INDEX)
+            break;
+        he0 = m_he_next[he0];
+    }while(he0 != he_start);
 }
 
-vector<Vertex*> MeshHE::GetVertexNeighbors(const Vertex* v) const
+vector<Vertex> MeshHE::GetVertexNeighbors(const Vertex v) const
 {
-    // cout << " Entree dans la recherche voisin" << endl;
-    std::vector<Vertex*> liste_voisin ;
-    if(!IsAtBorder(v)){
-      // cout << " Entre non bord" << endl;
-		liste_voisin = GetVertexNeighborsNotBorder(v);
-  }else{
-    cout << " On tombe sur un bord " <<endl;
-		liste_voisin = GetVertexNeighborsAtBorder(v);
-  }
-    // cout << " GetVertexNeighbors found " << liste_voisin.size() << " vertexs " << endl;
-    cout << endl;
+    std::vector<Vertex> liste_voisin ;
+    liste_voisin.reserve(GetNbNeighbors(v));
+
+    const glm::uint* neighbors = GetNeighbors(v);
+    for(glm::uint i = 0; i < GetNbNeighbors(v); i++)
+    {
+        liste_voisin.push_back(Vertex(neighbors[i]));
+    }
     return liste_voisin;
 }
 
 
-glm::vec3 MeshHE::Laplacian(const Vertex* v) const
+glm::vec3 MeshHE::Laplacian(const Vertex v) const
 {
-    // cout << "Entree Laplacien" << endl;
-	vector<Vertex*> neighbors = GetVertexNeighbors(v);
 	vec3 laplace = vec3(0);
-	//for(Vertex* n : neighbors)
-  // cout << "MILIEU LAPLACIEN " << endl;
   if(!IsAtBorder(v)){ // Si le sommet est au bord, pas de déplacement
-	   for (std::vector<Vertex*>::iterator it = neighbors.begin() ; it != neighbors.end(); ++it){
-		  Vertex* n = *it;
-		  laplace += *(n->m_position) - *(v->m_position);
+	   const glm::uint* neighbors = GetNeighbors(v);
+	   glm::uint nb_neighbors = GetNbNeighbors(v);
+	   for (glm::uint i = 0; i < nb_neighbors; i++){
+		  laplace += m_positions[neighbors[i]] - m_positions[v.m_id];
 	 }
-	 laplace /= neighbors.size();
+	 laplace /= nb_neighbors;
   }
-  //  cout << "MeshHE::Laplacian ended" << endl;
-    // if(dot(laplace,laplace)>0.0001){
-    //    cout << "Thomas::Test : laplace = " << to_string(dot(laplace,laplace)) << " point : " << to_string(*(v->m_position)) << endl;
-    //    laplace = laplace / 10.0f;
-    //  }
     return laplace;
 }
 
-void MeshHE::LaplacianSmooth(const float lambda, const glm::uint nb_iter)
-{
-    // cout << "MeshHE::LaplacianSmooth(const float lambda, const glm::uint nb_iter) is not coded yet!" << endl;
-    int nb_vertices = m_vertices.size();
-    glm::vec3 lap_values[nb_vertices] ;
-    for(int i = 0 ; i < nb_iter ; i++){
-      // pour tous les sommmets du maillage, calculer le laplacien
-      for(int j = 0 ; j < nb_vertices; j++){
-        lap_values[j] = Laplacian(m_vertices[j]);
-        // lap_values[j] *= lap_values[j];
-        // lap_values[j] *= 10;
-      }
-      // Pour tous les sommets du maillage, aller dans la direction du laplacien
-      for(int j = 0 ; j < nb_vertices; j++){
-        if(!IsAtBorder(m_vertices[j])){
-          *(m_vertices[j]->m_position) = *(m_vertices[j]->m_position)+lambda*lap_values[j];
-        }
-      }
+/**
+ * @brief MeshHE::SetLaplacianWeights
+ * Reassembles the laplacian operator with the given weights. Uniform weights
+ * only depend on the connectivity; geometric weights depend on the positions,
+ * so they are refreshed at the start of each smoothing call around the
+ * vertices moved by more than tolerance (see LaplacianOperator::RefreshWeights).
+ * @param weights
+ * @param tolerance     In mean edge lengths (0 recomputes the weights around every moved vertex)
+ */
+void MeshHE::SetLaplacianWeights(const LaplacianWeights weights, const float tolerance)
+{
+    m_laplacian.Build(*this, weights, tolerance);
+    m_topology.reset();
+}
+
+void MeshHE::LaplacianSmooth(const float lambda, const glm::uint nb_iter, const int nb_threads)
+{
+    if(NbVertices() == 0)
+        return;
+
+    UpdatePartition(nb_threads);
+    m_laplacian.RefreshWeights(*this);
+
+    m_smoothing_src.Load(m_positions, m_partition.GetVertexOrder());
+    m_smoothing_dst.Resize(NbVertices());
 
+    for(glm::uint i = 0 ; i < nb_iter ; i++){
+        TRACE_ZONE("laplacian iteration");
+        m_laplacian.Step(lambda, m_smoothing_src, m_smoothing_dst, nb_threads);
+        std::swap(m_smoothing_src, m_smoothing_dst);
     }
+
+    m_smoothing_src.Store(m_positions, m_partition.GetVertexOrder());
+    MarkInteriorMoved();
 }
 
-void MeshHE::TaubinSmooth(const float lambda, const float mu, const glm::uint nb_iter)
+/**
+ * @brief MeshHE::TaubinSmooth
+ * Each iteration applies the lambda and mu steps in a single sweep
+ * (see LaplacianOperator::TaubinStep) when the vertex order is local enough
+ * for the halo recomputation to be cheap, as two sweeps otherwise: both give
+ * the same result.
+ */
+void MeshHE::TaubinSmooth(const float lambda, const float mu, const glm::uint nb_iter, const int nb_threads)
 {
-//    cout << "MeshHE::TaubinSmooth(const float lambda, const float mu, const glm::uint nb_iter) is not coded yet!" << endl;
+    if(NbVertices() == 0)
+        return;
+
+    UpdatePartition(nb_threads);
+    m_laplacian.RefreshWeights(*this);
 
-	for(int i=nb_iter; i>0; i--){
-			LaplacianSmooth(lambda,1);
-			LaplacianSmooth(mu,1);
+    m_smoothing_src.Load(m_positions, m_partition.GetVertexOrder());
+    m_smoothing_dst.Resize(NbVertices());
+
+    bool fused = m_laplacian.HasSmallHalos();
+
+	for(glm::uint i = 0 ; i < nb_iter ; i++){
+        TRACE_ZONE("taubin iteration");
+        if(fused){
+            m_laplacian.TaubinStep(lambda, mu, m_smoothing_src, m_smoothing_dst, nb_threads);
+            std::swap(m_smoothing_src, m_smoothing_dst);
+        }
+        else{
+            m_laplacian.Step(lambda, m_smoothing_src, m_smoothing_dst, nb_threads);
+            m_laplacian.Step(mu, m_smoothing_dst, m_smoothing_src, nb_threads);
+        }
 	}
+
+    m_smoothing_src.Store(m_positions, m_partition.GetVertexOrder());
+    MarkInteriorMoved();
+}
+
+const float MeshHE::IMPLICIT_TOLERANCE = 1e-5f;
+const glm::uint MeshHE::IMPLICIT_MAX_ITER;
+
+/**
+ * @brief MeshHE::ImplicitSmooth
+ * Backward Euler smoothing: each step solves (I - lambda_dt L) p' = p
+ * (see LaplacianOperator::SolveImplicit), which is stable for any lambda_dt,
+ * so one large step replaces many explicit ones.
+ * The solver is warm started with the displacement of the previous step.
+ * A warning is printed if it reaches IMPLICIT_MAX_ITER iterations in a step.
+ * @return total number of solver iterations
+ */
+glm::uint MeshHE::ImplicitSmooth(const float lambda_dt, const glm::uint nb_iter, const int nb_threads)
+{
+    if(NbVertices() == 0)
+        return 0;
+
+    UpdatePartition(nb_threads);
+    m_laplacian.RefreshWeights(*this);
+
+    m_smoothing_src.Load(m_positions, m_partition.GetVertexOrder());
+    m_smoothing_dst.Resize(NbVertices());
+    if(m_implicit_delta.Size() != NbVertices())
+        m_implicit_delta.Resize(NbVertices());
+
+    int padded_size = 3 * m_smoothing_src.PaddedSize();     // x, y and z arrays are contiguous
+    glm::uint nb_solver_iter = 0;
+    glm::uint nb_unconverged = 0;
+
+    for(glm::uint i = 0 ; i < nb_iter ; i++){
+        TRACE_ZONE("implicit iteration");
+        float* src = m_smoothing_src.X();
+        float* dst = m_smoothing_dst.X();
+        float* delta = m_implicit_delta.X();
+
+        #pragma omp parallel for schedule(static) num_threads(NbThreads(nb_threads))
+        for(int k = 0; k < padded_size; k++)
+            dst[k] = src[k] + delta[k];
+
+        glm::uint nb_step_iter = m_laplacian.SolveImplicit(lambda_dt, m_smoothing_src, m_smoothing_dst,
+                                                           IMPLICIT_TOLERANCE, IMPLICIT_MAX_ITER, nb_threads);
+        nb_solver_iter += nb_step_iter;
+        if(nb_step_iter >= IMPLICIT_MAX_ITER)
+            nb_unconverged++;
+        TRACE_COUNTER("cg iterations", nb_step_iter);
+
+        #pragma omp parallel for schedule(static) num_threads(NbThreads(nb_threads))
+        for(int k = 0; k < padded_size; k++)
+            delta[k] = dst[k] - src[k];
+
+        std::swap(m_smoothing_src, m_smoothing_dst);
+    }
+
+    m_smoothing_src.Store(m_positions, m_partition.GetVertexOrder());
+    MarkInteriorMoved();
+
+    if(nb_unconverged > 0)
+    {
+        cerr << "Warning : the implicit solver stopped at " << IMPLICIT_MAX_ITER << " iterations without converging in "
+             << nb_unconverged << " of " << nb_iter << " steps." << endl;
+    }
+    return nb_solver_iter;
+}
+
+/**
+ * @brief MeshHE::UpdatePartition
+ * The partition has one part per thread: a call with another number of
+ * threads than the previous ones repartitions the mesh (and reassembles the
+ * laplacian, whose rows follow the partition).
+ */
+void MeshHE::UpdatePartition(const int nb_threads)
+{
+    if(m_partition.NbParts() == glm::uint(NbThreads(nb_threads)))
+        return;
+
+    m_partition.Build(*this, NbThreads(nb_threads));
+    m_laplacian.Build(*this, m_laplacian.GetWeights(), m_laplacian.GetWeightTolerance());
+    m_implicit_delta.Resize(0);
+    m_topology.reset();
+}
+
+int MeshHE::NbThreads(const int nb_threads)
+{
+#ifdef _OPENMP
+    return nb_threads > 0 ? nb_threads : omp_get_max_threads();
+#else
+    return 1;
+#endif
 }
 
 //***************
@@ -430,22 +665,23 @@ void MeshHE::TaubinSmooth(const float lambda, const float mu, const glm::uint nb
 
 void MeshHE::Noise()
 {
-    int nb_vertices = m_vertices.size();
+    int nb_vertices = NbVertices();
 	for(int i = 0; i < nb_vertices; i++)
 	{
 		float x = float(rand()%100)/10000.0;
 		float y = float(rand()%100)/10000.0;
 		float z = float(rand()%100)/10000.0;
-		*(m_vertices[i]->m_position) = *(m_vertices[i]->m_position)+ glm::vec3(x,y,z);
+		m_positions[i] = m_positions[i]+ glm::vec3(x,y,z);
 	}
+	MarkAllMoved();
 }
 
 void MeshHE::NoiseNotBorder()
 {
-    int nb_vertices = m_vertices.size();
+    int nb_vertices = NbVertices();
 	for(int i = 0; i < nb_vertices; i++)
 	{
-		if(!IsAtBorder(m_vertices[i])){
+		if(!IsAtBorder(Vertex(i))){
 			float x = float(rand()%100)/10000.0;
 			float y = float(rand()%100)/10000.0;
 			float z = float(rand()%100)/10000.0;
@@ -454,7 +690,8 @@ void MeshHE::NoiseNotBorder()
 			y -= 0.005;
 			z -= 0.005;
 			*/
-			*(m_vertices[i]->m_position) = *(m_vertices[i]->m_position)+ glm::vec3(x,y,z);
+			m_positions[i] = m_positions[i]+ glm::vec3(x,y,z);
+			m_vertex_moved[i] = 1;
 		}
 	}
 }
@@ -462,54 +699,43 @@ void MeshHE::NoiseNotBorder()
 //***************
 // Border detection
 
-bool MeshHE::IsAtBorder(const HalfEdge* he) const
-{
-    return (he->m_twin==NULL);
-}
-
-bool MeshHE::IsAtBorder(const Vertex* v) const
-{
-    // cout << "MeshHE::IsAtBorder(const Vertex* v) is not coded yet!" << endl;
-    HalfEdge* he0 = v->m_half_edge;
-    if(IsAtBorder(he0)){
-       cout << " point au bord trouve "<< endl;
-        return true;
-      }
-    HalfEdge* he1 = he0-> m_twin;
-    he0 = he1->m_next;
-    if(IsAtBorder(he0)){
-      cout << " point au bord trouve "<< endl;
-       return true;
-     }
-    while(!(EstEgal(*(he0->m_twin),*he1))){
-      if(IsAtBorder(he0)){
-        cout << " point au bord trouve "<< endl;
-         return true;
-       }
-      he0 = he0->m_twin;
-      he0 = he0->m_next;
-      if(IsAtBorder(he0)){
-         cout << " point au bord trouve "<< endl;
-          return true;
-         }
-    }
-    return false;
-}
-
-bool MeshHE::IsAtBorder(const Face* f) const
-{
-  //cout << "MeshHE::IsAtBorder(const Face* f) is not coded yet!" << endl;
-	HalfEdge* h = f->m_half_edge;
-	HalfEdge* hi = f->m_half_edge;
-	for(int i=0; i<3; i++){
-		if(IsAtBorder(h)){
-			return true;
-		}
-		h = h->m_next;
-	}
-	if(h != hi){
-		cout << "error of struc face read" << endl;
-	}  return false;
+/**
+ * @brief MeshHE::BuildBorderFlags
+ * Computes the border status of all the half edges and vertices in one pass
+ * over the half edges: a half edge is at border when it has no twin, and so
+ * are its two vertices.
+ * Should be called again each time the connectivity changes.
+ */
+void MeshHE::BuildBorderFlags()
+{
+    m_he_border.assign(NbHalfEdges(), false);
+    m_vertex_border.assign(NbVertices(), false);
+
+    for(glm::uint he = 0; he < NbHalfEdges(); he++)
+    {
+        if(m_he_twin[he] == NULL_INDEX)
+        {
+            m_he_border[he] = true;
+            m_vertex_border[m_he_vertex[he]] = true;
+            m_vertex_border[m_he_vertex[m_he_next[he]]] = true;
+        }
+    }
+}
+
+bool MeshHE::IsAtBorder(const HalfEdge he) const
+{
+    return m_he_border[he.m_id];
+}
+
+bool MeshHE::IsAtBorder(const Vertex v) const
+{
+    return m_vertex_border[v.m_id];
+}
+
+bool MeshHE::IsAtBorder(const Face f) const
+{
+	glm::uint h = m_face_he[f.m_id];
+	return m_he_border[h] || m_he_border[m_he_next[h]] || m_he_border[m_he_next[m_he_next[h]]];
 }
 
 
@@ -519,36 +745,96 @@ bool MeshHE::IsAtBorder(const Face* f) const
 
 void MeshHE::display() const
 {
-    for(glm::uint i=0; i<m_vertices.size(); i++)
-        m_vertices[i]->display();
+    for(glm::uint i=0; i<NbVertices(); i++)
+    {
+        cout << "v #" << i << endl;
+        cout << "| position: " << m_positions[i].x << " " << m_positions[i].y << " " << m_positions[i].z << endl;
+        cout << "| normal: " << m_normals[i].x << " " << m_normals[i].y << " " << m_normals[i].z << endl;
+
+        if(m_vertex_he[i] != NULL_INDEX)
+            cout << "| half edge: " << m_vertex_he[i] << endl;
+        else
+            cout << "| half edge: NULL" << endl;
+    }
 
-    for(glm::uint i=0; i<m_faces.size(); i++)
-        m_faces[i]->display();
+    for(glm::uint i=0; i<NbFaces(); i++)
+    {
+        cout << "f #" << i << endl;
+        cout << "| half edge: " << m_face_he[i] << endl;
+    }
 
-    for(glm::uint i=0; i<m_half_edges.size(); i++)
-        m_half_edges[i]->display();
+    for(glm::uint i=0; i<NbHalfEdges(); i++)
+    {
+        cout << "he #" << i << endl;
+        cout << "| vertex: " << m_he_vertex[i] << endl;
+        cout << "| face: " << m_he_face[i] << endl;
+        cout << "| next: " << m_he_next[i] << endl;
+
+        if(m_he_twin[i] != NULL_INDEX)
+            cout << "| twin: " << m_he_twin[i] << endl;
+        else
+            cout << "| twin: NULL" << endl;
+    }
 }
 
 
-void MeshHE::write_obj(const char* filename) const
+bool MeshHE::write_obj(const char* filename) const
 {
     FILE *file;
 
     if((file=fopen(filename,"w"))==NULL)
     {
         std::cout << "Unable to open : " << filename << std::endl;
+        return false;
     }
 
-    for(glm::uint i = 0; i < m_vertices.size(); i++)
+    for(glm::uint i = 0; i < NbVertices(); i++)
     {
-        vec3 p = *m_vertices[i]->m_position;
+        vec3 p = m_positions[i];
         fprintf(file,"v %f %f %f\n", p.x, p.y, p.z);
     }
 
-    for(glm::uint i = 0; i < m_faces.size(); i++)
+    for(glm::uint i = 0; i < NbFaces(); i++)
     {
-        fprintf(file,"f %i %i %i\n", m_faces[i]->m_half_edge->m_vertex->m_id+1, m_faces[i]->m_half_edge->m_next->m_vertex->m_id+1, m_faces[i]->m_half_edge->m_next->m_next->m_vertex->m_id+1);
+        glm::uint he = m_face_he[i];
+        fprintf(file,"f %i %i %i\n", m_he_vertex[he]+1, m_he_vertex[m_he_next[he]]+1, m_he_vertex[m_he_next[m_he_next[he]]]+1);
     }
+
+    return fclose(file) == 0;
+}
+
+/**
+ * @brief MeshHE::write_off
+ * Exports this mesh in an OFF file, with enough digits for the positions
+ * to be read back exactly.
+ * @param filename
+ * @return false if the file could not be written
+ */
+bool MeshHE::write_off(const char* filename) const
+{
+    FILE *file;
+
+    if((file=fopen(filename,"w"))==NULL)
+    {
+        std::cout << "Unable to open : " << filename << std::endl;
+        return false;
+    }
+
+    fprintf(file,"OFF\n%u %u 0\n", NbVertices(), NbFaces());
+
+    for(glm::uint i = 0; i < NbVertices(); i++)
+    {
+        vec3 p = m_positions[i];
+        fprintf(file,"%.9g %.9g %.9g\n", p.x, p.y, p.z);
+    }
+
+    for(glm::uint i = 0; i < NbFaces(); i++)
+    {
+        glm::uint he = m_face_he[i];
+        fprintf(file,"3 %u %u %u\n", m_he_vertex[he], m_he_vertex[m_he_next[he]], m_he_vertex[m_he_next[m_he_next[he]]]);
+    }
+
+    return fclose(file) == 0;
 }
 
 
@@ -559,19 +845,10 @@ void MeshHE::write_obj(const char* filename) const
 
 vector<vec3> MeshHE::computeBB() const
 {
-    vector<vec3> output;
+    vector<vec3> output(2, vec3(0.0f));
 
-    output.push_back(*m_vertices[0]->m_position);
-    output.push_back(*m_vertices[0]->m_position);
-
-    for(int i=1; i<m_vertices.size(); ++i)
-    {
-        vec3 v = *m_vertices[i]->m_position;
-
-        output[0] = glm::min(output[0], v);
-        output[1] = glm::max(output[1], v);
-
-    }
+    if(!m_positions.empty())
+        GetSmoothingKernels().bounding_box(&m_positions.data()->x, m_positions.size(), &output[0].x, &output[1].x);
 
     return output;
 }
@@ -579,155 +856,213 @@ vector<vec3> MeshHE::computeBB() const
 
 void MeshHE::Normalize()
 {
+    TRACE_ZONE("normalize");
+
     vector<vec3> bb = computeBB();
 
     vec3 centre = (bb[0] + bb[1])*0.5f;
     float radius = glm::max(glm::max(bb[1].x - bb[0].x, bb[1].y - bb[0].y), bb[1].z - bb[0].z);
 
-    for(int i=0; i<m_vertices.size(); ++i)
+    int nb_vertices = m_positions.size();
+
+    #pragma omp parallel for schedule(static)
+    for(int i=0; i<nb_vertices; ++i)
     {
-        *m_vertices[i]->m_position = (*m_vertices[i]->m_position - centre) / radius;
+        m_positions[i] = (m_positions[i] - centre) / radius;
     }
 }
 
 
-void MeshHE::ComputeNormals()
+/**
+ * @brief MeshHE::BuildCorners
+ * Caches the corners of every vertex (the half edges originating from it,
+ * one per incident face) in compressed sparse row form, in increasing half
+ * edge order. Unlike the 1-rings, they do not depend on the fans being
+ * manifold.
+ * Should be called again each time the connectivity changes.
+ */
+void MeshHE::BuildCorners()
 {
-    for(unsigned int i=0; i<m_vertices.size(); i++)
-    {
-        if(!IsAtBorder(m_vertices[i]))
-		{
-        *m_vertices[i]->m_normal = vec3(0.0);
-        // cout << "BOUCLE COMPUTENORMALS" << endl;
-        vector<Vertex*> neib = GetVertexNeighbors(m_vertices[i]);
+    glm::uint nb_vertices = NbVertices();
+    glm::uint nb_half_edges = NbHalfEdges();
 
+    m_corner_offsets.assign(nb_vertices+1, 0);
+    for(glm::uint he = 0; he < nb_half_edges; he++)
+        m_corner_offsets[m_he_vertex[he]+1]++;
 
-        glm::uint j_max = neib.size();
-        if(IsAtBorder(m_vertices[i]))
-            j_max --;
-
-        for(glm::uint j = 0; j < j_max; j++)
-        {
-            vec3 d01 = glm::normalize(*neib[ j               ]->m_position - *m_vertices[i]->m_position);
-            vec3 d02 = glm::normalize(*neib[(j+1)%neib.size()]->m_position - *m_vertices[i]->m_position);
+    for(glm::uint v = 0; v < nb_vertices; v++)
+        m_corner_offsets[v+1] += m_corner_offsets[v];
 
-            vec3 faceNormal = glm::normalize(glm::cross(d01, d02));
-
-            float alpha = asin(length(glm::cross(d01, d02)));//1.0;//
-
-            if(glm::isnan(alpha))
-                alpha = 1.0f;
-
-            *m_vertices[i]->m_normal += faceNormal * alpha;
-        }
+    m_corners.resize(nb_half_edges);
+    vector<glm::uint> fill(m_corner_offsets.begin(), m_corner_offsets.end() - 1);
+    for(glm::uint he = 0; he < nb_half_edges; he++)
+        m_corners[fill[m_he_vertex[he]]++] = he;
 
-        *m_vertices[i]->m_normal = -glm::normalize(*m_vertices[i]->m_normal);
-		}
-    }
-    cout << " FIN BOUCLE COMPUTENORMALS" << endl;
+    m_vertex_moved.assign(nb_vertices, 0);
 }
 
-
-//***************
-// OpenGL utilities
-
-const vector<vec3>& MeshHE::gen_positions_array() const
+void MeshHE::MarkMoved(const Vertex v)
 {
-    return m_positions;
+    m_vertex_moved[v.m_id] = 1;
 }
 
-
-const vector<vec3>& MeshHE::gen_normals_array() const
+void MeshHE::MarkAllMoved()
 {
-    return m_normals;
+    m_all_moved = true;
 }
 
-
-vector<glm::uint> MeshHE::gen_faces_array() const
+void MeshHE::MarkInteriorMoved()
 {
-    vector<glm::uint> output;
+    int nb_vertices = NbVertices();
 
-    for(glm::uint i=0; i<m_faces.size(); i++)
+    #pragma omp parallel for schedule(static)
+    for(int v = 0; v < nb_vertices; v++)
     {
-        output.push_back(m_faces[i]->m_half_edge->m_vertex->m_position - &m_positions[0]);
-        output.push_back(m_faces[i]->m_half_edge->m_next->m_vertex->m_position - &m_positions[0]);
-        output.push_back(m_faces[i]->m_half_edge->m_next->m_next->m_vertex->m_position - &m_positions[0]);
+        if(!m_vertex_border[v])
+            m_vertex_moved[v] = 1;
     }
-
-    return output;
 }
 
+void MeshHE::ComputeFaceNormal(const glm::uint f)
+{
+    glm::uint he = 3*f;
+    const vec3& p0 = m_positions[m_he_vertex[he]];
+    const vec3& p1 = m_positions[m_he_vertex[he+1]];
+    const vec3& p2 = m_positions[m_he_vertex[he+2]];
+
+    vec3 d01 = p1 - p0;
+    vec3 d12 = p2 - p1;
+    vec3 d20 = p0 - p2;
+
+    vec3 n = glm::cross(d01, -d20);
+    float double_area = length(n);
+    if(double_area > 0.0f)
+        n /= double_area;
+
+    m_face_normals.X()[f] = n.x;
+    m_face_normals.Y()[f] = n.y;
+    m_face_normals.Z()[f] = n.z;
+
+    // The three corners share |cross|, atan2 stays accurate for flat and obtuse angles
+    m_corner_angles[he  ] = atan2(double_area, -dot(d01, d20));
+    m_corner_angles[he+1] = atan2(double_area, -dot(d12, d01));
+    m_corner_angles[he+2] = atan2(double_area, -dot(d20, d12));
+}
 
+void MeshHE::GatherVertexNormal(const glm::uint v)
+{
+    const float* nx = m_face_normals.X();
+    const float* ny = m_face_normals.Y();
+    const float* nz = m_face_normals.Z();
 
+    vec3 n(0.0f);
+    for(glm::uint k = m_corner_offsets[v]; k < m_corner_offsets[v+1]; k++)
+    {
+        glm::uint he = m_corners[k];
+        glm::uint f = he / 3;
+        n += vec3(nx[f], ny[f], nz[f]) * m_corner_angles[he];
+    }
 
+    float l = length(n);
+    if(l > 0.0f)
+        m_normals[v] = n / l;
+}
 
-//---------------------------------------------------------
-// Vertex section
-//---------------------------------------------------------
-
-glm::uint Vertex::s_id = 0;
-
-void Vertex::display() const
+/**
+ * @brief MeshHE::ComputeNormals
+ * Angle weighted vertex normals, computed per face then gathered per vertex:
+ * a first parallel pass computes the normal and the three corner angles of
+ * each face, a second one sums them over the corners of each vertex, so
+ * there are no concurrent writes.
+ * Only the faces with a vertex moved since the last call (see MarkMoved) are
+ * recomputed, and only the vertices around them gathered again; the first
+ * call after a connectivity change computes everything. Normalize does not
+ * change the normals, so it does not mark any vertex.
+ * Isolated vertices keep their normal.
+ */
+void MeshHE::ComputeNormals()
 {
-    cout << "v #" << m_id << endl;
+    TRACE_ZONE("compute normals");
 
-    cout << "| position: " << m_position->x << " " << m_position->y << " " << m_position->z << endl;
+    int nb_faces = NbFaces();
 
-    cout << "| normal: " << m_normal->x << " " << m_normal->y << " " << m_normal->z << endl;
-
-    if(m_half_edge != NULL)
-        cout << "| half edge: " << m_half_edge->m_id << endl;
-    else
-        cout << "| half edge: NULL" << endl;
-}
+    if(m_face_normals.Size() != glm::uint(nb_faces) || m_corner_angles.size() != NbHalfEdges())
+    {
+        m_face_normals.Resize(nb_faces);
+        m_corner_angles.resize(NbHalfEdges());
+        m_all_moved = true;
+    }
+    m_face_updated.resize(nb_faces);
 
+    bool all = m_all_moved;
+    const glm::uint8* moved = m_vertex_moved.data();
+    glm::uint8* updated = m_face_updated.data();
 
+    // Each thread processes the faces, then the vertices, of its part
+    const vector<glm::uint>& face_order = m_partition.GetFaceOrder();
+    const vector<glm::uint>& vertex_order = m_partition.GetVertexOrder();
+    int nb_parts = m_partition.NbParts();
 
-//---------------------------------------------------------
-// Face section
-//---------------------------------------------------------
+    #pragma omp parallel for schedule(static)
+    for(int part = 0; part < nb_parts; part++)
+    {
+        for(glm::uint i = m_partition.FacePartBegin(part); i < m_partition.FacePartEnd(part); i++)
+        {
+            glm::uint f = face_order[i];
+            glm::uint he = 3*f;
+            updated[f] = all || moved[m_he_vertex[he]] || moved[m_he_vertex[he+1]] || moved[m_he_vertex[he+2]];
+            if(updated[f])
+                ComputeFaceNormal(f);
+        }
+    }
 
-glm::uint Face::s_id = 0;
+    #pragma omp parallel for schedule(static)
+    for(int part = 0; part < nb_parts; part++)
+    {
+        for(glm::uint r = m_partition.PartBegin(part); r < m_partition.PartEnd(part); r++)
+        {
+            glm::uint v = vertex_order[r];
+            bool changed = all;
+            for(glm::uint k = m_corner_offsets[v]; !changed && k < m_corner_offsets[v+1]; k++)
+                changed = updated[m_corners[k] / 3];
 
-void Face::display() const
-{
-    cout << "f #" << m_id << endl;
+            if(changed)
+                GatherVertexNormal(v);
+        }
+    }
 
-    if(m_half_edge != NULL)
-        cout << "| half edge: " << m_half_edge->m_id << endl;
-    else
-        cout << "| half edge: NULL" << endl;
+    std::fill(m_vertex_moved.begin(), m_vertex_moved.end(), 0);
+    m_all_moved = false;
 }
 
 
+//***************
+// OpenGL utilities
 
-//---------------------------------------------------------
-// HalfEdge section
-//---------------------------------------------------------
+const vector<vec3>& MeshHE::gen_positions_array() const
+{
+    return m_positions;
+}
 
-glm::uint HalfEdge::s_id = 0;
 
-void HalfEdge::display() const
+const vector<vec3>& MeshHE::gen_normals_array() const
 {
-    cout << "he #" << m_id << endl;
+    return m_normals;
+}
 
-    if(m_vertex != NULL)
-        cout << "| vertex: " << m_vertex->m_id << endl;
-    else
-        cout << "| vertex: NULL" << endl;
 
-    if(m_face != NULL)
-        cout << "| face: " << m_face->m_id << endl;
-    else
-        cout << "| face: NULL" << endl;
+vector<glm::uint> MeshHE::gen_faces_array() const
+{
+    vector<glm::uint> output;
+    output.reserve(3*NbFaces());
 
-    if(m_next != NULL)
-        cout << "| next: " << m_next->m_id << endl;
-    else
-        cout << "| next: NULL" << endl;
+    for(glm::uint i=0; i<NbFaces(); i++)
+    {
+        glm::uint he = m_face_he[i];
+        output.push_back(m_he_vertex[he]);
+        output.push_back(m_he_vertex[m_he_next[he]]);
+        output.push_back(m_he_vertex[m_he_next[m_he_next[he]]]);
+    }
 
-    if(m_twin != NULL)
-        cout << "| twin: " << m_twin->m_id << endl;
-    else
-        cout << "| twin: NULL" << endl;
+    return output;
 }
@@ -2,143 +2,160 @@
 #define MESH_HE_H
 
 #include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp> // uint8
 
 #include <vector>
 #include <memory>
 
+#include "SimdKernels.h"
+#include "LaplacianOperator.h"
+#include "MeshPartition.h"
+#include "MeshSnapshot.h"
+
 class Mesh;
-class HalfEdge;
+
+
+static const glm::uint NULL_INDEX = 0xFFFFFFFF;   /// Index used for missing elements (e.g. twin of a border half edge)
 
 
 /**
  * @brief The Vertex class.
- * Represents a vertex for the MeshHE class.
- * Vertex attributes: position and normal.
+ * Lightweight handle on a vertex of the MeshHE class.
+ * All the vertex attributes (position, normal, outgoing half edge) are stored
+ * in the arrays of the mesh, the handle only holds the index of the vertex.
  */
 class Vertex
 {
 public:
 
     // Constructors
-    Vertex(glm::vec3* position, glm::vec3* normal) :
-        m_id(s_id++), m_position(position), m_normal(normal), m_half_edge(NULL) {}
+    explicit Vertex(glm::uint id = NULL_INDEX) : m_id(id) {}
 
+    bool IsValid() const { return m_id != NULL_INDEX; }
 
-    // I/O
-    void display() const;            /// Displays some information about the vertex in the console
-    glm::uint m_id;                  /// Id of the vertex (used for display)
-    static glm::uint s_id;           /// Static instance counter (for id generation)
-
-
-public:
-
-    // Attributes
-    HalfEdge* m_half_edge;      /// Pointer to one of the half edges originating from this vertex (from which the others can be retrieved)
-
-    glm::vec3* m_position;       /// Pointer to the position of the vertex
-    glm::vec3* m_normal;         /// Pointer to the normal of the vertex (should be normalized)
+    glm::uint m_id;                  /// Index of the vertex in the arrays of the mesh
 };
 
 
 /**
  * @brief The Face class.
- * Represents a face of for the MeshHE class.
- * Face attribute: none.
+ * Lightweight handle on a face of the MeshHE class.
  */
 class Face
 {
 public:
 
     // Constructors
-    Face() : m_id(s_id++), m_half_edge(NULL) {}
-
-    void display() const;            /// displays some information about the face in the console
-    glm::uint m_id;                  /// id of the face (used for display)
-    static glm::uint s_id;           /// static instance counter (for id generation)
+    explicit Face(glm::uint id = NULL_INDEX) : m_id(id) {}
 
+    bool IsValid() const { return m_id != NULL_INDEX; }
 
-public:
-
-    // Attributes
-    HalfEdge* m_half_edge;           /// Pointer to one of the half edges contouring this face (from which the others can be retrieved)
+    glm::uint m_id;                  /// Index of the face in the arrays of the mesh
 };
 
 
 /**
  * @brief The HalfEdge class.
- * Represents a half edge for the MeshHE class.
- * Half edge attribute: none.
+ * Lightweight handle on a half edge of the MeshHE class.
  */
 class HalfEdge
 {
 public:
 
-    // Constructors & utils  glm::vec3* m_position;
-    HalfEdge(): m_id(s_id++), m_next(NULL), m_twin(NULL) {}
-
-    bool EstEgal(const HalfEdge& he1,const HalfEdge& he2 );         /// Assignement operator performing deep copy
-
-
-    // I/O
-    void display() const;            /// Displays some information about the half edge in the console
-    glm::uint m_id;                  /// Id of the face (used for display)
-    static glm::uint s_id;           /// Static instance counter (for id generation)
-
-
-public:
+    // Constructors
+    explicit HalfEdge(glm::uint id = NULL_INDEX) : m_id(id) {}
 
-    // Attributes
-    Vertex* m_vertex;           /// Pointer to the vertex at the origin of the half edge
-    Face*   m_face;             /// Pointer to the face which contour is described by this half edge
+    bool IsValid() const { return m_id != NULL_INDEX; }
 
-    HalfEdge* m_twin;           /// Pointer to the other half of the edge (NULL if this is a border edge)
-    HalfEdge* m_next;           /// Pointer to the next half edge in m_face
+    glm::uint m_id;                  /// Index of the half edge in the arrays of the mesh
 };
 
 
 /**
  * @brief The MeshHE class.
  * Implements the half edge data structure for triangular meshes.
+ * The connectivity is stored as parallel arrays of 32 bits indices
+ * (structure of arrays), Vertex, Face and HalfEdge are only handles on them.
  */
 class MeshHE
 {
  public:
 
-    // Constructors / Destructor & copy utils
-    MeshHE(){}                                  /// Standard constructor
-    MeshHE(const MeshHE &m);                    /// Copy constructor
+    // Constructors & copy utils
+    MeshHE() : m_all_moved(true), m_nb_non_manifold_edges(0) {}    /// Standard constructor
     MeshHE(const Mesh& m);                      /// Constructor from Mesh (usefull for OFF loading)
-    ~MeshHE();                                  /// Simple ressources de-allocation
-
-    MeshHE& operator=(const MeshHE& m);         /// Assignement operator performing deep copy
+    explicit MeshHE(const MeshSnapshot& s);     /// Mesh in the state of a snapshot
+                                                /// Copy constructor and assignement operator perform a plain copy of the arrays,
+                                                /// move constructor and assignement take them over without any copy
     void ClearRessources();                     /// Simple ressources de-allocation
 
-
-    // Smoothing [TODO]
-    std::vector<Vertex*> GetVertexNeighbors(const Vertex* v) const;                                      /// Computes the 1-ring of vertex v
-    glm::vec3 Laplacian(const Vertex *v) const;                                                          /// Computes the laplacian of vertex v of this mesh
-    void LaplacianSmooth(const float lambda = 1.0, const glm::uint nb_iter = 1);                         /// Performs nb_iter steps of laplacian smoothing with factor lambda
-    void TaubinSmooth(const float lambda = 0.330, const float mu = -0.331, const glm::uint nb_iter = 1); /// Performs nb_iter steps of taubin smoothing with factors lambda and mu
-
-    // Noising [TODO]
+    void BuildConnectivity(const std::vector<glm::uint>& faces, const glm::uint nb_vertices);   /// Builds the half edges from triangle indices in linear time
+    void BuildAdjacency();                                                                      /// Rebuilds the cached 1-rings (to call when the connectivity changes)
+    void BuildBorderFlags();                                                                    /// Rebuilds the cached border flags (to call when the connectivity changes)
+    void BuildCorners();                                                                        /// Rebuilds the cached corners of each vertex (to call when the connectivity changes)
+    void RebuildCaches();                                                                       /// Rebuilds the 1-rings, border flags, corners, partition and laplacian (to call when the half edges are set directly)
+    void Renumber(const std::vector<glm::uint>& vertex_order, const std::vector<glm::uint>& face_order);    /// Vertex (face) i becomes the former vertex_order[i] (face_order[i]), the half edges are rebuilt
+
+
+    // Element access
+    glm::uint NbVertices() const  { return m_vertex_he.size(); }
+    glm::uint NbFaces() const     { return m_face_he.size(); }
+    glm::uint NbHalfEdges() const { return m_he_next.size(); }
+
+    HalfEdge GetHalfEdge(const Vertex v) const  { return HalfEdge(m_vertex_he[v.m_id]); }  /// One of the half edges originating from v
+    HalfEdge GetHalfEdge(const Face f) const    { return HalfEdge(m_face_he[f.m_id]); }    /// One of the half edges contouring f
+    HalfEdge GetNext(const HalfEdge he) const   { return HalfEdge(m_he_next[he.m_id]); }
+    HalfEdge GetTwin(const HalfEdge he) const   { return HalfEdge(m_he_twin[he.m_id]); }   /// Invalid handle if he is a border half edge
+    Vertex GetVertex(const HalfEdge he) const   { return Vertex(m_he_vertex[he.m_id]); }   /// Vertex at the origin of he
+    Face GetFace(const HalfEdge he) const       { return Face(m_he_face[he.m_id]); }
+
+    glm::vec3& GetPosition(const Vertex v)             { return m_positions[v.m_id]; }
+    const glm::vec3& GetPosition(const Vertex v) const { return m_positions[v.m_id]; }
+    glm::vec3& GetNormal(const Vertex v)               { return m_normals[v.m_id]; }
+    const glm::vec3& GetNormal(const Vertex v) const   { return m_normals[v.m_id]; }
+
+
+    // Smoothing
+    std::vector<Vertex> GetVertexNeighbors(const Vertex v) const;                                        /// Computes the 1-ring of vertex v
+    glm::uint GetNbNeighbors(const Vertex v) const { return m_adjacency_offsets[v.m_id+1] - m_adjacency_offsets[v.m_id]; }    /// Size of the cached 1-ring of vertex v
+    const glm::uint* GetNeighbors(const Vertex v) const { return &m_adjacency[0] + m_adjacency_offsets[v.m_id]; }             /// Cached 1-ring of vertex v (no allocation)
+    glm::vec3 Laplacian(const Vertex v) const;                                                           /// Computes the laplacian of vertex v of this mesh
+    void LaplacianSmooth(const float lambda = 1.0, const glm::uint nb_iter = 1, const int nb_threads = 0);                         /// Performs nb_iter steps of laplacian smoothing with factor lambda
+    void TaubinSmooth(const float lambda = 0.330, const float mu = -0.331, const glm::uint nb_iter = 1, const int nb_threads = 0); /// Performs nb_iter steps of taubin smoothing with factors lambda and mu
+                                                                                                                                   /// (nb_threads = 0 uses the OpenMP default)
+    glm::uint ImplicitSmooth(const float lambda_dt = 1.0, const glm::uint nb_iter = 1, const int nb_threads = 0);                  /// Performs nb_iter backward Euler steps of time lambda_dt (returns the number of solver iterations)
+    static int NbThreads(const int nb_threads);                                                                                    /// Number of threads actually used for a nb_threads request
+
+    void SetLaplacianWeights(const LaplacianWeights weights, const float tolerance = LaplacianOperator::WEIGHT_TOLERANCE);     /// Chooses the weights used by the smoothing (geometric weights follow the positions, within tolerance mean edge lengths)
+    const LaplacianOperator& GetLaplacianOperator() const { return m_laplacian; }
+    const MeshPartition& GetPartition() const { return m_partition; }           /// Parts of the vertices and faces processed by each thread
+
+    // Snapshots
+    MeshSnapshot TakeSnapshot();                                /// Copies the positions and normals, shares the connectivity with the other snapshots of this mesh
+    bool RestoreSnapshot(const MeshSnapshot& snapshot);         /// Back to the state of snapshot (its connectivity is only copied if it is not the current one)
+
+    // Noising
     void Noise();
     void NoiseNotBorder();
 
-    // Border detection [TODO]
-    bool IsAtBorder(const Vertex* v) const;     /// Tells wether vertex v is at border or not
-    bool IsAtBorder(const HalfEdge* he) const;  /// Tells wether half edge he is at border or not
-    bool IsAtBorder(const Face* f) const;       /// Tells wether face f is at border or not
+    // Border detection (cached flags, see BuildBorderFlags)
+    bool IsAtBorder(const Vertex v) const;      /// Tells wether vertex v is at border or not
+    bool IsAtBorder(const HalfEdge he) const;   /// Tells wether half edge he is at border or not
+    bool IsAtBorder(const Face f) const;        /// Tells wether face f is at border or not
 
 
     // I/O
     void display() const;                       /// Displays some info about this mesh in the console
-    void write_obj(const char* filename) const; /// Exports this mesh in an OBJ file
+    bool write_obj(const char* filename) const; /// Exports this mesh in an OBJ file
+    bool write_off(const char* filename) const; /// Exports this mesh in an OFF file
 
 
     // Geometric utilities
     std::vector< glm::vec3 > computeBB() const ;/// Computes the bounding box of this mesh (usefull for normalization)
     void Normalize();                           /// Normalises and centers this mesh
-    void ComputeNormals();                      /// Computes new normals for each vertex of this mesh
+    void ComputeNormals();                      /// Updates the normals of the vertices around the ones moved since the last call
+    void MarkMoved(const Vertex v);             /// Tells ComputeNormals that v moved (the smoothing and noising methods do it themselves)
+    void MarkAllMoved();                        /// Tells ComputeNormals that all the vertices moved
 
 
     // OpenGL utilities
@@ -150,18 +167,60 @@ class MeshHE
 
 public:
 
-    // Attributes
-    std::vector<HalfEdge*> m_half_edges;            /// Container for the half edges of the mesh
-    std::vector<Face*> m_faces;                     /// Container for the faces of the mesh
-    std::vector<Vertex*> m_vertices;                /// Container for the vertices of the mesh
+    // Half edges attributes (one entry per half edge)
+    std::vector<glm::uint> m_he_next;               /// Index of the next half edge in the same face
+    std::vector<glm::uint> m_he_twin;               /// Index of the other half of the edge (NULL_INDEX if this is a border edge)
+    std::vector<glm::uint> m_he_vertex;             /// Index of the vertex at the origin of the half edge
+    std::vector<glm::uint> m_he_face;               /// Index of the face which contour is described by the half edge
+
+    // Vertices and faces attributes
+    std::vector<glm::uint> m_vertex_he;             /// Index of one of the half edges originating from each vertex (the first one of the fan for border vertices)
+    std::vector<glm::uint> m_face_he;               /// Index of one of the half edges contouring each face
 
     std::vector<glm::vec3> m_positions;             /// Container for the vertices positions
     std::vector<glm::vec3> m_normals;               /// Container for the vertices normals
 
+    // 1-ring cache (compressed sparse row)
+    std::vector<glm::uint> m_adjacency_offsets;     /// Start of the 1-ring of each vertex in m_adjacency (NbVertices()+1 entries)
+    std::vector<glm::uint> m_adjacency;             /// Concatenated 1-rings of all the vertices
+
+    // Border cache
+    std::vector<bool> m_he_border;                  /// Border flag of each half edge (no twin)
+    std::vector<bool> m_vertex_border;              /// Border flag of each vertex (origin or end of a border half edge)
+
+    // Smoothing engine
+    MeshPartition m_partition;                      /// One part per thread, built for the default number of threads
+    LaplacianOperator m_laplacian;                  /// Assembled laplacian (border vertices stay fixed), rows in the partition order
+    SoAPositions m_smoothing_src;                   /// Double buffer of padded x/y/z positions for the Jacobi steps, in the partition order
+    SoAPositions m_smoothing_dst;
+    SoAPositions m_implicit_delta;                  /// Displacement of the last implicit step, used to warm start the next one
+    static const float IMPLICIT_TOLERANCE;          /// Relative residual at which the implicit solver stops
+    static const glm::uint IMPLICIT_MAX_ITER = 500; /// Iteration limit of the implicit solver
+
+    // Normal engine
+    std::vector<glm::uint> m_corner_offsets;        /// Start of the corners of each vertex in m_corners (NbVertices()+1 entries)
+    std::vector<glm::uint> m_corners;               /// Half edges originating from each vertex, i.e. its corners in the faces
+    SoAPositions m_face_normals;                    /// Unit normal of each face (x, y and z arrays)
+    std::vector<float> m_corner_angles;             /// Angle of the face at the origin of each half edge
+    std::vector<glm::uint8> m_vertex_moved;         /// Vertices moved since the last call to ComputeNormals
+    std::vector<glm::uint8> m_face_updated;         /// Faces recomputed by the current call to ComputeNormals
+    bool m_all_moved;                               /// All the vertices moved (m_vertex_moved is not filled)
+
+    glm::uint m_nb_non_manifold_edges;              /// Number of non manifold edges found by BuildConnectivity (left as borders)
+
+    // Snapshots
+    std::shared_ptr<const MeshHE> m_topology;           /// Connectivity shared by the snapshots, made by the first one (reset when the connectivity or the weights change)
+
 private:
 
-    std::vector<Vertex*> GetVertexNeighborsNotBorder(const Vertex* v) const;                                      /// Computes the 1-ring of vertex v
-    std::vector<Vertex*> GetVertexNeighborsAtBorder(const Vertex* v) const;                                      /// Computes the 1-ring of vertex v
+    void CopyConnectivity(const MeshHE& mesh);                                  /// Copies everything that only depends on the half edges of mesh
+    void MarkInteriorMoved();                                                   /// Marks all the vertices which are not at border as moved
+    void UpdatePartition(const int nb_threads);                                 /// Rebuilds the partition and the laplacian if nb_threads needs another number of parts
+    void ComputeFaceNormal(const glm::uint f);                                  /// Computes the normal and corner angles of face f
+    void GatherVertexNormal(const glm::uint v);                                 /// Angle weighted average of the normals of the faces around v
+
+    glm::uint CountVertexNeighbors(const glm::uint v) const;                    /// Size of the 1-ring of vertex v, computed from the half edges
+    void FillVertexNeighbors(const glm::uint v, glm::uint* neighbors) const;    /// Writes the 1-ring of vertex v, computed from the half edges
 
 };
 
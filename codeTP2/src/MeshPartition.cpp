@@ -0,0 +1,170 @@
+#include <MeshPartition.h>
+#include <MeshHE.h>
+#include <LaplacianOperator.h>
+#include <SimdKernels.h>
+#include <Trace.h>
+
+#include <algorithm>
+#include <glm/gtc/type_precision.hpp> // uint8, uint64
+
+using namespace glm;
+using namespace std;
+
+const glm::uint MeshPartition::MORTON_BITS;
+
+
+/// Spreads the 10 low bits of x to every third bit
+static inline glm::uint SpreadBits(glm::uint x)
+{
+    x &= 0x3FF;
+    x = (x | (x << 16)) & 0x030000FF;
+    x = (x | (x <<  8)) & 0x0300F00F;
+    x = (x | (x <<  4)) & 0x030C30C3;
+    x = (x | (x <<  2)) & 0x09249249;
+    return x;
+}
+
+/**
+ * @brief MeshPartition::ComputeCurveOrder
+ * Sorts the vertices by Morton code of their cell, in a grid of cubic cells
+ * (2^MORTON_BITS along the largest side of the bounding box). The vertices
+ * of a cell stay in index order.
+ */
+void MeshPartition::ComputeCurveOrder(const MeshHE &mesh, vector<glm::uint> &order)
+{
+    int nb_vertices = mesh.NbVertices();
+
+    vec3 bb_min(0.0f), bb_max(0.0f);
+    if(nb_vertices > 0)
+        GetSmoothingKernels().bounding_box(&mesh.m_positions.data()->x, nb_vertices, &bb_min.x, &bb_max.x);
+
+    vec3 size = bb_max - bb_min;
+    float extent = glm::max(size.x, glm::max(size.y, size.z));
+    float scale = extent > 0.0f ? float(1u << MORTON_BITS) / extent : 0.0f;
+    float max_cell = float((1u << MORTON_BITS) - 1);
+
+    vector<glm::uint64> keys(nb_vertices);
+
+    #pragma omp parallel for schedule(static)
+    for(int v = 0; v < nb_vertices; v++)
+    {
+        vec3 q = glm::clamp((mesh.m_positions[v] - bb_min) * scale, vec3(0.0f), vec3(max_cell));
+        glm::uint code = SpreadBits(glm::uint(q.x)) | (SpreadBits(glm::uint(q.y)) << 1) | (SpreadBits(glm::uint(q.z)) << 2);
+        keys[v] = (glm::uint64(code) << 32) | glm::uint(v);
+    }
+    sort(keys.begin(), keys.end());
+
+    order.resize(nb_vertices);
+
+    #pragma omp parallel for schedule(static)
+    for(int i = 0; i < nb_vertices; i++)
+        order[i] = glm::uint(keys[i]);
+}
+
+/**
+ * @brief MeshPartition::Build
+ * The parts are cut on LaplacianOperator block boundaries, so that each
+ * block of rows belongs to a single part. The order only depends on the
+ * positions and on nb_parts.
+ */
+void MeshPartition::Build(const MeshHE &mesh, const glm::uint nb_parts)
+{
+    TRACE_ZONE("partition");
+
+    int nb_vertices = mesh.NbVertices();
+    int nb_faces = mesh.NbFaces();
+    glm::uint nb = glm::max(nb_parts, 1u);
+    const glm::uint BLOCK_SIZE = LaplacianOperator::BLOCK_SIZE;
+
+    vector<glm::uint> curve;
+    ComputeCurveOrder(mesh, curve);
+
+    // Parts of equal numbers of blocks along the curve
+    glm::uint nb_blocks = (nb_vertices + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    m_part_offsets.resize(nb+1);
+    for(glm::uint p = 0; p <= nb; p++)
+        m_part_offsets[p] = glm::min(glm::uint(nb_vertices), glm::uint(glm::uint64(nb_blocks) * p / nb) * BLOCK_SIZE);
+
+    vector<glm::uint> part_of(nb_vertices);
+
+    #pragma omp parallel for schedule(static)
+    for(int p = 0; p < int(nb); p++)
+    {
+        for(glm::uint i = m_part_offsets[p]; i < m_part_offsets[p+1]; i++)
+            part_of[curve[i]] = p;
+    }
+
+    // Interior vertices first, then the interface ones, each in curve order
+    m_vertex_order.resize(nb_vertices);
+    m_interface_offsets.resize(nb);
+    vector<glm::uint8> is_interface(nb_vertices);
+
+    #pragma omp parallel for schedule(static)
+    for(int p = 0; p < int(nb); p++)
+    {
+        glm::uint nb_interior = 0;
+
+        for(glm::uint i = m_part_offsets[p]; i < m_part_offsets[p+1]; i++)
+        {
+            glm::uint v = curve[i];
+            const glm::uint* neighbors = mesh.GetNeighbors(Vertex(v));
+            glm::uint nb_neighbors = mesh.GetNbNeighbors(Vertex(v));
+
+            bool on_interface = false;
+            for(glm::uint k = 0; k < nb_neighbors && !on_interface; k++)
+                on_interface = part_of[neighbors[k]] != glm::uint(p);
+
+            is_interface[v] = on_interface;
+            nb_interior += !on_interface;
+        }
+
+        glm::uint next = m_part_offsets[p];
+        glm::uint next_interface = next + nb_interior;
+        m_interface_offsets[p] = next_interface;
+
+        for(glm::uint i = m_part_offsets[p]; i < m_part_offsets[p+1]; i++)
+        {
+            glm::uint v = curve[i];
+            if(is_interface[v])
+                m_vertex_order[next_interface++] = v;
+            else
+                m_vertex_order[next++] = v;
+        }
+    }
+
+    m_vertex_ranks.resize(nb_vertices);
+
+    #pragma omp parallel for schedule(static)
+    for(int r = 0; r < nb_vertices; r++)
+        m_vertex_ranks[m_vertex_order[r]] = r;
+
+    // Faces by part of their first vertex (counting sort, in face order)
+    m_face_part_offsets.assign(nb+1, 0);
+    for(int f = 0; f < nb_faces; f++)
+        m_face_part_offsets[part_of[mesh.m_he_vertex[3*f]] + 1]++;
+    for(glm::uint p = 0; p < nb; p++)
+        m_face_part_offsets[p+1] += m_face_part_offsets[p];
+
+    vector<glm::uint> cursor(m_face_part_offsets.begin(), m_face_part_offsets.end() - 1);
+    m_face_order.resize(nb_faces);
+    for(int f = 0; f < nb_faces; f++)
+        m_face_order[cursor[part_of[mesh.m_he_vertex[3*f]]]++] = f;
+}
+
+void MeshPartition::Clear()
+{
+    m_vertex_order.clear();
+    m_vertex_ranks.clear();
+    m_part_offsets.clear();
+    m_interface_offsets.clear();
+    m_face_order.clear();
+    m_face_part_offsets.clear();
+}
+
+glm::uint MeshPartition::NbInterfaceVertices() const
+{
+    glm::uint count = 0;
+    for(glm::uint p = 0; p < NbParts(); p++)
+        count += PartEnd(p) - InterfaceBegin(p);
+    return count;
+}
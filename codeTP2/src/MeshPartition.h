@@ -0,0 +1,60 @@
+#ifndef MESH_PARTITION_H
+#define MESH_PARTITION_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+class MeshHE;
+
+
+/**
+ * @brief The MeshPartition class.
+ * Splits the vertices of a MeshHE in spatially compact parts, one per thread:
+ * the vertices are sorted along a Morton curve (1024^3 grid of cubic cells
+ * over the bounding box) and the curve is cut in parts of equal numbers of
+ * LaplacianOperator blocks. Inside each part, the interior vertices (whole
+ * 1-ring in the part) come first, then the interface vertices (1-ring
+ * reaching another part).
+ * The laplacian operator stores its rows in this order, so that each thread
+ * sweeps one contiguous range of the smoothing arrays, and first touches it.
+ * The faces are grouped by the part of their first vertex, for the normal
+ * passes.
+ */
+class MeshPartition
+{
+public:
+
+    static const glm::uint MORTON_BITS = 10;    /// Bits per axis of the Morton codes
+
+    MeshPartition() {}
+
+    void Build(const MeshHE& mesh, const glm::uint nb_parts);      /// Partitions the vertices (the 1-rings of mesh must be built)
+    void Clear();
+
+    static void ComputeCurveOrder(const MeshHE& mesh, std::vector<glm::uint>& order);   /// Vertices sorted along the Morton curve
+
+    glm::uint NbParts() const { return m_part_offsets.empty() ? 0 : m_part_offsets.size() - 1; }
+
+    const std::vector<glm::uint>& GetVertexOrder() const { return m_vertex_order; }     /// Vertices part after part (interior ones first)
+    const std::vector<glm::uint>& GetVertexRanks() const { return m_vertex_ranks; }     /// Position of each vertex in the vertex order
+    const std::vector<glm::uint>& GetFaceOrder() const   { return m_face_order; }       /// Faces part after part
+
+    glm::uint PartBegin(const glm::uint part) const      { return m_part_offsets[part]; }          /// First rank of a part
+    glm::uint InterfaceBegin(const glm::uint part) const { return m_interface_offsets[part]; }     /// First rank of the interface vertices of a part
+    glm::uint PartEnd(const glm::uint part) const        { return m_part_offsets[part+1]; }
+    glm::uint FacePartBegin(const glm::uint part) const  { return m_face_part_offsets[part]; }     /// First face of a part in the face order
+    glm::uint FacePartEnd(const glm::uint part) const    { return m_face_part_offsets[part+1]; }
+    glm::uint NbInterfaceVertices() const;
+
+private:
+
+    std::vector<glm::uint> m_vertex_order;
+    std::vector<glm::uint> m_vertex_ranks;
+    std::vector<glm::uint> m_part_offsets;          /// Start of each part in m_vertex_order (NbParts()+1 entries), multiples of LaplacianOperator::BLOCK_SIZE
+    std::vector<glm::uint> m_interface_offsets;     /// Start of the interface vertices of each part in m_vertex_order
+    std::vector<glm::uint> m_face_order;
+    std::vector<glm::uint> m_face_part_offsets;     /// Start of each part in m_face_order (NbParts()+1 entries)
+};
+
+#endif // MESH_PARTITION_H
@@ -0,0 +1,313 @@
+#include <MeshReorder.h>
+#include <MeshHE.h>
+#include <MeshPartition.h>
+#include <Trace.h>
+
+#include <algorithm>
+#include <numeric>
+
+using namespace glm;
+using namespace std;
+
+const glm::uint MeshReorder::VERTEX_CACHE_SIZE;
+
+
+/**
+ * @brief MeshReorder::Reorder
+ * The face order is computed on the current numbering, with the dead ends
+ * resolved along the new vertex order, so that the half edges are only
+ * rebuilt once.
+ */
+void MeshReorder::Reorder(MeshHE &mesh, const VertexOrdering ordering, const bool reorder_faces)
+{
+    TRACE_ZONE("reorder");
+
+    if(ordering == KEEP_VERTEX_ORDER && !reorder_faces)
+        return;
+
+    vector<glm::uint> vertex_order;
+    switch(ordering)
+    {
+    case KEEP_VERTEX_ORDER:
+        vertex_order.resize(mesh.NbVertices());
+        iota(vertex_order.begin(), vertex_order.end(), 0u);
+        break;
+    case MORTON_VERTEX_ORDER:
+        MeshPartition::ComputeCurveOrder(mesh, vertex_order);
+        break;
+    case RCM_VERTEX_ORDER:
+        ComputeRCMOrder(mesh, vertex_order);
+        break;
+    }
+
+    vector<glm::uint> face_order;
+    if(reorder_faces)
+    {
+        ComputeTipsifyOrder(mesh, vertex_order, face_order);
+    }
+    else
+    {
+        face_order.resize(mesh.NbFaces());
+        iota(face_order.begin(), face_order.end(), 0u);
+    }
+
+    mesh.Renumber(vertex_order, face_order);
+}
+
+
+//***************
+// Vertex order
+
+/// Breadth first search from root, fills queue with the vertices reached (in level order) and returns the last level
+static glm::uint BreadthFirst(const MeshHE &mesh, const glm::uint root, vector<glm::uint> &level, vector<glm::uint> &queue)
+{
+    queue.clear();
+    queue.push_back(root);
+    level[root] = 0;
+
+    for(size_t i = 0; i < queue.size(); i++)
+    {
+        glm::uint v = queue[i];
+        const glm::uint* neighbors = mesh.GetNeighbors(Vertex(v));
+        glm::uint nb_neighbors = mesh.GetNbNeighbors(Vertex(v));
+
+        for(glm::uint k = 0; k < nb_neighbors; k++)
+        {
+            if(level[neighbors[k]] == NULL_INDEX)
+            {
+                level[neighbors[k]] = level[v] + 1;
+                queue.push_back(neighbors[k]);
+            }
+        }
+    }
+
+    return level[queue.back()];
+}
+
+static void ClearLevels(vector<glm::uint> &level, const vector<glm::uint> &queue)
+{
+    for(size_t i = 0; i < queue.size(); i++)
+        level[queue[i]] = NULL_INDEX;
+}
+
+/**
+ * @brief MeshReorder::ComputeRCMOrder
+ * Each connected component is numbered by a breadth first search from a
+ * pseudo-peripheral vertex (George-Liu: restarted from the lowest degree
+ * vertex of the last level while the depth grows), the neighbors of each
+ * vertex being visited by increasing degree. The whole order is reversed.
+ */
+void MeshReorder::ComputeRCMOrder(const MeshHE &mesh, vector<glm::uint> &order)
+{
+    TRACE_ZONE("rcm order");
+
+    glm::uint nb_vertices = mesh.NbVertices();
+
+    vector<glm::uint> level(nb_vertices, NULL_INDEX);
+    vector<glm::uint8> numbered(nb_vertices, 0);
+    vector<glm::uint> queue;
+    vector< pair<glm::uint, glm::uint> > next;     // (degree, vertex) of the neighbors to number
+
+    order.clear();
+    order.reserve(nb_vertices);
+
+    for(glm::uint seed = 0; seed < nb_vertices; seed++)
+    {
+        if(numbered[seed])
+            continue;
+
+        // Pseudo-peripheral root of the component of seed
+        glm::uint root = seed;
+        glm::uint depth = BreadthFirst(mesh, root, level, queue);
+
+        while(true)
+        {
+            glm::uint candidate = queue.back();
+            for(size_t i = queue.size(); i-- > 0 && level[queue[i]] == depth; )
+            {
+                if(mesh.GetNbNeighbors(Vertex(queue[i])) < mesh.GetNbNeighbors(Vertex(candidate)))
+                    candidate = queue[i];
+            }
+
+            ClearLevels(level, queue);
+            glm::uint candidate_depth = BreadthFirst(mesh, candidate, level, queue);
+            if(candidate_depth <= depth)
+                break;
+
+            root = candidate;
+            depth = candidate_depth;
+        }
+        ClearLevels(level, queue);
+
+        // Cuthill-McKee numbering of the component
+        size_t begin = order.size();
+        order.push_back(root);
+        numbered[root] = 1;
+
+        for(size_t i = begin; i < order.size(); i++)
+        {
+            glm::uint v = order[i];
+            const glm::uint* neighbors = mesh.GetNeighbors(Vertex(v));
+            glm::uint nb_neighbors = mesh.GetNbNeighbors(Vertex(v));
+
+            next.clear();
+            for(glm::uint k = 0; k < nb_neighbors; k++)
+            {
+                glm::uint w = neighbors[k];
+                if(!numbered[w])
+                {
+                    numbered[w] = 1;
+                    next.push_back(make_pair(mesh.GetNbNeighbors(Vertex(w)), w));
+                }
+            }
+
+            sort(next.begin(), next.end());
+            for(size_t k = 0; k < next.size(); k++)
+                order.push_back(next[k].second);
+        }
+    }
+
+    reverse(order.begin(), order.end());
+}
+
+
+//***************
+// Face order
+
+/**
+ * @brief MeshReorder::ComputeTipsifyOrder
+ * Emits all the faces around a fanning vertex, then moves to the vertex of
+ * these faces that is still in the cache and has the most faces left (the
+ * one which entered the cache first, unless its remaining faces would push
+ * it out). At a dead end, the last vertices emitted are tried from the most
+ * recent one, then vertex_order is scanned for a vertex with faces left.
+ * The faces around each vertex are its corners (half edges 3f to 3f+2 are
+ * the corners of face f).
+ */
+void MeshReorder::ComputeTipsifyOrder(const MeshHE &mesh, const vector<glm::uint> &vertex_order,
+                                      vector<glm::uint> &face_order, const glm::uint cache_size)
+{
+    TRACE_ZONE("tipsify order");
+
+    glm::uint nb_vertices = mesh.NbVertices();
+    glm::uint nb_faces = mesh.NbFaces();
+
+    vector<glm::uint> live(nb_vertices);            // Faces not emitted yet around each vertex
+    for(glm::uint v = 0; v < nb_vertices; v++)
+        live[v] = mesh.m_corner_offsets[v+1] - mesh.m_corner_offsets[v];
+
+    vector<glm::uint> cache_time(nb_vertices, 0);
+    vector<glm::uint8> emitted(nb_faces, 0);
+    vector<glm::uint> dead_end;
+    vector<glm::uint> candidates;
+    glm::uint time = cache_size + 1;
+    glm::uint cursor = 0;
+
+    face_order.clear();
+    face_order.reserve(nb_faces);
+
+    glm::uint fanning = NULL_INDEX;
+    while(cursor < nb_vertices && fanning == NULL_INDEX)
+    {
+        if(live[vertex_order[cursor]] > 0)
+            fanning = vertex_order[cursor];
+        cursor++;
+    }
+
+    while(fanning != NULL_INDEX)
+    {
+        candidates.clear();
+
+        for(glm::uint k = mesh.m_corner_offsets[fanning]; k < mesh.m_corner_offsets[fanning+1]; k++)
+        {
+            glm::uint f = mesh.m_corners[k] / 3;
+            if(emitted[f])
+                continue;
+
+            for(glm::uint j = 0; j < 3; j++)
+            {
+                glm::uint v = mesh.m_he_vertex[3*f + j];
+                dead_end.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if(time - cache_time[v] > cache_size)
+                    cache_time[v] = time++;
+            }
+
+            emitted[f] = 1;
+            face_order.push_back(f);
+        }
+
+        // Next fanning vertex among the ones just emitted
+        fanning = NULL_INDEX;
+        int best = -1;
+        for(size_t i = 0; i < candidates.size(); i++)
+        {
+            glm::uint v = candidates[i];
+            if(live[v] == 0)
+                continue;
+
+            int priority = 0;
+            if(time - cache_time[v] + 2*live[v] <= cache_size)
+                priority = time - cache_time[v];
+
+            if(priority > best)
+            {
+                best = priority;
+                fanning = v;
+            }
+        }
+
+        // Dead end : most recent vertex with faces left, else the next one in vertex_order
+        while(fanning == NULL_INDEX && !dead_end.empty())
+        {
+            if(live[dead_end.back()] > 0)
+                fanning = dead_end.back();
+            dead_end.pop_back();
+        }
+
+        while(fanning == NULL_INDEX && cursor < nb_vertices)
+        {
+            if(live[vertex_order[cursor]] > 0)
+                fanning = vertex_order[cursor];
+            cursor++;
+        }
+    }
+}
+
+/**
+ * @brief MeshReorder::ComputeACMR
+ * Simulates a FIFO cache of cache_size vertices on the indices of
+ * gen_faces_array, i.e. the order in which Object draws them.
+ */
+float MeshReorder::ComputeACMR(const MeshHE &mesh, const glm::uint cache_size)
+{
+    vector<glm::uint> faces = mesh.gen_faces_array();
+    if(faces.empty())
+        return 0.0f;
+
+    vector<glm::uint> entered(mesh.NbVertices(), NULL_INDEX);     // Miss count when each vertex entered the cache
+    glm::uint nb_misses = 0;
+
+    for(size_t i = 0; i < faces.size(); i++)
+    {
+        glm::uint v = faces[i];
+        if(entered[v] == NULL_INDEX || nb_misses - entered[v] >= cache_size)
+            entered[v] = nb_misses++;
+    }
+
+    return float(nb_misses) / float(faces.size() / 3);
+}
+
+const char* MeshReorder::OrderingName(const VertexOrdering ordering)
+{
+    switch(ordering)
+    {
+    case MORTON_VERTEX_ORDER:
+        return "morton";
+    case RCM_VERTEX_ORDER:
+        return "rcm";
+    default:
+        return "none";
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef MESH_REORDER_H
+#define MESH_REORDER_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+class MeshHE;
+
+
+/// Vertex numberings of MeshReorder
+enum VertexOrdering
+{
+    KEEP_VERTEX_ORDER,          /// vertices keep their order (the one of the file)
+    MORTON_VERTEX_ORDER,        /// along a Morton curve of the bounding box (see MeshPartition)
+    RCM_VERTEX_ORDER            /// reverse Cuthill-McKee on the 1-rings (small index span in each 1-ring)
+};
+
+
+/**
+ * @brief The MeshReorder class.
+ * Renumbers the vertices and faces of a MeshHE for locality, once it is
+ * loaded: the vertices along a space filling curve or by reverse
+ * Cuthill-McKee, so that the 1-ring gathers of the smoothing and the normals
+ * stay in cache, then the faces by Tipsify (Sander et al. 2007), so that the
+ * indices drawn by Object hit the post-transform vertex cache of the GPU.
+ * The efficiency of a face order is measured by its ACMR (average cache miss
+ * ratio : vertices transformed per triangle, between 0.5 and 3) on a FIFO
+ * cache of VERTEX_CACHE_SIZE entries.
+ */
+class MeshReorder
+{
+public:
+
+    static const glm::uint VERTEX_CACHE_SIZE = 16;     /// Entries of the simulated post-transform cache
+
+    static void Reorder(MeshHE& mesh, const VertexOrdering ordering, const bool reorder_faces = true);       /// Renumbers the vertices, then the faces if reorder_faces (the half edges are rebuilt)
+
+    static void ComputeRCMOrder(const MeshHE& mesh, std::vector<glm::uint>& order);                     /// Reverse Cuthill-McKee order of the vertices
+    static void ComputeTipsifyOrder(const MeshHE& mesh, const std::vector<glm::uint>& vertex_order,
+                                    std::vector<glm::uint>& face_order, const glm::uint cache_size = VERTEX_CACHE_SIZE);    /// Tipsify order of the faces (vertex_order is scanned when it reaches a dead end)
+    static float ComputeACMR(const MeshHE& mesh, const glm::uint cache_size = VERTEX_CACHE_SIZE);       /// ACMR of gen_faces_array on a FIFO cache
+
+    static const char* OrderingName(const VertexOrdering ordering);
+};
+
+#endif // MESH_REORDER_H
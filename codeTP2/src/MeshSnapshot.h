@@ -0,0 +1,46 @@
+#ifndef MESH_SNAPSHOT_H
+#define MESH_SNAPSHOT_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <memory>
+
+class MeshHE;
+
+
+/**
+ * @brief The MeshSnapshot class.
+ * Geometric state of a MeshHE (positions and normals), taken by
+ * MeshHE::TakeSnapshot and restored by MeshHE::RestoreSnapshot.
+ * All the snapshots of a mesh share one read only copy of its connectivity
+ * (half edges, 1-rings, partition, laplacian), made by the first snapshot
+ * after each connectivity change, so each snapshot only owns a copy of the
+ * two arrays, taken when it is made.
+ * A snapshot is read only : copying it shares its arrays instead of
+ * duplicating them.
+ */
+class MeshSnapshot
+{
+public:
+
+    MeshSnapshot() {}
+
+    bool IsValid() const { return m_topology != nullptr; }
+    glm::uint NbVertices() const { return m_positions ? m_positions->size() : 0; }
+
+    const std::vector<glm::vec3>& GetPositions() const { return *m_positions; }
+    const std::vector<glm::vec3>& GetNormals() const   { return *m_normals; }
+
+    bool SharesTopology(const MeshSnapshot& snapshot) const { return m_topology == snapshot.m_topology; }     /// Taken from the same connectivity
+
+private:
+
+    friend class MeshHE;
+
+    std::shared_ptr<const MeshHE> m_topology;                   /// Connectivity of the mesh (its positions and normals are empty)
+    std::shared_ptr< const std::vector<glm::vec3> > m_positions;
+    std::shared_ptr< const std::vector<glm::vec3> > m_normals;
+};
+
+#endif // MESH_SNAPSHOT_H
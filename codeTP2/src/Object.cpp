@@ -1,6 +1,7 @@
 #include "Object.h"
 
 #include <iostream>
+#include <cstring>
 
 #include <GL/glew.h>
 
@@ -10,15 +11,22 @@
 #include <glm/ext.hpp>
 
 #include "shader.h"
+#include "QuantizedMesh.h"
+#include "Trace.h"
 
 using namespace std;
 using namespace glm;
 
 
 unsigned int Object::s_id = 0;
-
-Object::Object():
-    m_id(s_id)
+const glm::uint Object::UPDATE_BLOCK_SIZE;
+
+Object::Object(const bool compact):
+    m_id(s_id),
+    m_compact(compact),
+    m_positionOrigin(0.0f),
+    m_positionStep(0.0f),
+    m_nbBufferVertices(0)
 {
     s_id++;
 
@@ -27,8 +35,8 @@ Object::Object():
 
 Object::~Object()
 {
+    glDeleteVertexArrays(1, &m_vertexArrayID);
     glDeleteBuffers(1, &m_vertexBufferID);
-    glDeleteBuffers(1, &m_normalBufferID);
     glDeleteBuffers(1, &m_elementBufferID);
 }
 
@@ -38,19 +46,108 @@ void Object::SetMesh(MeshHE *mesh)
     UpdateBuffers();
 }
 
+/**
+ * @brief Object::UpdateGeometryBuffers
+ * Interleaves the positions and normals of the mesh and compares them with
+ * the current content of the vertex buffer by blocks of UPDATE_BLOCK_SIZE
+ * vertices. The buffer is only reallocated when the number of vertices
+ * changes. When most of it changed, it is orphaned (glBufferData with no data)
+ * before being filled, so the driver renames the storage instead of waiting
+ * for the frames still drawing the old one; otherwise only the changed ranges
+ * are sent with glBufferSubData.
+ * Compact positions are quantized in the current bounding box, so a change of
+ * the box changes every vertex.
+ */
 void Object::UpdateGeometryBuffers()
 {
+    TRACE_ZONE("update geometry buffers");
+
+    glm::uint nb_vertices = m_mesh->NbVertices();
+    const vector<vec3>& positions = m_mesh->gen_positions_array();
+    const vector<vec3>& normals = m_mesh->gen_normals_array();
+
+    const GLsizeiptr vertex_size = m_compact ? sizeof(CompactVertex) : 2 * sizeof(vec3);
+    m_stagingData.resize(vertex_size * nb_vertices);
+
+    if(m_compact)
+    {
+        if(nb_vertices > 0)
+        {
+            vector<vec3> bb = m_mesh->computeBB();
+            QuantizedMesh::ComputeGrid(bb[0], bb[1], 16, m_positionOrigin, m_positionStep);
+        }
+
+        CompactVertex* vertices = reinterpret_cast<CompactVertex*>(m_stagingData.data());
+        for(glm::uint i = 0; i < nb_vertices; i++)
+        {
+            uvec3 q = QuantizedMesh::QuantizePosition(positions[i], m_positionOrigin, m_positionStep, 16);
+            vertices[i].position[0] = glm::uint16(q.x);
+            vertices[i].position[1] = glm::uint16(q.y);
+            vertices[i].position[2] = glm::uint16(q.z);
+            vertices[i].position[3] = 0;
+            vertices[i].normal = QuantizedMesh::EncodeOctahedral(normals[i]);
+        }
+    }
+    else
+    {
+        vec3* vertices = reinterpret_cast<vec3*>(m_stagingData.data());
+        for(glm::uint i = 0; i < nb_vertices; i++)
+        {
+            vertices[2*i  ] = positions[i];
+            vertices[2*i+1] = normals[i];
+        }
+    }
+
     glBindBuffer(GL_ARRAY_BUFFER, m_vertexBufferID);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * m_mesh->m_vertices.size(), m_mesh->gen_positions_array().data(), GL_STATIC_DRAW);
 
-    glBindBuffer(GL_ARRAY_BUFFER, m_normalBufferID);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * m_mesh->m_vertices.size(), m_mesh->gen_normals_array().data(), GL_STATIC_DRAW);
+    if(nb_vertices != m_nbBufferVertices)
+    {
+        glBufferData(GL_ARRAY_BUFFER, vertex_size * nb_vertices, m_stagingData.data(), GL_DYNAMIC_DRAW);
+        m_nbBufferVertices = nb_vertices;
+        m_vertexData.swap(m_stagingData);
+        return;
+    }
+
+    // Changed ranges, merged when contiguous
+    vector<glm::uvec2> ranges;
+    glm::uint nb_changed = 0;
+    for(glm::uint begin = 0; begin < nb_vertices; begin += UPDATE_BLOCK_SIZE)
+    {
+        glm::uint end = glm::min(begin + UPDATE_BLOCK_SIZE, nb_vertices);
+        if(memcmp(&m_stagingData[vertex_size*begin], &m_vertexData[vertex_size*begin], vertex_size * (end - begin)) == 0)
+            continue;
+
+        if(!ranges.empty() && ranges.back().y == begin)
+            ranges.back().y = end;
+        else
+            ranges.push_back(glm::uvec2(begin, end));
+        nb_changed += end - begin;
+    }
+
+    if(nb_changed == 0)
+        return;
+
+    if(nb_changed > nb_vertices / 2)
+    {
+        glBufferData(GL_ARRAY_BUFFER, vertex_size * nb_vertices, NULL, GL_DYNAMIC_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, vertex_size * nb_vertices, m_stagingData.data());
+    }
+    else
+    {
+        for(size_t r = 0; r < ranges.size(); r++)
+        {
+            glBufferSubData(GL_ARRAY_BUFFER, vertex_size * ranges[r].x, vertex_size * (ranges[r].y - ranges[r].x),
+                            &m_stagingData[vertex_size*ranges[r].x]);
+        }
+    }
+
+    m_vertexData.swap(m_stagingData);
 }
 
 void Object::UpdateElementsBuffer()
 {
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_elementBufferID);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(glm::uint) * 3 * m_mesh->m_faces.size(), m_mesh->gen_faces_array().data(), GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(glm::uint) * 3 * m_mesh->NbFaces(), m_mesh->gen_faces_array().data(), GL_STATIC_DRAW);
 }
 
 void Object::UpdateBuffers()
@@ -64,13 +161,13 @@ void Object::UpdateBuffers()
 
 void Object::GenBuffers()
 {
-    glGenBuffers(1, &m_vertexBufferID);
+    glGenVertexArrays(1, &m_vertexArrayID);
     if(DISPLAY_DEBUG_INFO)
-        cout << "  vertexBufferID = " << m_vertexBufferID << endl;
+        cout << "  vertexArrayID = " << m_vertexArrayID << endl;
 
-    glGenBuffers(1, &m_normalBufferID);
+    glGenBuffers(1, &m_vertexBufferID);
     if(DISPLAY_DEBUG_INFO)
-        cout << "  normalBufferID = " << m_normalBufferID << endl;
+        cout << "  vertexBufferID = " << m_vertexBufferID << endl;
 
     glGenBuffers(1, &m_elementBufferID);
     if(DISPLAY_DEBUG_INFO)
@@ -95,55 +192,93 @@ void Object::UpdateAttributeLocations()
     m_normalID = glGetAttribLocation(m_programID, "in_normal");
     if(DISPLAY_DEBUG_INFO)
         cout << "normalID = " << m_normalID << endl;
-}
 
+    // Only in the compact vertex shader (-1 otherwise)
+    m_positionOriginID = glGetUniformLocation(m_programID, "PositionOrigin");
+    m_positionStepID = glGetUniformLocation(m_programID, "PositionStep");
 
-void Object::Draw(const mat4& projection_matrix, const mat4& view_matrix, const GLuint PmatrixID, const GLuint VmatrixID) const
+    SetupVertexArray();
+}
+
+void Object::SetupVertexArray()
 {
-    // Shader program setting
-    glUseProgram(m_programID);
+    glBindVertexArray(m_vertexArrayID);
 
-    // Matrix transmission
-    glUniformMatrix4fv(PmatrixID, 1, GL_FALSE, value_ptr(projection_matrix));
-    glUniformMatrix4fv(VmatrixID, 1, GL_FALSE, value_ptr(view_matrix));
+    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBufferID);
+
+    if(m_compact)
+    {
+        // Integer values converted to floats, decoded by the shader
+        const GLsizei stride = sizeof(CompactVertex);
+
+        glEnableVertexAttribArray(m_positionID);
+        glVertexAttribPointer(m_positionID, 3, GL_UNSIGNED_SHORT, GL_FALSE, stride, (void*)0);
+
+        glEnableVertexAttribArray(m_normalID);
+        glVertexAttribPointer(m_normalID, 2, GL_SHORT, GL_FALSE, stride, (void*)(4 * sizeof(glm::uint16)));
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_elementBufferID);
 
+        glBindVertexArray(0);
+        return;
+    }
+
+    const GLsizei stride = 2 * sizeof(vec3);
 
-    // Pointer settings
     glEnableVertexAttribArray(m_positionID);
-    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBufferID);
     glVertexAttribPointer(
                 m_positionID,
                 3,
                 GL_FLOAT,
                 GL_FALSE,
-                0,
+                stride,
                 (void*)0
                 );
 
-
     glEnableVertexAttribArray(m_normalID);
-    glBindBuffer(GL_ARRAY_BUFFER, m_normalBufferID);
     glVertexAttribPointer(
                 m_normalID,
                 3,
                 GL_FLOAT,
                 GL_TRUE,
-                0,
-                (void*)0
+                stride,
+                (void*)sizeof(vec3)
                 );
 
-
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_elementBufferID);
 
+    glBindVertexArray(0);
+}
+
+
+void Object::Draw(const mat4& projection_matrix, const mat4& view_matrix, const GLuint PmatrixID, const GLuint VmatrixID) const
+{
+    TRACE_ZONE("draw");
+
+    // Shader program setting
+    glUseProgram(m_programID);
+
+    // Matrix transmission
+    glUniformMatrix4fv(PmatrixID, 1, GL_FALSE, value_ptr(projection_matrix));
+    glUniformMatrix4fv(VmatrixID, 1, GL_FALSE, value_ptr(view_matrix));
+    if(m_compact)
+    {
+        glUniform3fv(m_positionOriginID, 1, value_ptr(m_positionOrigin));
+        glUniform3fv(m_positionStepID, 1, value_ptr(m_positionStep));
+    }
+
+
+    // Attributes and buffers (see SetupVertexArray)
+    glBindVertexArray(m_vertexArrayID);
+
 
     // Draw triangles
     glDrawElements(
                 GL_TRIANGLES,               // mode
-                m_mesh->m_faces.size()*3,    // count
+                m_mesh->NbFaces()*3,    // count
                 GL_UNSIGNED_INT,            // type
                 (void*)0                    // offset
                 );
 
-    glDisableVertexAttribArray(m_positionID);
-    glDisableVertexAttribArray(m_normalID);
+    glBindVertexArray(0);
 }
@@ -3,6 +3,9 @@
 
 #include <GL/glew.h>
 #include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp> // uint8, uint16, uint32
+
+#include <vector>
 
 #include "Mesh.h"
 #include "MeshHE.h"
@@ -10,22 +13,42 @@
 #define DISPLAY_DEBUG_INFO  true
 
 
+/// Vertex of the compact buffer : position quantized on 16 bits per axis of the bounding box (w unused), octahedral normal (see QuantizedMesh)
+struct CompactVertex
+{
+    glm::uint16 position[4];
+    glm::uint32 normal;
+};
+
+
+/**
+ * @brief The Object class.
+ * Draws a MeshHE from one interleaved (position, normal) vertex buffer and
+ * an element buffer, bound once in a vertex array object.
+ * In compact mode, the vertex buffer holds CompactVertex (12 bytes instead of
+ * 24), decoded by shader/vertex_compact.glsl from the PositionOrigin and
+ * PositionStep uniforms.
+ */
 class Object
 {
 public:
-    Object();
+
+    static const glm::uint UPDATE_BLOCK_SIZE = 1024;    /// Granularity (in vertices) of the changed ranges uploaded by UpdateGeometryBuffers
+
+    Object(const bool compact = false);
     ~Object();
 
     void Draw(const glm::mat4& projection_matrix, const glm::mat4& view_matrix, const GLuint PmatrixID, const GLuint VmatrixID) const;
 
     void GenBuffers();
-    void UpdateGeometryBuffers();
+    void UpdateGeometryBuffers();               /// Uploads the ranges of positions and normals which changed since the last upload
     void UpdateElementsBuffer();
     void UpdateBuffers();
 
     void SetMesh(MeshHE *mesh);
     void SetShader(const GLuint programID);
     void UpdateAttributeLocations();
+    void SetupVertexArray();                    /// Records the attribute layout and the buffers in the vertex array object
 
 public:
 
@@ -36,11 +59,21 @@ public:
     GLuint m_programID;
     GLuint m_positionID;
     GLuint m_normalID;
+    GLint m_positionOriginID;
+    GLint m_positionStepID;
 
-    GLuint m_vertexBufferID;
-    GLuint m_normalBufferID;
+    GLuint m_vertexArrayID;
+    GLuint m_vertexBufferID;                    /// Interleaved positions and normals
     GLuint m_elementBufferID;
 
+    bool m_compact;                             /// The vertex buffer holds CompactVertex instead of (position, normal) floats
+    glm::vec3 m_positionOrigin;                 /// Quantization grid of the compact positions
+    glm::vec3 m_positionStep;
+
+    glm::uint m_nbBufferVertices;               /// Number of vertices the vertex buffer is allocated for
+    std::vector<glm::uint8> m_vertexData;       /// Copy of the content of the vertex buffer
+    std::vector<glm::uint8> m_stagingData;      /// Next content of the vertex buffer
+
     static unsigned int s_id;
 };
 
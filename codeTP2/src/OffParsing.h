@@ -0,0 +1,81 @@
+#ifndef OFF_PARSING_H
+#define OFF_PARSING_H
+
+#include <glm/glm.hpp>
+
+#include <charconv>
+
+
+/**
+ * Tokenizing helpers of the OFF loaders (Mesh::LoadOFF and
+ * OutOfCoreSmoother::ConvertOFF), shared so that both accept the same files.
+ * They work on [c, end) ranges of characters; a token ends with a blank, a
+ * newline, a comment ('#') or the end of the range.
+ */
+
+inline bool IsBlank(const char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+
+/// Tells wether c (end if c == end) may follow a token
+inline bool IsTokenEnd(const char* c, const char* end)
+{
+    return c == end || IsBlank(*c) || *c == '\n' || *c == '#';
+}
+
+/// Skips blanks, newlines and comments, counting the newlines
+inline const char* SkipSpacesAndComments(const char* c, const char* end, glm::uint& nb_lines)
+{
+    while(c < end)
+    {
+        if(*c == '#')
+        {
+            while(c < end && *c != '\n')
+                c++;
+        }
+        else if(*c == '\n')
+        {
+            nb_lines++;
+            c++;
+        }
+        else if(IsBlank(*c))
+            c++;
+        else
+            break;
+    }
+    return c;
+}
+
+/// Parses one number of the current line, which must be followed by a blank, a comment or the end of the line
+template <typename T>
+inline bool ParseNumber(const char*& c, const char* end, T& value)
+{
+    while(c < end && IsBlank(*c))
+        c++;
+    if(c < end && *c == '+')
+        c++;
+
+    std::from_chars_result result = std::from_chars(c, end, value);
+    if(result.ec != std::errc() || !IsTokenEnd(result.ptr, end))
+        return false;
+
+    c = result.ptr;
+    return true;
+}
+
+/// Tells wether the line starting at c holds data (not empty nor a comment)
+inline bool IsDataLine(const char* c, const char* end)
+{
+    while(c < end && IsBlank(*c))
+        c++;
+    return c < end && *c != '\n' && *c != '#';
+}
+
+/// Tells wether the "OFF" keyword starts at c (blanks must have been skipped)
+inline bool IsOFFKeyword(const char* c, const char* end)
+{
+    return end - c >= 3 && c[0] == 'O' && c[1] == 'F' && c[2] == 'F' && IsTokenEnd(c + 3, end);
+}
+
+#endif // OFF_PARSING_H
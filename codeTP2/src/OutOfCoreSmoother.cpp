@@ -0,0 +1,965 @@
+#include <OutOfCoreSmoother.h>
+#include <LaplacianOperator.h>
+#include <SimdKernels.h>
+#include <OffParsing.h>
+#include <Trace.h>
+
+#include <iostream>
+#include <algorithm>
+#include <cfloat>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace glm;
+using namespace std;
+
+const size_t OutOfCoreSmoother::MIN_MEMORY_BUDGET;
+const size_t OutOfCoreSmoother::BYTES_PER_CHUNK_VERTEX;
+const size_t OutOfCoreSmoother::BUCKET_BUFFER_SIZE;
+const glm::uint OutOfCoreSmoother::MORTON_BITS;
+
+static const size_t READ_BUFFER_SIZE = 1 << 20;     /// Text read buffer (bytes), the longest accepted line
+static const glm::uint IO_BLOCK_SIZE = 1 << 16;     /// Number of vertices / faces read or written at once
+
+
+//***************
+// Work files
+
+/// Shared memory mapping of a whole work file: the written pages go back to
+/// the file, and the system can evict them under memory pressure
+class FileMapping
+{
+public:
+
+    FileMapping() : m_data(NULL), m_size(0) {}
+    ~FileMapping()
+    {
+        if(m_data != NULL)
+            munmap(m_data, m_size);
+    }
+
+    bool Open(const string& filename, const size_t size, const bool writable)
+    {
+        int fd = open(filename.c_str(), writable ? O_RDWR : O_RDONLY);
+        if(fd < 0)
+            return false;
+
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0 && size_t(st.st_size) >= size;
+        if(ok && size > 0)
+        {
+            void* data = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+            ok = data != MAP_FAILED;
+            if(ok)
+            {
+                m_data = data;
+                m_size = size;
+            }
+        }
+        close(fd);
+        return ok;
+    }
+
+    template <typename T> T* Data() const { return static_cast<T*>(m_data); }
+
+private:
+
+    FileMapping(const FileMapping&);
+    FileMapping& operator=(const FileMapping&);
+
+    void* m_data;
+    size_t m_size;
+};
+
+static bool CopyFile(const string& src_filename, const string& dst_filename)
+{
+    FILE* src = fopen(src_filename.c_str(), "rb");
+    FILE* dst = fopen(dst_filename.c_str(), "wb");
+    bool ok = src != NULL && dst != NULL;
+
+    vector<char> buffer(READ_BUFFER_SIZE);
+    size_t nb_read;
+    while(ok && (nb_read = fread(&buffer[0], 1, buffer.size(), src)) > 0)
+        ok = fwrite(&buffer[0], 1, nb_read, dst) == nb_read;
+    ok = ok && !ferror(src);
+
+    if(src != NULL)
+        fclose(src);
+    if(dst != NULL && fclose(dst) != 0)
+        ok = false;
+    return ok;
+}
+
+static bool AppendToFile(const string& filename, const vector<glm::uint>& data)
+{
+    if(data.empty())
+        return true;
+
+    FILE* file = fopen(filename.c_str(), "ab");
+    if(file == NULL)
+        return false;
+    bool ok = fwrite(&data[0], sizeof(glm::uint), data.size(), file) == data.size();
+    return fclose(file) == 0 && ok;
+}
+
+
+//***************
+// OFF streaming
+
+/// Reads a text file line by line through a buffer of READ_BUFFER_SIZE bytes
+class LineReader
+{
+public:
+
+    LineReader() : m_file(NULL), m_buffer(READ_BUFFER_SIZE), m_begin(0), m_end(0), m_line(0), m_too_long(false) {}
+    ~LineReader()
+    {
+        if(m_file != NULL)
+            fclose(m_file);
+    }
+
+    bool Open(const char* filename)
+    {
+        m_file = fopen(filename, "rb");
+        return m_file != NULL;
+    }
+
+    /// Next line holding data, without its comment; false at the end of the file or on error
+    bool NextDataLine(const char*& begin, const char*& end)
+    {
+        while(NextLine(begin, end))
+        {
+            const char* comment = (const char*)memchr(begin, '#', end - begin);
+            if(comment != NULL)
+                end = comment;
+
+            const char* c = begin;
+            while(c < end && IsBlank(*c))
+                c++;
+            if(c < end)
+                return true;
+        }
+        return false;
+    }
+
+    glm::uint Line() const    { return m_line; }
+    bool Failed() const       { return m_too_long || (m_file != NULL && ferror(m_file)); }
+
+private:
+
+    bool NextLine(const char*& begin, const char*& end)
+    {
+        char* eol = (char*)memchr(&m_buffer[0] + m_begin, '\n', m_end - m_begin);
+        if(eol == NULL)
+        {
+            // Moves the partial line to the front and refills the buffer
+            memmove(&m_buffer[0], &m_buffer[0] + m_begin, m_end - m_begin);
+            m_end -= m_begin;
+            m_begin = 0;
+            m_end += fread(&m_buffer[0] + m_end, 1, m_buffer.size() - m_end, m_file);
+
+            eol = (char*)memchr(&m_buffer[0], '\n', m_end);
+            if(eol == NULL)
+            {
+                m_too_long = (m_end == m_buffer.size());
+                if(m_end == 0 || m_too_long)
+                    return false;
+                eol = &m_buffer[0] + m_end;     // Last line, without newline
+            }
+        }
+
+        begin = &m_buffer[0] + m_begin;
+        end = eol;
+        m_begin = std::min(size_t(eol - &m_buffer[0]) + 1, m_end);
+        m_line++;
+        return true;
+    }
+
+    FILE* m_file;
+    vector<char> m_buffer;
+    size_t m_begin;             /// Start of the unread data in m_buffer
+    size_t m_end;               /// End of the data in m_buffer
+    glm::uint m_line;           /// Number of the last line returned (1 based)
+    bool m_too_long;
+};
+
+
+//***************
+// Chunks
+
+/// Laplacian rows of one chunk, as stored in the topology file: a header,
+/// then the global index of the local vertices (rows first, then halo),
+/// then the CSR arrays of the rows, with local columns
+struct ChunkTopology
+{
+    struct Header
+    {
+        glm::uint nb_rows;
+        glm::uint nb_locals;
+        glm::uint nb_entries;
+        glm::uint padding;
+    };
+
+    bool Read(FILE* file)
+    {
+        if(fread(&header, sizeof(Header), 1, file) != 1)
+            return false;
+
+        globals.resize(header.nb_locals);
+        offsets.resize(header.nb_rows + 1);
+        columns.resize(header.nb_entries);
+        values.resize(header.nb_entries);
+        diagonal.resize(header.nb_rows);
+
+        return ReadArray(file, globals) && ReadArray(file, offsets) && ReadArray(file, columns)
+            && ReadArray(file, values) && ReadArray(file, diagonal);
+    }
+
+    bool Write(FILE* file) const
+    {
+        return fwrite(&header, sizeof(Header), 1, file) == 1
+            && WriteArray(file, globals) && WriteArray(file, offsets) && WriteArray(file, columns)
+            && WriteArray(file, values) && WriteArray(file, diagonal);
+    }
+
+    template <typename T>
+    static bool ReadArray(FILE* file, vector<T>& array)
+    {
+        return array.empty() || fread(&array[0], sizeof(T), array.size(), file) == array.size();
+    }
+
+    template <typename T>
+    static bool WriteArray(FILE* file, const vector<T>& array)
+    {
+        return array.empty() || fwrite(&array[0], sizeof(T), array.size(), file) == array.size();
+    }
+
+    Header header;
+    vector<glm::uint> globals;
+    vector<glm::uint> offsets;
+    vector<glm::uint> columns;
+    vector<float> values;
+    vector<float> diagonal;
+};
+
+/// Cell of p in a grid of 2^MORTON_BITS cubic cells along the largest side of the bounding box, as a Morton code
+static glm::uint MortonCell(const vec3& p, const vec3& bb_min, const vec3& bb_max)
+{
+    const glm::uint nb_cells = 1u << OutOfCoreSmoother::MORTON_BITS;
+    vec3 size = bb_max - bb_min;
+    float extent = glm::max(size.x, glm::max(size.y, size.z));
+
+    glm::uint q[3];
+    for(int k = 0; k < 3; k++)
+    {
+        float t = extent > 0.0f ? (p[k] - bb_min[k]) / extent : 0.0f;
+        q[k] = glm::uint(glm::clamp(t * float(nb_cells), 0.0f, float(nb_cells - 1)));
+    }
+
+    glm::uint code = 0;
+    for(glm::uint b = 0; b < OutOfCoreSmoother::MORTON_BITS; b++)
+        for(int k = 0; k < 3; k++)
+            code |= ((q[k] >> b) & 1u) << (3*b + k);
+    return code;
+}
+
+
+//***************
+// Constructors
+
+OutOfCoreSmoother::OutOfCoreSmoother(const size_t memory_budget, const string &work_directory) :
+    m_memory_budget(std::max(memory_budget, MIN_MEMORY_BUDGET)),
+    m_nb_vertices(0),
+    m_nb_faces(0),
+    m_bb_min(0.0f),
+    m_bb_max(0.0f),
+    m_max_chunk_vertices(0),
+    m_chunk_offsets(1, 0),
+    m_current(0)
+{
+    string pattern = work_directory + "/smoothing-XXXXXX";
+    vector<char> path(pattern.begin(), pattern.end());
+    path.push_back('\0');
+
+    if(memory_budget < MIN_MEMORY_BUDGET)
+    {
+        std::cerr << "Warning : memory budget raised to the minimum of " << (MIN_MEMORY_BUDGET >> 20) << " MB" << std::endl;
+    }
+
+    if(mkdtemp(&path[0]) != NULL)
+        m_work_directory = &path[0];
+    else
+        std::cerr << "Unable to create a work directory in : " << work_directory << std::endl;
+}
+
+OutOfCoreSmoother::~OutOfCoreSmoother()
+{
+    if(m_work_directory.empty())
+        return;
+
+    DIR* dir = opendir(m_work_directory.c_str());
+    if(dir != NULL)
+    {
+        struct dirent* entry;
+        while((entry = readdir(dir)) != NULL)
+        {
+            if(strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+                remove(WorkFile(entry->d_name).c_str());
+        }
+        closedir(dir);
+    }
+    rmdir(m_work_directory.c_str());
+}
+
+string OutOfCoreSmoother::WorkFile(const string &name) const
+{
+    return m_work_directory + "/" + name;
+}
+
+string OutOfCoreSmoother::PositionsFile(const glm::uint index) const
+{
+    return WorkFile(index == 0 ? "positions0.bin" : "positions1.bin");
+}
+
+
+//***************
+// Preprocessing
+
+/**
+ * @brief OutOfCoreSmoother::Open
+ * Prepares the work files: positions (twice, the second file receives the
+ * result of the first step), faces, vertex to chunk map and chunk topology.
+ */
+bool OutOfCoreSmoother::Open(const char *off_filename)
+{
+    if(m_work_directory.empty())
+        return false;
+
+    m_current = 0;
+
+    if(!ConvertOFF(off_filename) || !Partition() || !BuildChunks())
+        return false;
+
+    if(!CopyFile(PositionsFile(0), PositionsFile(1)))
+    {
+        std::cerr << "Unable to write : " << PositionsFile(1) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief OutOfCoreSmoother::ConvertOFF
+ * Same format as Mesh::LoadOFF, but read sequentially through a fixed size
+ * buffer and written as it goes: positions as 3 floats, faces as 3 indices.
+ */
+bool OutOfCoreSmoother::ConvertOFF(const char *off_filename)
+{
+    TRACE_ZONE("out of core conversion");
+
+    LineReader reader;
+    if(!reader.Open(off_filename))
+    {
+        std::cerr << "Unable to read : " << off_filename << std::endl;
+        return false;
+    }
+
+    const char* c;
+    const char* end;
+
+    // Header : "OFF" then the numbers of vertices, faces and edges
+    if(!reader.NextDataLine(c, end))
+    {
+        std::cerr << off_filename << ": missing OFF header" << std::endl;
+        return false;
+    }
+    while(c < end && IsBlank(*c))
+        c++;
+    if(!IsOFFKeyword(c, end))
+    {
+        std::cerr << off_filename << ":" << reader.Line() << ": missing OFF header" << std::endl;
+        return false;
+    }
+    c += 3;
+
+    glm::uint counts[3];
+    for(int i = 0; i < 3; i++)
+    {
+        while(c < end && IsBlank(*c))
+            c++;
+        if(c == end && !reader.NextDataLine(c, end))
+        {
+            std::cerr << off_filename << ": invalid element counts" << std::endl;
+            return false;
+        }
+        if(!ParseNumber(c, end, counts[i]))
+        {
+            std::cerr << off_filename << ":" << reader.Line() << ": invalid element counts" << std::endl;
+            return false;
+        }
+    }
+    m_nb_vertices = counts[0];
+    m_nb_faces = counts[1];
+
+    // Elements
+    FILE* positions = fopen(PositionsFile(0).c_str(), "wb");
+    FILE* faces = fopen(WorkFile("faces.bin").c_str(), "wb");
+    if(positions == NULL || faces == NULL)
+    {
+        std::cerr << "Unable to write in : " << m_work_directory << std::endl;
+        if(positions != NULL)
+            fclose(positions);
+        if(faces != NULL)
+            fclose(faces);
+        return false;
+    }
+
+    vector<float> position_block;
+    vector<glm::uint> face_block;
+    position_block.reserve(3*IO_BLOCK_SIZE);
+    face_block.reserve(3*IO_BLOCK_SIZE);
+    m_bb_min = vec3(FLT_MAX);
+    m_bb_max = vec3(-FLT_MAX);
+
+    string error;
+    bool written = true;
+
+    for(glm::uint64 element = 0; element < glm::uint64(m_nb_vertices) + m_nb_faces && error.empty() && written; element++)
+    {
+        if(!reader.NextDataLine(c, end))
+        {
+            error = reader.Failed() ? "read error or line too long" : "unexpected end of file";
+            break;
+        }
+
+        if(element < m_nb_vertices)
+        {
+            vec3 p;
+            if(!ParseNumber(c, end, p.x) || !ParseNumber(c, end, p.y) || !ParseNumber(c, end, p.z))
+            {
+                error = "invalid vertex";
+                break;
+            }
+            m_bb_min = glm::min(m_bb_min, p);
+            m_bb_max = glm::max(m_bb_max, p);
+            position_block.push_back(p.x);
+            position_block.push_back(p.y);
+            position_block.push_back(p.z);
+        }
+        else
+        {
+            glm::uint degree, f[3];
+            if(!ParseNumber(c, end, degree) || (degree == 3 && (!ParseNumber(c, end, f[0]) || !ParseNumber(c, end, f[1]) || !ParseNumber(c, end, f[2]))))
+            {
+                error = "invalid face";
+                break;
+            }
+            if(degree != 3)
+            {
+                error = "face " + std::to_string(element - m_nb_vertices) + " is not a triangle (" + std::to_string(degree) + " polygonal face)";
+                break;
+            }
+            if(f[0] >= m_nb_vertices || f[1] >= m_nb_vertices || f[2] >= m_nb_vertices)
+            {
+                error = "vertex index out of range in face " + std::to_string(element - m_nb_vertices);
+                break;
+            }
+            face_block.insert(face_block.end(), f, f + 3);
+        }
+
+        if(position_block.size() == 3*IO_BLOCK_SIZE)
+        {
+            written = fwrite(&position_block[0], sizeof(float), position_block.size(), positions) == position_block.size();
+            position_block.clear();
+        }
+        if(face_block.size() == 3*IO_BLOCK_SIZE)
+        {
+            written = fwrite(&face_block[0], sizeof(glm::uint), face_block.size(), faces) == face_block.size();
+            face_block.clear();
+        }
+    }
+
+    if(!position_block.empty())
+        written = written && fwrite(&position_block[0], sizeof(float), position_block.size(), positions) == position_block.size();
+    if(!face_block.empty())
+        written = written && fwrite(&face_block[0], sizeof(glm::uint), face_block.size(), faces) == face_block.size();
+    written = (fclose(positions) == 0) && written;
+    written = (fclose(faces) == 0) && written;
+
+    if(!error.empty())
+    {
+        std::cerr << off_filename << ":" << reader.Line() << ": " << error << std::endl;
+        return false;
+    }
+    if(!written)
+    {
+        std::cerr << "Unable to write in : " << m_work_directory << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief OutOfCoreSmoother::Partition
+ * Two streaming passes over the positions: the first one counts the vertices
+ * of each grid cell, the second one gives each vertex its rank in the Morton
+ * order of the cells (ties in index order), and so its chunk. All the chunks
+ * have m_max_chunk_vertices vertices, except the last one.
+ */
+bool OutOfCoreSmoother::Partition()
+{
+    TRACE_ZONE("out of core partition");
+
+    m_max_chunk_vertices = glm::uint(std::min(size_t(0xFFFFFFFFu), std::max(size_t(1), m_memory_budget / 2 / BYTES_PER_CHUNK_VERTEX)));
+    glm::uint nb_chunks = std::max(glm::uint(1), glm::uint((glm::uint64(m_nb_vertices) + m_max_chunk_vertices - 1) / m_max_chunk_vertices));
+
+    vector<glm::uint> cell_start((1u << (3*MORTON_BITS)) + 1, 0);
+    vector<float> block(3*IO_BLOCK_SIZE);
+    vector<glm::uint> chunk_block(IO_BLOCK_SIZE);
+
+    FILE* positions = fopen(PositionsFile(0).c_str(), "rb");
+    FILE* chunk_map = fopen(WorkFile("chunks.bin").c_str(), "wb");
+    bool ok = positions != NULL && chunk_map != NULL;
+
+    for(int pass = 0; pass < 2 && ok; pass++)
+    {
+        rewind(positions);
+        for(glm::uint first = 0; first < m_nb_vertices && ok; first += IO_BLOCK_SIZE)
+        {
+            glm::uint nb = std::min(IO_BLOCK_SIZE, m_nb_vertices - first);
+            ok = fread(&block[0], 3*sizeof(float), nb, positions) == nb;
+
+            for(glm::uint i = 0; i < nb && ok; i++)
+            {
+                glm::uint cell = MortonCell(vec3(block[3*i], block[3*i+1], block[3*i+2]), m_bb_min, m_bb_max);
+                if(pass == 0)
+                    cell_start[cell + 1]++;
+                else
+                    chunk_block[i] = cell_start[cell]++ / m_max_chunk_vertices;
+            }
+
+            if(pass == 1 && ok)
+                ok = fwrite(&chunk_block[0], sizeof(glm::uint), nb, chunk_map) == nb;
+        }
+
+        if(pass == 0)
+        {
+            for(size_t cell = 1; cell < cell_start.size(); cell++)
+                cell_start[cell] += cell_start[cell - 1];
+        }
+    }
+
+    if(positions != NULL)
+        fclose(positions);
+    if(chunk_map != NULL && fclose(chunk_map) != 0)
+        ok = false;
+
+    if(!ok)
+    {
+        std::cerr << "Unable to partition the mesh in : " << m_work_directory << std::endl;
+        return false;
+    }
+
+    m_chunk_offsets.assign(nb_chunks + 1, 0);
+    return true;
+}
+
+/**
+ * @brief OutOfCoreSmoother::BuildChunks
+ * The chunks are processed by groups whose bucket buffers fit in a quarter of
+ * the budget: for each group, one pass over the faces appends each face to
+ * the bucket file of every chunk of the group owning one of its vertices,
+ * then the topology of each chunk is built from its bucket.
+ */
+bool OutOfCoreSmoother::BuildChunks()
+{
+    TRACE_ZONE("out of core chunks");
+
+    FileMapping chunk_map;
+    FILE* topology = fopen(WorkFile("topology.bin").c_str(), "wb");
+    if(!chunk_map.Open(WorkFile("chunks.bin"), size_t(m_nb_vertices) * sizeof(glm::uint), false) || topology == NULL)
+    {
+        std::cerr << "Unable to open the work files in : " << m_work_directory << std::endl;
+        if(topology != NULL)
+            fclose(topology);
+        return false;
+    }
+    const glm::uint* chunk_of = chunk_map.Data<glm::uint>();
+
+    glm::uint nb_chunks = NbChunks();
+    glm::uint group_size = glm::uint(std::max(size_t(1), m_memory_budget / 4 / BUCKET_BUFFER_SIZE));
+    const size_t bucket_capacity = BUCKET_BUFFER_SIZE / sizeof(glm::uint);
+    vector<glm::uint> face_block(3*IO_BLOCK_SIZE);
+    bool ok = true;
+
+    for(glm::uint first = 0; first < nb_chunks && ok; first += group_size)
+    {
+        glm::uint last = std::min(nb_chunks, first + group_size);
+        vector< vector<glm::uint> > buckets(last - first);
+        vector<string> bucket_files(last - first);
+        for(glm::uint c = first; c < last; c++)
+            bucket_files[c - first] = WorkFile("bucket" + std::to_string(c) + ".bin");
+
+        FILE* faces = fopen(WorkFile("faces.bin").c_str(), "rb");
+        ok = faces != NULL;
+
+        for(glm::uint f0 = 0; f0 < m_nb_faces && ok; f0 += IO_BLOCK_SIZE)
+        {
+            glm::uint nb = std::min(IO_BLOCK_SIZE, m_nb_faces - f0);
+            ok = fread(&face_block[0], 3*sizeof(glm::uint), nb, faces) == nb;
+
+            for(glm::uint i = 0; i < nb && ok; i++)
+            {
+                const glm::uint* f = &face_block[3*i];
+                for(int j = 0; j < 3; j++)
+                {
+                    glm::uint c = chunk_of[f[j]];
+                    if(c < first || c >= last || (j > 0 && c == chunk_of[f[0]]) || (j > 1 && c == chunk_of[f[1]]))
+                        continue;
+
+                    vector<glm::uint>& bucket = buckets[c - first];
+                    bucket.insert(bucket.end(), f, f + 3);
+                    if(bucket.size() + 3 > bucket_capacity)
+                    {
+                        ok = AppendToFile(bucket_files[c - first], bucket);
+                        bucket.clear();
+                    }
+                }
+            }
+        }
+        if(faces != NULL)
+            fclose(faces);
+
+        for(glm::uint c = first; c < last && ok; c++)
+        {
+            ok = AppendToFile(bucket_files[c - first], buckets[c - first]);
+            vector<glm::uint>().swap(buckets[c - first]);
+        }
+
+        // Topology of each chunk, from its whole bucket
+        for(glm::uint c = first; c < last && ok; c++)
+        {
+            vector<glm::uint> chunk_faces;
+            FILE* bucket = fopen(bucket_files[c - first].c_str(), "rb");
+            if(bucket != NULL)
+            {
+                fseek(bucket, 0, SEEK_END);
+                chunk_faces.resize(ftell(bucket) / sizeof(glm::uint));
+                rewind(bucket);
+                ok = ChunkTopology::ReadArray(bucket, chunk_faces);
+                fclose(bucket);
+                remove(bucket_files[c - first].c_str());
+            }
+
+            m_chunk_offsets[c] = ftell(topology);
+            ok = ok && BuildChunkTopology(c, chunk_faces, chunk_of, topology);
+        }
+    }
+
+    m_chunk_offsets[nb_chunks] = ftell(topology);
+    ok = (fclose(topology) == 0) && ok;
+
+    if(!ok)
+    {
+        std::cerr << "Unable to build the chunks in : " << m_work_directory << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief OutOfCoreSmoother::BuildChunkTopology
+ * faces holds all the faces around the vertices of the chunk. Each directed
+ * edge gives an outgoing end to its origin and an incoming end to its
+ * destination; once sorted, the ends of a vertex tell its neighbors and its
+ * border status: as in MeshHE, a vertex is at border when one of its edges
+ * is not made of exactly two opposite half edges. The rows are the interior
+ * vertices of the chunk, with uniform weights.
+ */
+bool OutOfCoreSmoother::BuildChunkTopology(const glm::uint chunk, const vector<glm::uint> &faces, const glm::uint *chunk_of, FILE *topology)
+{
+    // Edge ends : (vertex of the chunk, other vertex) key, and direction
+    struct EdgeEnd
+    {
+        glm::uint64 key;
+        glm::uint outgoing;
+
+        bool operator<(const EdgeEnd& e) const { return key < e.key; }
+    };
+
+    vector<EdgeEnd> ends;
+    ends.reserve(2 * faces.size());
+    for(size_t i = 0; i < faces.size(); i += 3)
+    {
+        for(int j = 0; j < 3; j++)
+        {
+            glm::uint u = faces[i + j];
+            glm::uint w = faces[i + (j+1) % 3];
+            if(chunk_of[u] == chunk)
+            {
+                EdgeEnd e = { (glm::uint64(u) << 32) | w, 1 };
+                ends.push_back(e);
+            }
+            if(chunk_of[w] == chunk)
+            {
+                EdgeEnd e = { (glm::uint64(w) << 32) | u, 0 };
+                ends.push_back(e);
+            }
+        }
+    }
+    std::sort(ends.begin(), ends.end());
+
+    ChunkTopology t;
+    vector<glm::uint> neighbors;            // Global indices, row after row
+    t.offsets.push_back(0);
+
+    for(size_t i = 0; i < ends.size(); )
+    {
+        glm::uint v = glm::uint(ends[i].key >> 32);
+        size_t nb_neighbors = neighbors.size();
+        bool interior = true;
+
+        while(i < ends.size() && glm::uint(ends[i].key >> 32) == v)
+        {
+            glm::uint w = glm::uint(ends[i].key);
+            glm::uint nb_out = 0, nb_in = 0;
+            for(; i < ends.size() && ends[i].key == ((glm::uint64(v) << 32) | w); i++)
+                (ends[i].outgoing ? nb_out : nb_in)++;
+
+            interior = interior && w != v && nb_out == 1 && nb_in == 1;
+            neighbors.push_back(w);
+        }
+
+        if(interior)
+        {
+            t.globals.push_back(v);
+            t.offsets.push_back(neighbors.size());
+        }
+        else
+        {
+            neighbors.resize(nb_neighbors);
+        }
+    }
+    vector<EdgeEnd>().swap(ends);
+
+    // Local numbering : rows, then the halo, both in global order. The
+    // neighbors are sorted by global index and merged with the rows
+    glm::uint nb_rows = t.globals.size();
+    vector<glm::uint64> sorted_neighbors(neighbors.size());
+    for(size_t k = 0; k < neighbors.size(); k++)
+        sorted_neighbors[k] = (glm::uint64(neighbors[k]) << 32) | k;
+    std::sort(sorted_neighbors.begin(), sorted_neighbors.end());
+
+    t.columns.resize(neighbors.size());
+    glm::uint row = 0;
+    for(size_t i = 0; i < sorted_neighbors.size(); )
+    {
+        glm::uint global = glm::uint(sorted_neighbors[i] >> 32);
+        while(row < nb_rows && t.globals[row] < global)
+            row++;
+
+        glm::uint local = row;
+        if(row == nb_rows || t.globals[row] != global)
+        {
+            local = t.globals.size();
+            t.globals.push_back(global);
+        }
+
+        for(; i < sorted_neighbors.size() && glm::uint(sorted_neighbors[i] >> 32) == global; i++)
+            t.columns[glm::uint(sorted_neighbors[i])] = local;
+    }
+
+    t.values.resize(neighbors.size());
+    t.diagonal.assign(nb_rows, 1.0f);
+    for(glm::uint r = 0; r < nb_rows; r++)
+    {
+        glm::uint nb_entries = t.offsets[r+1] - t.offsets[r];
+        for(glm::uint k = t.offsets[r]; k < t.offsets[r+1]; k++)
+            t.values[k] = 1.0f / nb_entries;
+    }
+
+    t.header.nb_rows = nb_rows;
+    t.header.nb_locals = t.globals.size();
+    t.header.nb_entries = neighbors.size();
+    t.header.padding = 0;
+    return t.Write(topology);
+}
+
+
+//***************
+// Smoothing
+
+/**
+ * @brief OutOfCoreSmoother::Step
+ * Streams the chunks in order: gathers the chunk and its halo from the
+ * current positions, computes the rows block by block as
+ * LaplacianOperator::Step does, and scatters them into the other positions
+ * file. The other vertices (borders) are the same in both files.
+ */
+bool OutOfCoreSmoother::Step(const float lambda)
+{
+    TRACE_ZONE("out of core step");
+
+    const SmoothingKernels& kernels = GetSmoothingKernels();
+    const glm::uint BLOCK_SIZE = LaplacianOperator::BLOCK_SIZE;
+    size_t size = 3 * sizeof(float) * size_t(m_nb_vertices);
+
+    FileMapping src_file, dst_file;
+    FILE* topology = fopen(WorkFile("topology.bin").c_str(), "rb");
+    if(!src_file.Open(PositionsFile(m_current), size, false) || !dst_file.Open(PositionsFile(1 - m_current), size, true) || topology == NULL)
+    {
+        std::cerr << "Unable to open the work files in : " << m_work_directory << std::endl;
+        if(topology != NULL)
+            fclose(topology);
+        return false;
+    }
+    const float* src = src_file.Data<float>();
+    float* dst = dst_file.Data<float>();
+
+    ChunkTopology t;
+    SoAPositions local, result;
+    bool ok = true;
+
+    for(glm::uint c = 0; c < NbChunks() && ok; c++)
+    {
+        ok = t.Read(topology);
+        glm::uint nb_rows = t.header.nb_rows;
+        int nb_locals = t.header.nb_locals;
+        if(!ok || nb_rows == 0)
+            continue;
+
+        local.Resize(nb_locals);
+        result.Resize(nb_rows);
+
+        #pragma omp parallel for schedule(static)
+        for(int i = 0; i < nb_locals; i++)
+        {
+            const float* p = src + 3 * size_t(t.globals[i]);
+            local.X()[i] = p[0];
+            local.Y()[i] = p[1];
+            local.Z()[i] = p[2];
+        }
+
+        int nb_blocks = (nb_rows + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+        #pragma omp parallel
+        {
+            SoAPositions lap;
+            lap.Resize(BLOCK_SIZE);
+
+            #pragma omp for schedule(static)
+            for(int b = 0; b < nb_blocks; b++)
+            {
+                glm::uint begin = b * BLOCK_SIZE;
+                glm::uint nb = glm::min(BLOCK_SIZE, nb_rows - begin);
+
+                kernels.spmv(local.X(), local.Y(), local.Z(), local.X() + begin, local.Y() + begin, local.Z() + begin,
+                             &t.offsets[begin], t.columns.data(), t.values.data(), &t.diagonal[begin],
+                             nb, lap.X(), lap.Y(), lap.Z());
+                kernels.update(local.X() + begin, local.Y() + begin, local.Z() + begin, lap.X(), lap.Y(), lap.Z(),
+                               lambda, nb, result.X() + begin, result.Y() + begin, result.Z() + begin);
+            }
+        }
+
+        #pragma omp parallel for schedule(static)
+        for(int r = 0; r < int(nb_rows); r++)
+        {
+            float* p = dst + 3 * size_t(t.globals[r]);
+            p[0] = result.X()[r];
+            p[1] = result.Y()[r];
+            p[2] = result.Z()[r];
+        }
+    }
+
+    fclose(topology);
+    if(!ok)
+    {
+        std::cerr << "Unable to read : " << WorkFile("topology.bin") << std::endl;
+        return false;
+    }
+
+    m_current = 1 - m_current;
+    return true;
+}
+
+bool OutOfCoreSmoother::LaplacianSmooth(const float lambda, const glm::uint nb_iter)
+{
+    for(glm::uint i = 0; i < nb_iter; i++)
+    {
+        TRACE_ZONE("laplacian iteration");
+        if(!Step(lambda))
+            return false;
+    }
+    return true;
+}
+
+bool OutOfCoreSmoother::TaubinSmooth(const float lambda, const float mu, const glm::uint nb_iter)
+{
+    for(glm::uint i = 0; i < nb_iter; i++)
+    {
+        TRACE_ZONE("taubin iteration");
+        if(!Step(lambda) || !Step(mu))
+            return false;
+    }
+    return true;
+}
+
+
+//***************
+// Output
+
+/**
+ * @brief OutOfCoreSmoother::WriteOFF
+ * Same output as MeshHE::write_off, streamed from the work files.
+ * @return false if the file could not be written
+ */
+bool OutOfCoreSmoother::WriteOFF(const char *filename) const
+{
+    TRACE_ZONE("out of core output");
+
+    FILE *file;
+
+    if((file=fopen(filename,"w"))==NULL)
+    {
+        std::cout << "Unable to open : " << filename << std::endl;
+        return false;
+    }
+
+    FILE* positions = fopen(PositionsFile(m_current).c_str(), "rb");
+    FILE* faces = fopen(WorkFile("faces.bin").c_str(), "rb");
+    bool ok = positions != NULL && faces != NULL;
+
+    fprintf(file,"OFF\n%u %u 0\n", m_nb_vertices, m_nb_faces);
+
+    vector<float> position_block(3*IO_BLOCK_SIZE);
+    for(glm::uint first = 0; first < m_nb_vertices && ok; first += IO_BLOCK_SIZE)
+    {
+        glm::uint nb = std::min(IO_BLOCK_SIZE, m_nb_vertices - first);
+        ok = fread(&position_block[0], 3*sizeof(float), nb, positions) == nb;
+        for(glm::uint i = 0; i < nb && ok; i++)
+            fprintf(file,"%.9g %.9g %.9g\n", position_block[3*i], position_block[3*i+1], position_block[3*i+2]);
+    }
+
+    vector<glm::uint> face_block(3*IO_BLOCK_SIZE);
+    for(glm::uint first = 0; first < m_nb_faces && ok; first += IO_BLOCK_SIZE)
+    {
+        glm::uint nb = std::min(IO_BLOCK_SIZE, m_nb_faces - first);
+        ok = fread(&face_block[0], 3*sizeof(glm::uint), nb, faces) == nb;
+        for(glm::uint i = 0; i < nb && ok; i++)
+            fprintf(file,"3 %u %u %u\n", face_block[3*i], face_block[3*i+1], face_block[3*i+2]);
+    }
+
+    if(positions != NULL)
+        fclose(positions);
+    if(faces != NULL)
+        fclose(faces);
+
+    if(!ok)
+        std::cerr << "Unable to read the work files in : " << m_work_directory << std::endl;
+    return (fclose(file) == 0) && ok;
+}
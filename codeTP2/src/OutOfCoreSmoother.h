@@ -0,0 +1,81 @@
+#ifndef OUT_OF_CORE_SMOOTHER_H
+#define OUT_OF_CORE_SMOOTHER_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp> // uint64
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdio>
+
+
+/**
+ * @brief The OutOfCoreSmoother class.
+ * Uniform laplacian and Taubin smoothing of meshes which do not fit in memory.
+ * The OFF file is streamed once into binary work files (positions, faces),
+ * then the vertices are cut in spatial chunks: consecutive ranges of the
+ * vertices sorted by Morton code of their cell in a grid of 64 cubic cells
+ * along the largest side of the bounding box, each chunk
+ * holding as many vertices as the memory budget allows. The faces are
+ * bucketed per chunk and each chunk gets its own laplacian rows (its interior
+ * vertices) with their 1-ring halo, written in a topology file.
+ * A smoothing step then streams the chunks one at a time: the positions of
+ * the chunk and of its halo are gathered from the current positions file,
+ * smoothed with the same kernels as LaplacianOperator::Step, and the rows
+ * are scattered into the other positions file. The two files are swapped
+ * after each step, which re-syncs the halos for the next one.
+ * The position files and the vertex to chunk map are memory mapped, so that
+ * the system can evict them; everything else stays under the budget.
+ * Unlike MeshHE, the positions are never normalized.
+ */
+class OutOfCoreSmoother
+{
+public:
+
+    static const size_t MIN_MEMORY_BUDGET = 16 << 20;       /// Smallest budget accepted (bytes)
+    static const size_t BYTES_PER_CHUNK_VERTEX = 256;       /// Memory needed per vertex of the chunk being processed (faces, sorted edges, rows, halo)
+    static const size_t BUCKET_BUFFER_SIZE = 64 << 10;      /// Write buffer of each face bucket (bytes)
+    static const glm::uint MORTON_BITS = 6;                 /// Bits per axis of the partitioning grid
+
+    OutOfCoreSmoother(const size_t memory_budget, const std::string& work_directory);     /// The work files are created in a new directory inside work_directory
+    ~OutOfCoreSmoother();                                                               /// Removes the work files
+
+    bool Open(const char* off_filename);                                    /// Converts and partitions a triangular OFF file
+    bool LaplacianSmooth(const float lambda, const glm::uint nb_iter);      /// Performs nb_iter steps of uniform laplacian smoothing with factor lambda
+    bool TaubinSmooth(const float lambda, const float mu, const glm::uint nb_iter);     /// Performs nb_iter steps of uniform taubin smoothing with factors lambda and mu
+    bool WriteOFF(const char* filename) const;                              /// Streams the current positions and the faces into an OFF file
+
+    glm::uint NbVertices() const       { return m_nb_vertices; }
+    glm::uint NbFaces() const          { return m_nb_faces; }
+    glm::uint NbChunks() const         { return glm::uint(m_chunk_offsets.size()) - 1; }
+    glm::uint MaxChunkVertices() const { return m_max_chunk_vertices; }
+
+private:
+
+    OutOfCoreSmoother(const OutOfCoreSmoother&);    /// Not copyable
+    OutOfCoreSmoother& operator=(const OutOfCoreSmoother&);
+
+    bool ConvertOFF(const char* off_filename);      /// Streams the OFF file into the positions and faces files
+    bool Partition();                               /// Assigns each vertex to a chunk (vertex to chunk map)
+    bool BuildChunks();                             /// Buckets the faces per chunk and writes the topology file
+    bool BuildChunkTopology(const glm::uint chunk, const std::vector<glm::uint>& faces, const glm::uint* chunk_of, FILE* topology);
+    bool Step(const float lambda);                  /// One smoothing step, from the current positions file to the other one
+
+    std::string WorkFile(const std::string& name) const;
+    std::string PositionsFile(const glm::uint index) const;
+
+    size_t m_memory_budget;
+    std::string m_work_directory;                   /// Private directory of the work files (empty if it could not be created)
+
+    glm::uint m_nb_vertices;
+    glm::uint m_nb_faces;
+    glm::vec3 m_bb_min;
+    glm::vec3 m_bb_max;
+
+    glm::uint m_max_chunk_vertices;
+    std::vector<glm::uint64> m_chunk_offsets;       /// Position of each chunk in the topology file, and the end of the file
+    glm::uint m_current;                            /// Index (0 or 1) of the positions file holding the current positions
+};
+
+#endif // OUT_OF_CORE_SMOOTHER_H
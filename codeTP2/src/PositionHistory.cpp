@@ -0,0 +1,363 @@
+#include <PositionHistory.h>
+#include <MeshHE.h>
+#include <Trace.h>
+
+#include <cstring>
+
+using namespace glm;
+using namespace std;
+
+const size_t PositionHistory::DEFAULT_MEMORY_BUDGET;
+
+
+//***************
+// Range coder
+
+static const glm::uint PROBABILITY_BITS = 11;
+static const glm::uint PROBABILITY_INIT = 1 << (PROBABILITY_BITS - 1);
+static const glm::uint ADAPTATION_SHIFT = 5;
+static const glm::uint RANGE_TOP = 1 << 24;
+
+
+/// Adaptive binary range encoder (carry propagated through the cached byte)
+class RangeEncoder
+{
+public:
+
+    RangeEncoder(vector<glm::uint8>& output) : m_low(0), m_range(0xFFFFFFFF), m_cache(0), m_cache_size(1), m_output(output) {}
+
+    void EncodeBit(glm::uint16& probability, const glm::uint bit)
+    {
+        glm::uint bound = (m_range >> PROBABILITY_BITS) * probability;
+        if(bit == 0)
+        {
+            m_range = bound;
+            probability += ((1 << PROBABILITY_BITS) - probability) >> ADAPTATION_SHIFT;
+        }
+        else
+        {
+            m_low += bound;
+            m_range -= bound;
+            probability -= probability >> ADAPTATION_SHIFT;
+        }
+        Normalize();
+    }
+
+    void EncodeTree(glm::uint16* probabilities, const glm::uint nb_bits, const glm::uint symbol)    /// Most significant bit first, each bit in the context of the previous ones
+    {
+        glm::uint node = 1;
+        for(int i = nb_bits - 1; i >= 0; i--)
+        {
+            glm::uint bit = (symbol >> i) & 1;
+            EncodeBit(probabilities[node], bit);
+            node = (node << 1) | bit;
+        }
+    }
+
+    void Flush()
+    {
+        for(int i = 0; i < 5; i++)
+            ShiftLow();
+    }
+
+private:
+
+    void Normalize()
+    {
+        while(m_range < RANGE_TOP)
+        {
+            m_range <<= 8;
+            ShiftLow();
+        }
+    }
+
+    void ShiftLow()
+    {
+        if(glm::uint(m_low) < 0xFF000000u || (m_low >> 32) != 0)
+        {
+            glm::uint8 carry = glm::uint8(m_low >> 32);
+            glm::uint8 byte = m_cache;
+            do{
+                m_output.push_back(glm::uint8(byte + carry));
+                byte = 0xFF;
+            }while(--m_cache_size != 0);
+            m_cache = glm::uint8(m_low >> 24);
+        }
+        m_cache_size++;
+        m_low = (m_low & 0x00FFFFFF) << 8;
+    }
+
+    glm::uint64 m_low;
+    glm::uint m_range;
+    glm::uint8 m_cache;
+    glm::uint64 m_cache_size;
+    vector<glm::uint8>& m_output;
+};
+
+
+class RangeDecoder
+{
+public:
+
+    RangeDecoder(const glm::uint8* input, const size_t size) : m_code(0), m_range(0xFFFFFFFF), m_input(input), m_size(size), m_next(0)
+    {
+        for(int i = 0; i < 5; i++)
+            m_code = (m_code << 8) | NextByte();
+    }
+
+    glm::uint DecodeBit(glm::uint16& probability)
+    {
+        glm::uint bound = (m_range >> PROBABILITY_BITS) * probability;
+        glm::uint bit;
+        if(m_code < bound)
+        {
+            m_range = bound;
+            probability += ((1 << PROBABILITY_BITS) - probability) >> ADAPTATION_SHIFT;
+            bit = 0;
+        }
+        else
+        {
+            m_code -= bound;
+            m_range -= bound;
+            probability -= probability >> ADAPTATION_SHIFT;
+            bit = 1;
+        }
+        Normalize();
+        return bit;
+    }
+
+    glm::uint DecodeTree(glm::uint16* probabilities, const glm::uint nb_bits)
+    {
+        glm::uint node = 1;
+        for(glm::uint i = 0; i < nb_bits; i++)
+            node = (node << 1) | DecodeBit(probabilities[node]);
+        return node - (1 << nb_bits);
+    }
+
+private:
+
+    void Normalize()
+    {
+        while(m_range < RANGE_TOP)
+        {
+            m_range <<= 8;
+            m_code = (m_code << 8) | NextByte();
+        }
+    }
+
+    glm::uint8 NextByte() { return (m_next < m_size) ? m_input[m_next++] : 0; }
+
+    glm::uint m_code;
+    glm::uint m_range;
+    const glm::uint8* m_input;
+    size_t m_size;
+    size_t m_next;
+};
+
+
+/// Adaptive models of the difference words of a step
+struct DeltaModel
+{
+    DeltaModel()
+    {
+        for(glm::uint16* p = &sizes[0][0]; p != &sizes[0][0] + sizeof(sizes) / sizeof(glm::uint16); p++)
+            *p = PROBABILITY_INIT;
+        for(glm::uint16* p = &high_bytes[0][0]; p != &high_bytes[0][0] + sizeof(high_bytes) / sizeof(glm::uint16); p++)
+            *p = PROBABILITY_INIT;
+        previous_size[0] = previous_size[1] = previous_size[2] = 0;
+    }
+
+    glm::uint16 sizes[5][8];            /// Number of significant bytes (3 bits tree), per number of the previous word of the same axis
+    glm::uint16 high_bytes[5][256];     /// Highest significant byte, per number of significant bytes
+    glm::uint previous_size[3];
+};
+
+static inline glm::uint FloatBits(const float f)
+{
+    glm::uint bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+static inline glm::uint ZigZag(const glm::uint delta)      /// Small negative and positive differences to small words
+{
+    return (delta << 1) ^ glm::uint(-glm::int32(delta >> 31));
+}
+
+static inline glm::uint UnZigZag(const glm::uint x)
+{
+    return (x >> 1) ^ glm::uint(-glm::int32(x & 1));
+}
+
+static inline glm::uint NbSignificantBytes(const glm::uint x)
+{
+    return (x == 0) ? 0 : (x >> 8 == 0) ? 1 : (x >> 16 == 0) ? 2 : (x >> 24 == 0) ? 3 : 4;
+}
+
+
+//***************
+// History
+
+PositionHistory::PositionHistory(const size_t memory_budget) :
+    m_memory_budget(memory_budget),
+    m_step_bytes(0)
+{
+}
+
+void PositionHistory::Reset(const MeshHE &mesh)
+{
+    m_current = mesh.m_positions;
+    m_undo.clear();
+    m_redo.clear();
+    m_step_bytes = 0;
+}
+
+bool PositionHistory::Record(const MeshHE &mesh)
+{
+    TRACE_ZONE("history record");
+
+    if(mesh.NbVertices() != m_current.size())
+    {
+        Reset(mesh);
+        return false;
+    }
+
+    Step step;
+    if(!EncodeStep(m_current, mesh.m_positions, step))
+        return false;
+
+    m_current = mesh.m_positions;
+
+    for(size_t i = 0; i < m_redo.size(); i++)
+        m_step_bytes -= m_redo[i].size();
+    m_redo.clear();
+
+    m_step_bytes += step.size();
+    m_undo.push_back(Step());
+    m_undo.back().swap(step);
+    DropOldSteps();
+    return true;
+}
+
+bool PositionHistory::Undo(MeshHE &mesh)
+{
+    if(m_undo.empty() || mesh.NbVertices() != m_current.size())
+        return false;
+
+    TRACE_ZONE("history undo");
+
+    ApplyStep(m_undo.back(), false, mesh);
+    m_redo.push_back(Step());
+    m_redo.back().swap(m_undo.back());
+    m_undo.pop_back();
+    return true;
+}
+
+bool PositionHistory::Redo(MeshHE &mesh)
+{
+    if(m_redo.empty() || mesh.NbVertices() != m_current.size())
+        return false;
+
+    TRACE_ZONE("history redo");
+
+    ApplyStep(m_redo.back(), true, mesh);
+    m_undo.push_back(Step());
+    m_undo.back().swap(m_redo.back());
+    m_redo.pop_back();
+    return true;
+}
+
+void PositionHistory::DropOldSteps()
+{
+    while(m_step_bytes > m_memory_budget && !m_undo.empty())
+    {
+        m_step_bytes -= m_undo.front().size();
+        m_undo.pop_front();
+    }
+}
+
+/**
+ * @brief PositionHistory::EncodeStep
+ * The words are coded vertex after vertex, x, y then z. A step is the size
+ * of the range coded part (4 bytes), the range coded part, then the lower
+ * bytes of the words (little endian), which are close to random.
+ */
+bool PositionHistory::EncodeStep(const vector<vec3> &from, const vector<vec3> &to, Step &step)
+{
+    step.assign(4, 0);
+    if(from.empty())
+        return false;
+
+    glm::uint nb_words = 3 * from.size();
+    const float* a = &from[0].x;
+    const float* b = &to[0].x;
+
+    vector<glm::uint8> low_bytes;
+    RangeEncoder encoder(step);
+    DeltaModel model;
+    bool moved = false;
+
+    for(glm::uint i = 0; i < nb_words; i++)
+    {
+        glm::uint x = ZigZag(FloatBits(b[i]) - FloatBits(a[i]));
+        glm::uint axis = i % 3;
+        glm::uint size = NbSignificantBytes(x);
+
+        encoder.EncodeTree(model.sizes[model.previous_size[axis]], 3, size);
+        model.previous_size[axis] = size;
+
+        if(size > 0)
+        {
+            encoder.EncodeTree(model.high_bytes[size], 8, x >> (8 * (size - 1)));
+            for(glm::uint k = 0; k + 1 < size; k++)
+                low_bytes.push_back(glm::uint8(x >> (8 * k)));
+            moved = true;
+        }
+    }
+    encoder.Flush();
+
+    glm::uint coded_size = step.size() - 4;
+    memcpy(&step[0], &coded_size, sizeof(coded_size));
+    step.insert(step.end(), low_bytes.begin(), low_bytes.end());
+
+    return moved;
+}
+
+void PositionHistory::ApplyStep(const Step &step, const bool forward, MeshHE &mesh)
+{
+    glm::uint nb_vertices = m_current.size();
+
+    glm::uint coded_size;
+    memcpy(&coded_size, &step[0], sizeof(coded_size));
+    RangeDecoder decoder(&step[4], coded_size);
+    const glm::uint8* low_bytes = &step[0] + 4 + coded_size;
+    DeltaModel model;
+
+    for(glm::uint v = 0; v < nb_vertices; v++)
+    {
+        bool moved = false;
+        for(glm::uint axis = 0; axis < 3; axis++)
+        {
+            glm::uint size = decoder.DecodeTree(model.sizes[model.previous_size[axis]], 3);
+            model.previous_size[axis] = size;
+
+            if(size > 0)
+            {
+                glm::uint x = decoder.DecodeTree(model.high_bytes[size], 8) << (8 * (size - 1));
+                for(glm::uint k = 0; k + 1 < size; k++)
+                    x |= glm::uint(*low_bytes++) << (8 * k);
+
+                glm::uint delta = UnZigZag(x);
+                glm::uint bits = forward ? FloatBits(m_current[v][axis]) + delta : FloatBits(m_current[v][axis]) - delta;
+                memcpy(&m_current[v][axis], &bits, sizeof(bits));
+                moved = true;
+            }
+        }
+
+        if(moved)
+        {
+            mesh.m_positions[v] = m_current[v];
+            mesh.MarkMoved(Vertex(v));
+        }
+    }
+}
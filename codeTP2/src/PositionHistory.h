@@ -0,0 +1,63 @@
+#ifndef POSITION_HISTORY_H
+#define POSITION_HISTORY_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp> // uint8
+
+#include <vector>
+#include <deque>
+#include <cstddef>
+
+class MeshHE;
+
+
+/**
+ * @brief The PositionHistory class.
+ * Undo / redo stack of the positions of a mesh, one step per recorded change.
+ * A step stores, for each coordinate, the difference of the bits of the new
+ * and old floats as an integer (zigzag coded, so that small moves in both
+ * directions give small words): the coordinates that did not move give 0,
+ * and the ones moved a little only differ in their low mantissa bits.
+ * The number of significant bytes of each word (context: the previous word
+ * of the same axis) and its highest significant byte (context: number of
+ * significant bytes) are entropy coded by an adaptive binary range coder,
+ * the lower bytes, close to random, are stored as is after the coded part.
+ * The same step is subtracted to undo it and added to redo it. Only the
+ * vertices it changes are marked moved, so that the next ComputeNormals
+ * only updates the normals around them.
+ * The oldest steps are dropped when the compressed steps exceed the memory
+ * budget.
+ */
+class PositionHistory
+{
+public:
+
+    static const size_t DEFAULT_MEMORY_BUDGET = 64 << 20;     /// Bytes of compressed steps kept by default
+
+    PositionHistory(const size_t memory_budget = DEFAULT_MEMORY_BUDGET);
+
+    void Reset(const MeshHE& mesh);         /// Forgets all the steps, the positions of mesh become the current state
+    bool Record(const MeshHE& mesh);        /// Adds the change from the current state to the positions of mesh as an undo step (false if nothing moved), clears the redo steps
+    bool Undo(MeshHE& mesh);                /// Applies the last undo step to the current state and to mesh (which must be in the current state)
+    bool Redo(MeshHE& mesh);
+
+    glm::uint NbUndoSteps() const { return m_undo.size(); }
+    glm::uint NbRedoSteps() const { return m_redo.size(); }
+    size_t NbStepBytes() const    { return m_step_bytes; }     /// Memory used by the compressed steps
+
+private:
+
+    typedef std::vector<glm::uint8> Step;
+
+    static bool EncodeStep(const std::vector<glm::vec3>& from, const std::vector<glm::vec3>& to, Step& step);     /// false if nothing moved
+    void ApplyStep(const Step& step, const bool forward, MeshHE& mesh);     /// forward: redo, else undo
+    void DropOldSteps();                    /// Enforces the memory budget
+
+    size_t m_memory_budget;
+    std::vector<glm::vec3> m_current;       /// Positions after the last recorded / applied step
+    std::deque<Step> m_undo;                /// Oldest step first
+    std::vector<Step> m_redo;               /// Next step to redo last
+    size_t m_step_bytes;
+};
+
+#endif // POSITION_HISTORY_H
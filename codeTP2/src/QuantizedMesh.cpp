@@ -0,0 +1,422 @@
+#include <QuantizedMesh.h>
+#include <MeshHE.h>
+#include <MappedFile.h>
+#include <Trace.h>
+
+#include <iostream>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+using namespace glm;
+using namespace std;
+
+const glm::uint QuantizedMesh::OCTAHEDRAL_MAX;
+const glm::uint QuantizedMesh::FILE_VERSION;
+
+
+//***************
+// File layout
+
+static const char QMESH_MAGIC[8] = { 'Q', 'M', 'E', 'S', 'H', 'H', 'E', '\n' };
+static const glm::uint32 QMESH_ENDIANNESS = 0x01020304;
+
+/// Followed by the positions (3 x uint16 or one uint64 per vertex), the
+/// normals (one uint32 per vertex) then the indices (3 x uint32 per face),
+/// stored in the byte order of the writer
+struct QMeshHeader
+{
+    char magic[8];
+    glm::uint32 version;
+    glm::uint32 endianness;     /// QMESH_ENDIANNESS as stored by the writer
+    glm::uint32 position_bits;
+    glm::uint32 nb_vertices;
+    glm::uint32 nb_faces;
+    float origin[3];
+    float step[3];
+};
+
+static_assert(sizeof(QMeshHeader) == 52, "QMeshHeader must not be padded");
+
+
+/**
+ * @brief QuantizedMesh::Encode
+ * @param position_bits 16 or 21
+ * @return false if position_bits is not supported
+ */
+bool QuantizedMesh::Encode(const MeshHE &mesh, const glm::uint position_bits)
+{
+    TRACE_ZONE("quantize");
+
+    if(position_bits != 16 && position_bits != 21)
+    {
+        cerr << "Positions can only be quantized on 16 or 21 bits (not " << position_bits << ")" << endl;
+        return false;
+    }
+
+    Clear();
+    m_position_bits = position_bits;
+    m_nb_vertices = mesh.NbVertices();
+    int nb_vertices = m_nb_vertices;
+
+    if(nb_vertices > 0)
+    {
+        vector<vec3> bb = mesh.computeBB();
+        ComputeGrid(bb[0], bb[1], position_bits, m_origin, m_step);
+    }
+
+    if(position_bits == 16)
+        m_positions16.resize(3*nb_vertices);
+    else
+        m_positions21.resize(nb_vertices);
+    m_normals.resize(nb_vertices);
+
+    // Half edge 3*f+j is the corner j of face f, so their origins are the faces
+    m_indices = mesh.m_he_vertex;
+
+    #pragma omp parallel for schedule(static)
+    for(int v = 0; v < nb_vertices; v++)
+    {
+        uvec3 q = QuantizePosition(mesh.m_positions[v], m_origin, m_step, position_bits);
+        if(position_bits == 16)
+        {
+            m_positions16[3*v]   = glm::uint16(q.x);
+            m_positions16[3*v+1] = glm::uint16(q.y);
+            m_positions16[3*v+2] = glm::uint16(q.z);
+        }
+        else
+        {
+            m_positions21[v] = glm::uint64(q.x) | (glm::uint64(q.y) << 21) | (glm::uint64(q.z) << 42);
+        }
+
+        m_normals[v] = EncodeOctahedral(mesh.m_normals[v]);
+    }
+
+    return true;
+}
+
+bool QuantizedMesh::Decode(MeshHE &mesh) const
+{
+    if(mesh.NbVertices() != m_nb_vertices)
+    {
+        cerr << "Cannot decode " << m_nb_vertices << " vertices into a mesh of " << mesh.NbVertices() << " vertices" << endl;
+        return false;
+    }
+
+    int nb_vertices = m_nb_vertices;
+    mesh.m_normals.resize(nb_vertices);
+
+    #pragma omp parallel for schedule(static)
+    for(int v = 0; v < nb_vertices; v++)
+    {
+        mesh.m_positions[v] = DecodePosition(v);
+        mesh.m_normals[v] = DecodeNormal(v);
+    }
+
+    mesh.MarkAllMoved();
+    return true;
+}
+
+/**
+ * @brief QuantizedMesh::DecodeMesh
+ * The attributes are decoded first, as building the half edges also builds
+ * the laplacian, whose weights may depend on the positions.
+ */
+void QuantizedMesh::DecodeMesh(MeshHE &mesh) const
+{
+    mesh.ClearRessources();
+
+    int nb_vertices = m_nb_vertices;
+    mesh.m_positions.resize(nb_vertices);
+    mesh.m_normals.resize(nb_vertices);
+
+    #pragma omp parallel for schedule(static)
+    for(int v = 0; v < nb_vertices; v++)
+    {
+        mesh.m_positions[v] = DecodePosition(v);
+        mesh.m_normals[v] = DecodeNormal(v);
+    }
+
+    mesh.BuildConnectivity(m_indices, m_nb_vertices);
+    mesh.MarkAllMoved();
+}
+
+void QuantizedMesh::Clear()
+{
+    m_position_bits = 0;
+    m_nb_vertices = 0;
+    m_origin = m_step = vec3(0.0f);
+    m_positions16.clear();
+    m_positions21.clear();
+    m_normals.clear();
+    m_indices.clear();
+}
+
+bool QuantizedMesh::Write(const char *filename) const
+{
+    QMeshHeader header;
+    memset(&header, 0, sizeof(QMeshHeader));
+    memcpy(header.magic, QMESH_MAGIC, sizeof(QMESH_MAGIC));
+    header.version = FILE_VERSION;
+    header.endianness = QMESH_ENDIANNESS;
+    header.position_bits = m_position_bits;
+    header.nb_vertices = m_nb_vertices;
+    header.nb_faces = NbFaces();
+    for(int i = 0; i < 3; i++)
+    {
+        header.origin[i] = m_origin[i];
+        header.step[i] = m_step[i];
+    }
+
+    FILE* file = fopen(filename, "wb");
+    if(file == NULL)
+    {
+        cerr << "Unable to write : " << filename << endl;
+        return false;
+    }
+
+    bool ok = fwrite(&header, sizeof(QMeshHeader), 1, file) == 1;
+    ok = ok && fwrite(m_positions16.data(), sizeof(glm::uint16), m_positions16.size(), file) == m_positions16.size();
+    ok = ok && fwrite(m_positions21.data(), sizeof(glm::uint64), m_positions21.size(), file) == m_positions21.size();
+    ok = ok && fwrite(m_normals.data(), sizeof(glm::uint32), m_normals.size(), file) == m_normals.size();
+    ok = ok && fwrite(m_indices.data(), sizeof(glm::uint), m_indices.size(), file) == m_indices.size();
+    ok = (fclose(file) == 0) && ok;
+
+    if(!ok)
+    {
+        cerr << "Unable to write : " << filename << endl;
+        remove(filename);
+    }
+    return ok;
+}
+
+/**
+ * @brief QuantizedMesh::Read
+ * Checks the header, the size of the file and the range of every index, so
+ * that the decoded mesh is always valid. Files written on a host of another
+ * byte order are rejected.
+ */
+bool QuantizedMesh::Read(const char *filename)
+{
+    Clear();
+
+    MappedFile file;
+    if(!file.Open(filename))
+    {
+        cerr << "Unable to read : " << filename << endl;
+        return false;
+    }
+
+    QMeshHeader header;
+    if(file.Size() < sizeof(QMeshHeader))
+    {
+        cerr << filename << ": not a .qmesh file" << endl;
+        return false;
+    }
+    memcpy(&header, file.Begin(), sizeof(QMeshHeader));
+
+    if(memcmp(header.magic, QMESH_MAGIC, sizeof(QMESH_MAGIC)) != 0 || header.version != FILE_VERSION
+            || header.endianness != QMESH_ENDIANNESS)
+    {
+        cerr << filename << ": not a .qmesh file of version " << FILE_VERSION << " and of this byte order" << endl;
+        return false;
+    }
+
+    glm::uint64 nb_vertices = header.nb_vertices;
+    glm::uint64 nb_indices = 3 * glm::uint64(header.nb_faces);
+    glm::uint64 position_bytes = nb_vertices * (header.position_bits == 16 ? 3*sizeof(glm::uint16) : sizeof(glm::uint64));
+    glm::uint64 normal_bytes = nb_vertices * sizeof(glm::uint32);
+    glm::uint64 index_bytes = nb_indices * sizeof(glm::uint);
+
+    bool valid = (header.position_bits == 16 || header.position_bits == 21)
+              && file.Size() == sizeof(QMeshHeader) + position_bytes + normal_bytes + index_bytes;
+    for(int i = 0; i < 3; i++)
+        valid = valid && std::isfinite(header.origin[i]) && std::isfinite(header.step[i]) && header.step[i] >= 0.0f;
+
+    if(!valid)
+    {
+        cerr << filename << ": invalid header or truncated file" << endl;
+        return false;
+    }
+
+    m_position_bits = header.position_bits;
+    m_nb_vertices = header.nb_vertices;
+    m_origin = vec3(header.origin[0], header.origin[1], header.origin[2]);
+    m_step = vec3(header.step[0], header.step[1], header.step[2]);
+
+    const char* data = file.Begin() + sizeof(QMeshHeader);
+    if(m_position_bits == 16)
+        m_positions16.resize(3*nb_vertices);
+    else
+        m_positions21.resize(nb_vertices);
+    m_normals.resize(nb_vertices);
+    m_indices.resize(nb_indices);
+
+    if(nb_vertices > 0)
+    {
+        memcpy(m_position_bits == 16 ? (void*)m_positions16.data() : (void*)m_positions21.data(), data, position_bytes);
+        memcpy(m_normals.data(), data + position_bytes, normal_bytes);
+    }
+    if(nb_indices > 0)
+        memcpy(m_indices.data(), data + position_bytes + normal_bytes, index_bytes);
+
+    for(size_t i = 0; i < m_indices.size(); i++)
+    {
+        if(m_indices[i] >= m_nb_vertices)
+        {
+            cerr << filename << ": vertex index out of range" << endl;
+            Clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief QuantizedMesh::PositionErrorBound
+ * Half the diagonal of a cell, plus the rounding of the decoded coordinates
+ * to floats.
+ */
+float QuantizedMesh::PositionErrorBound() const
+{
+    vec3 corner = glm::max(glm::abs(m_origin), glm::abs(m_origin + m_step * float((1u << m_position_bits) - 1)));
+    return 0.5f * glm::length(m_step) + 0.5f * FLT_EPSILON * glm::length(corner);
+}
+
+glm::vec3 QuantizedMesh::DecodePosition(const glm::uint v) const
+{
+    uvec3 q;
+    if(m_position_bits == 16)
+    {
+        q = uvec3(m_positions16[3*v], m_positions16[3*v+1], m_positions16[3*v+2]);
+    }
+    else
+    {
+        glm::uint64 c = m_positions21[v];
+        q = uvec3(glm::uint(c & 0x1FFFFF), glm::uint((c >> 21) & 0x1FFFFF), glm::uint((c >> 42) & 0x1FFFFF));
+    }
+    return vec3(dvec3(m_origin) + dvec3(m_step) * dvec3(q));
+}
+
+size_t QuantizedMesh::NbBytes() const
+{
+    return m_positions16.size() * sizeof(glm::uint16) + m_positions21.size() * sizeof(glm::uint64)
+         + m_normals.size() * sizeof(glm::uint32);
+}
+
+/**
+ * @brief QuantizedMesh::MeasureErrors
+ * Normals of zero length in mesh (isolated vertices) are not measured.
+ */
+void QuantizedMesh::MeasureErrors(const MeshHE &mesh, float &max_position_error, float &max_normal_angle) const
+{
+    int nb_vertices = glm::min(m_nb_vertices, mesh.NbVertices());
+    double position_error = 0.0;
+    double normal_angle = 0.0;
+
+    #pragma omp parallel for schedule(static) reduction(max:position_error, normal_angle)
+    for(int v = 0; v < nb_vertices; v++)
+    {
+        position_error = glm::max(position_error, glm::distance(dvec3(DecodePosition(v)), dvec3(mesh.m_positions[v])));
+
+        // atan2 keeps its precision for small angles, unlike acos
+        dvec3 n(mesh.m_normals[v]);
+        if(glm::length(n) > 0.0)
+        {
+            dvec3 d(DecodeNormal(v));
+            normal_angle = glm::max(normal_angle, atan2(glm::length(glm::cross(d, n)), glm::dot(d, n)));
+        }
+    }
+
+    max_position_error = float(position_error);
+    max_normal_angle = float(glm::degrees(normal_angle));
+}
+
+
+//***************
+// Encodings
+
+/**
+ * @brief QuantizedMesh::ComputeGrid
+ * (1 << bits) - 1 cells along each axis, so that both sides of the box are
+ * exactly representable. Flat axes get a null step.
+ */
+void QuantizedMesh::ComputeGrid(const glm::vec3 &bb_min, const glm::vec3 &bb_max, const glm::uint bits, glm::vec3 &origin, glm::vec3 &step)
+{
+    origin = bb_min;
+    step = (bb_max - bb_min) / float((1u << bits) - 1);
+}
+
+glm::uvec3 QuantizedMesh::QuantizePosition(const glm::vec3 &p, const glm::vec3 &origin, const glm::vec3 &step, const glm::uint bits)
+{
+    double max_q = double((1u << bits) - 1);
+    uvec3 q(0);
+    for(int i = 0; i < 3; i++)
+    {
+        if(step[i] > 0.0f)
+            q[i] = glm::uint(glm::clamp(floor((double(p[i]) - origin[i]) / step[i] + 0.5), 0.0, max_q));
+    }
+    return q;
+}
+
+static inline float SignNotZero(const float x)
+{
+    return (x < 0.0f) ? -1.0f : 1.0f;
+}
+
+static inline glm::uint32 PackOctahedral(const int x, const int y)
+{
+    return glm::uint32(glm::uint16(glm::int16(x))) | (glm::uint32(glm::uint16(glm::int16(y))) << 16);
+}
+
+/**
+ * @brief QuantizedMesh::EncodeOctahedral
+ * Projects n on the octahedron |x| + |y| + |z| = 1, folds the lower half
+ * over the upper one and keeps the (x, y) coordinates. Of the 4 codes around
+ * the projection, the one which decodes closest to n is kept.
+ */
+glm::uint32 QuantizedMesh::EncodeOctahedral(const glm::vec3 &n)
+{
+    float l1 = glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z);
+    if(l1 == 0.0f)
+        return PackOctahedral(0, 0);
+
+    vec2 p(n.x / l1, n.y / l1);
+    if(n.z < 0.0f)
+        p = vec2((1.0f - glm::abs(p.y)) * SignNotZero(p.x), (1.0f - glm::abs(p.x)) * SignNotZero(p.y));
+
+    const float range = float(OCTAHEDRAL_MAX);
+    vec2 base = glm::floor(p * range);
+    vec3 unit = n / glm::length(n);
+
+    glm::uint32 best = 0;
+    float best_dot = -2.0f;
+    for(int i = 0; i < 4; i++)
+    {
+        vec2 c = glm::clamp(base + vec2(float(i & 1), float(i >> 1)), vec2(-range), vec2(range));
+        glm::uint32 code = PackOctahedral(int(c.x), int(c.y));
+        float d = glm::dot(DecodeOctahedral(code), unit);
+        if(d > best_dot)
+        {
+            best_dot = d;
+            best = code;
+        }
+    }
+    return best;
+}
+
+glm::vec3 QuantizedMesh::DecodeOctahedral(const glm::uint32 code)
+{
+    vec2 p(float(glm::int16(code & 0xFFFF)), float(glm::int16(code >> 16)));
+    p = glm::max(p / float(OCTAHEDRAL_MAX), vec2(-1.0f));
+
+    vec3 n(p.x, p.y, 1.0f - glm::abs(p.x) - glm::abs(p.y));
+    if(n.z < 0.0f)
+    {
+        float x = n.x;
+        n.x = (1.0f - glm::abs(n.y)) * SignNotZero(x);
+        n.y = (1.0f - glm::abs(x)) * SignNotZero(n.y);
+    }
+    return glm::normalize(n);
+}
@@ -0,0 +1,74 @@
+#ifndef QUANTIZED_MESH_H
+#define QUANTIZED_MESH_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp> // uint16, uint32, uint64
+
+#include <vector>
+#include <cstddef>
+
+class MeshHE;
+
+
+/**
+ * @brief The QuantizedMesh class.
+ * Compact copy of a MeshHE, for viewing and archiving large meshes:
+ *  - each position is quantized on 16 bits (3 x uint16, 6 bytes) or 21 bits
+ *    (packed in one uint64, 8 bytes) per axis, on a regular grid spanning
+ *    the bounding box given by computeBB() (position = origin + step * q),
+ *  - each normal is octahedral encoded on 2 x 16 bits (one uint32), the
+ *    octahedron coordinates being stored as signed normalized shorts.
+ * That is 10 or 12 bytes per vertex instead of 24. The same encodings are
+ * used by Object for its compact vertex buffer, decoded in the vertex shader.
+ * The triangles are kept as well, so that a ".qmesh" file (Write / Read)
+ * holds the whole mesh : a fixed header (magic, version, byte order check,
+ * bits per axis, element counts, origin and step of the grid) followed by
+ * the packed positions, the normals and the 3 vertex indices of each face.
+ */
+class QuantizedMesh
+{
+public:
+
+    static const glm::uint OCTAHEDRAL_MAX = 32767;      /// Signed normalized range of the octahedron coordinates
+    static const glm::uint FILE_VERSION = 1;            /// To increment each time the layout of the .qmesh files changes
+
+    QuantizedMesh() : m_position_bits(0), m_nb_vertices(0), m_origin(0.0f), m_step(0.0f) {}
+
+    bool Encode(const MeshHE& mesh, const glm::uint position_bits = 16);    /// Quantizes the positions (16 or 21 bits per axis) and normals of mesh, keeps its triangles
+    bool Decode(MeshHE& mesh) const;                                        /// Writes the decoded positions and normals back into mesh (same number of vertices)
+    void DecodeMesh(MeshHE& mesh) const;                                    /// Rebuilds the whole mesh, half edges included, from the decoded attributes and the triangles
+    void Clear();
+
+    bool Write(const char* filename) const;                                 /// Saves a .qmesh file
+    bool Read(const char* filename);                                        /// Loads a .qmesh file, returns false if it is missing or invalid
+
+    glm::vec3 DecodePosition(const glm::uint v) const;
+    glm::vec3 DecodeNormal(const glm::uint v) const { return DecodeOctahedral(m_normals[v]); }
+
+    glm::uint NbVertices() const   { return m_nb_vertices; }
+    glm::uint NbFaces() const      { return m_indices.size() / 3; }
+    glm::uint PositionBits() const { return m_position_bits; }
+    size_t NbBytes() const;                                                 /// Memory used by the encoded attributes
+    float PositionErrorBound() const;                                       /// Largest distance between a position and its decoded value
+    void MeasureErrors(const MeshHE& mesh, float& max_position_error, float& max_normal_angle) const;  /// Largest distance and angle (degrees) to the attributes of mesh
+
+    // Encodings shared with Object
+    static void ComputeGrid(const glm::vec3& bb_min, const glm::vec3& bb_max, const glm::uint bits, glm::vec3& origin, glm::vec3& step);
+    static glm::uvec3 QuantizePosition(const glm::vec3& p, const glm::vec3& origin, const glm::vec3& step, const glm::uint bits);
+    static glm::uint32 EncodeOctahedral(const glm::vec3& n);                /// Unit vector to 2 x int16 (x in the low bits)
+    static glm::vec3 DecodeOctahedral(const glm::uint32 code);
+
+private:
+
+    glm::uint m_position_bits;
+    glm::uint m_nb_vertices;
+    glm::vec3 m_origin;                             /// Decoded position of the quantized (0, 0, 0)
+    glm::vec3 m_step;                               /// Size of a quantization cell along each axis
+
+    std::vector<glm::uint16> m_positions16;         /// x, y, z of each vertex (16 bits mode)
+    std::vector<glm::uint64> m_positions21;         /// x | y << 21 | z << 42 (21 bits mode)
+    std::vector<glm::uint32> m_normals;             /// Octahedral normal of each vertex
+    std::vector<glm::uint> m_indices;               /// 3 vertex indices per face
+};
+
+#endif // QUANTIZED_MESH_H
@@ -0,0 +1,416 @@
+#include <SimdKernels.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MESH_SIMD_X86
+#include <immintrin.h>
+#endif
+
+using namespace glm;
+using namespace std;
+
+const glm::uint SoAPositions::SOA_PADDING;
+
+
+//---------------------------------------------------------
+// SoAPositions section
+//---------------------------------------------------------
+
+void SoAPositions::Resize(const glm::uint size)
+{
+    m_size = size;
+    m_padded_size = (size + SOA_PADDING - 1) / SOA_PADDING * SOA_PADDING;
+    m_data.clear();
+    m_data.resize(3*m_padded_size);
+
+    float* x = X();
+    float* y = Y();
+    float* z = Z();
+    int padded_size = m_padded_size;
+
+    #pragma omp parallel for schedule(static)
+    for(int i=0; i<padded_size; i++)
+    {
+        x[i] = 0.0f;
+        y[i] = 0.0f;
+        z[i] = 0.0f;
+    }
+}
+
+void SoAPositions::Load(const vector<vec3> &positions)
+{
+    if(positions.size() != m_size || m_data.empty())
+        Resize(positions.size());
+
+    float* x = X();
+    float* y = Y();
+    float* z = Z();
+    int size = m_size;
+
+    #pragma omp parallel for schedule(static)
+    for(int i=0; i<size; i++)
+    {
+        x[i] = positions[i].x;
+        y[i] = positions[i].y;
+        z[i] = positions[i].z;
+    }
+}
+
+void SoAPositions::Store(vector<vec3> &positions) const
+{
+    positions.resize(m_size);
+
+    const float* x = X();
+    const float* y = Y();
+    const float* z = Z();
+    int size = m_size;
+
+    #pragma omp parallel for schedule(static)
+    for(int i=0; i<size; i++)
+    {
+        positions[i] = vec3(x[i], y[i], z[i]);
+    }
+}
+
+
+void SoAPositions::Load(const vector<vec3> &positions, const vector<glm::uint> &order)
+{
+    if(positions.size() != m_size || m_data.empty())
+        Resize(positions.size());
+
+    float* x = X();
+    float* y = Y();
+    float* z = Z();
+    int size = m_size;
+
+    #pragma omp parallel for schedule(static)
+    for(int i=0; i<size; i++)
+    {
+        const vec3& p = positions[order[i]];
+        x[i] = p.x;
+        y[i] = p.y;
+        z[i] = p.z;
+    }
+}
+
+void SoAPositions::Store(vector<vec3> &positions, const vector<glm::uint> &order) const
+{
+    positions.resize(m_size);
+
+    const float* x = X();
+    const float* y = Y();
+    const float* z = Z();
+    int size = m_size;
+
+    #pragma omp parallel for schedule(static)
+    for(int i=0; i<size; i++)
+    {
+        positions[order[i]] = vec3(x[i], y[i], z[i]);
+    }
+}
+
+
+//---------------------------------------------------------
+// Scalar kernels
+//---------------------------------------------------------
+
+static void SpmvScalar(const float* x, const float* y, const float* z,
+                       const float* self_x, const float* self_y, const float* self_z,
+                       const glm::uint* offsets, const glm::uint* columns, const float* values, const float* diagonal,
+                       glm::uint nb_rows, float* lx, float* ly, float* lz)
+{
+    for(glm::uint r = 0; r < nb_rows; r++)
+    {
+        float sx = 0.0f, sy = 0.0f, sz = 0.0f;
+        for(glm::uint k = offsets[r]; k < offsets[r+1]; k++)
+        {
+            glm::uint j = columns[k];
+            float w = values[k];
+            sx += w*x[j];
+            sy += w*y[j];
+            sz += w*z[j];
+        }
+
+        float d = diagonal[r];
+        lx[r] = sx - d*self_x[r];
+        ly[r] = sy - d*self_y[r];
+        lz[r] = sz - d*self_z[r];
+    }
+}
+
+static void UpdateScalar(const float* x, const float* y, const float* z,
+                         const float* lx, const float* ly, const float* lz,
+                         float lambda, glm::uint nb_rows,
+                         float* dst_x, float* dst_y, float* dst_z)
+{
+    for(glm::uint i = 0; i < nb_rows; i++)
+    {
+        dst_x[i] = x[i] + lambda*lx[i];
+        dst_y[i] = y[i] + lambda*ly[i];
+        dst_z[i] = z[i] + lambda*lz[i];
+    }
+}
+
+static void BoundingBoxScalar(const float* xyz, glm::uint nb_positions, float* bb_min, float* bb_max)
+{
+    for(int c = 0; c < 3; c++)
+    {
+        bb_min[c] = nb_positions > 0 ? xyz[c] : 0.0f;
+        bb_max[c] = bb_min[c];
+    }
+
+    for(glm::uint i = 1; i < nb_positions; i++)
+    {
+        for(int c = 0; c < 3; c++)
+        {
+            bb_min[c] = glm::min(bb_min[c], xyz[3*i+c]);
+            bb_max[c] = glm::max(bb_max[c], xyz[3*i+c]);
+        }
+    }
+}
+
+
+
+#ifdef MESH_SIMD_X86
+
+//---------------------------------------------------------
+// SSE4 kernels
+// (no gather instruction: the sparse products stay scalar,
+//  emulating the gathers lane by lane is slower than the scalar loop)
+//---------------------------------------------------------
+
+__attribute__((target("sse4.1")))
+static void UpdateSSE4(const float* x, const float* y, const float* z,
+                       const float* lx, const float* ly, const float* lz,
+                       float lambda, glm::uint nb_rows,
+                       float* dst_x, float* dst_y, float* dst_z)
+{
+    __m128 l = _mm_set1_ps(lambda);
+
+    glm::uint i = 0;
+    for(; i + 4 <= nb_rows; i += 4)
+    {
+        _mm_storeu_ps(dst_x + i, _mm_add_ps(_mm_loadu_ps(x + i), _mm_mul_ps(l, _mm_loadu_ps(lx + i))));
+        _mm_storeu_ps(dst_y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(l, _mm_loadu_ps(ly + i))));
+        _mm_storeu_ps(dst_z + i, _mm_add_ps(_mm_loadu_ps(z + i), _mm_mul_ps(l, _mm_loadu_ps(lz + i))));
+    }
+
+    UpdateScalar(x + i, y + i, z + i, lx + i, ly + i, lz + i, lambda, nb_rows - i, dst_x + i, dst_y + i, dst_z + i);
+}
+
+/**
+ * Interleaved positions are read 12 floats (4 positions) at a time in 3
+ * registers; float k of a block always holds component k%3, so each lane of
+ * the accumulators only ever sees one component.
+ */
+__attribute__((target("sse4.1")))
+static void BoundingBoxSSE4(const float* xyz, glm::uint nb_positions, float* bb_min, float* bb_max)
+{
+    if(nb_positions < 4)
+    {
+        BoundingBoxScalar(xyz, nb_positions, bb_min, bb_max);
+        return;
+    }
+
+    __m128 min0 = _mm_loadu_ps(xyz), min1 = _mm_loadu_ps(xyz + 4), min2 = _mm_loadu_ps(xyz + 8);
+    __m128 max0 = min0, max1 = min1, max2 = min2;
+
+    glm::uint i = 4;
+    for(; i + 4 <= nb_positions; i += 4)
+    {
+        const float* p = xyz + 3*i;
+        __m128 a = _mm_loadu_ps(p), b = _mm_loadu_ps(p + 4), c = _mm_loadu_ps(p + 8);
+        min0 = _mm_min_ps(min0, a); max0 = _mm_max_ps(max0, a);
+        min1 = _mm_min_ps(min1, b); max1 = _mm_max_ps(max1, b);
+        min2 = _mm_min_ps(min2, c); max2 = _mm_max_ps(max2, c);
+    }
+
+    float mins[12], maxs[12];
+    _mm_storeu_ps(mins, min0); _mm_storeu_ps(mins + 4, min1); _mm_storeu_ps(mins + 8, min2);
+    _mm_storeu_ps(maxs, max0); _mm_storeu_ps(maxs + 4, max1); _mm_storeu_ps(maxs + 8, max2);
+
+    for(int c = 0; c < 3; c++)
+    {
+        bb_min[c] = mins[c];
+        bb_max[c] = maxs[c];
+    }
+    for(int k = 3; k < 12; k++)
+    {
+        bb_min[k%3] = glm::min(bb_min[k%3], mins[k]);
+        bb_max[k%3] = glm::max(bb_max[k%3], maxs[k]);
+    }
+    for(; i < nb_positions; i++)
+    {
+        for(int c = 0; c < 3; c++)
+        {
+            bb_min[c] = glm::min(bb_min[c], xyz[3*i+c]);
+            bb_max[c] = glm::max(bb_max[c], xyz[3*i+c]);
+        }
+    }
+}
+
+
+
+//---------------------------------------------------------
+// AVX2 kernels
+//---------------------------------------------------------
+
+/**
+ * 8 rows are processed in lock step: at step t, each lane gathers the t-th
+ * entry of its row, lanes whose row is shorter than t+1 are masked out.
+ */
+__attribute__((target("avx2")))
+static void SpmvAVX2(const float* x, const float* y, const float* z,
+                     const float* self_x, const float* self_y, const float* self_z,
+                     const glm::uint* offsets, const glm::uint* columns, const float* values, const float* diagonal,
+                     glm::uint nb_rows, float* lx, float* ly, float* lz)
+{
+    glm::uint r = 0;
+    for(; r + 8 <= nb_rows; r += 8)
+    {
+        __m256i start  = _mm256_loadu_si256((const __m256i*)(offsets + r));
+        __m256i stop   = _mm256_loadu_si256((const __m256i*)(offsets + r + 1));
+        __m256i degree = _mm256_sub_epi32(stop, start);
+
+        __m256i m = _mm256_max_epu32(degree, _mm256_permute2x128_si256(degree, degree, 1));
+        m = _mm256_max_epu32(m, _mm256_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+        m = _mm256_max_epu32(m, _mm256_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+        int max_degree = _mm256_cvtsi256_si32(m);
+
+        __m256 sx = _mm256_setzero_ps(), sy = _mm256_setzero_ps(), sz = _mm256_setzero_ps();
+        for(int t = 0; t < max_degree; t++)
+        {
+            __m256i tt = _mm256_set1_epi32(t);
+            __m256i mask = _mm256_cmpgt_epi32(degree, tt);
+            __m256 fmask = _mm256_castsi256_ps(mask);
+            __m256i k = _mm256_add_epi32(start, tt);
+
+            __m256i j = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int*)columns, k, mask, 4);
+            __m256 w = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), values, k, fmask, 4);
+
+            sx = _mm256_add_ps(sx, _mm256_mul_ps(w, _mm256_mask_i32gather_ps(_mm256_setzero_ps(), x, j, fmask, 4)));
+            sy = _mm256_add_ps(sy, _mm256_mul_ps(w, _mm256_mask_i32gather_ps(_mm256_setzero_ps(), y, j, fmask, 4)));
+            sz = _mm256_add_ps(sz, _mm256_mul_ps(w, _mm256_mask_i32gather_ps(_mm256_setzero_ps(), z, j, fmask, 4)));
+        }
+
+        __m256 d = _mm256_loadu_ps(diagonal + r);
+        _mm256_storeu_ps(lx + r, _mm256_sub_ps(sx, _mm256_mul_ps(d, _mm256_loadu_ps(self_x + r))));
+        _mm256_storeu_ps(ly + r, _mm256_sub_ps(sy, _mm256_mul_ps(d, _mm256_loadu_ps(self_y + r))));
+        _mm256_storeu_ps(lz + r, _mm256_sub_ps(sz, _mm256_mul_ps(d, _mm256_loadu_ps(self_z + r))));
+    }
+
+    SpmvScalar(x, y, z, self_x + r, self_y + r, self_z + r, offsets + r, columns, values, diagonal + r,
+               nb_rows - r, lx + r, ly + r, lz + r);
+}
+
+__attribute__((target("avx2")))
+static void UpdateAVX2(const float* x, const float* y, const float* z,
+                       const float* lx, const float* ly, const float* lz,
+                       float lambda, glm::uint nb_rows,
+                       float* dst_x, float* dst_y, float* dst_z)
+{
+    __m256 l = _mm256_set1_ps(lambda);
+
+    glm::uint i = 0;
+    for(; i + 8 <= nb_rows; i += 8)
+    {
+        _mm256_storeu_ps(dst_x + i, _mm256_add_ps(_mm256_loadu_ps(x + i), _mm256_mul_ps(l, _mm256_loadu_ps(lx + i))));
+        _mm256_storeu_ps(dst_y + i, _mm256_add_ps(_mm256_loadu_ps(y + i), _mm256_mul_ps(l, _mm256_loadu_ps(ly + i))));
+        _mm256_storeu_ps(dst_z + i, _mm256_add_ps(_mm256_loadu_ps(z + i), _mm256_mul_ps(l, _mm256_loadu_ps(lz + i))));
+    }
+
+    UpdateScalar(x + i, y + i, z + i, lx + i, ly + i, lz + i, lambda, nb_rows - i, dst_x + i, dst_y + i, dst_z + i);
+}
+
+/// Same as BoundingBoxSSE4 with 24 floats (8 positions) per block
+__attribute__((target("avx2")))
+static void BoundingBoxAVX2(const float* xyz, glm::uint nb_positions, float* bb_min, float* bb_max)
+{
+    if(nb_positions < 8)
+    {
+        BoundingBoxScalar(xyz, nb_positions, bb_min, bb_max);
+        return;
+    }
+
+    __m256 min0 = _mm256_loadu_ps(xyz), min1 = _mm256_loadu_ps(xyz + 8), min2 = _mm256_loadu_ps(xyz + 16);
+    __m256 max0 = min0, max1 = min1, max2 = min2;
+
+    glm::uint i = 8;
+    for(; i + 8 <= nb_positions; i += 8)
+    {
+        const float* p = xyz + 3*i;
+        __m256 a = _mm256_loadu_ps(p), b = _mm256_loadu_ps(p + 8), c = _mm256_loadu_ps(p + 16);
+        min0 = _mm256_min_ps(min0, a); max0 = _mm256_max_ps(max0, a);
+        min1 = _mm256_min_ps(min1, b); max1 = _mm256_max_ps(max1, b);
+        min2 = _mm256_min_ps(min2, c); max2 = _mm256_max_ps(max2, c);
+    }
+
+    float mins[24], maxs[24];
+    _mm256_storeu_ps(mins, min0); _mm256_storeu_ps(mins + 8, min1); _mm256_storeu_ps(mins + 16, min2);
+    _mm256_storeu_ps(maxs, max0); _mm256_storeu_ps(maxs + 8, max1); _mm256_storeu_ps(maxs + 16, max2);
+
+    for(int c = 0; c < 3; c++)
+    {
+        bb_min[c] = mins[c];
+        bb_max[c] = maxs[c];
+    }
+    for(int k = 3; k < 24; k++)
+    {
+        bb_min[k%3] = glm::min(bb_min[k%3], mins[k]);
+        bb_max[k%3] = glm::max(bb_max[k%3], maxs[k]);
+    }
+    for(; i < nb_positions; i++)
+    {
+        for(int c = 0; c < 3; c++)
+        {
+            bb_min[c] = glm::min(bb_min[c], xyz[3*i+c]);
+            bb_max[c] = glm::max(bb_max[c], xyz[3*i+c]);
+        }
+    }
+}
+
+#endif // MESH_SIMD_X86
+
+
+
+//---------------------------------------------------------
+// Runtime dispatch
+//---------------------------------------------------------
+
+static SmoothingKernels SelectSmoothingKernels()
+{
+    SmoothingKernels scalar = { "scalar", SpmvScalar, UpdateScalar, BoundingBoxScalar };
+
+    const char* forced = getenv("MESH_SIMD");
+    if(forced != NULL && strcmp(forced, "scalar") == 0)
+        return scalar;
+
+#ifdef MESH_SIMD_X86
+    __builtin_cpu_init();
+
+    bool avx2 = __builtin_cpu_supports("avx2");
+    bool sse4 = __builtin_cpu_supports("sse4.1");
+
+    if(avx2 && (forced == NULL || strcmp(forced, "avx2") == 0))
+    {
+        SmoothingKernels kernels = { "avx2", SpmvAVX2, UpdateAVX2, BoundingBoxAVX2 };
+        return kernels;
+    }
+
+    if(sse4)
+    {
+        SmoothingKernels kernels = { "sse4", SpmvScalar, UpdateSSE4, BoundingBoxSSE4 };
+        return kernels;
+    }
+#endif
+
+    return scalar;
+}
+
+const SmoothingKernels& GetSmoothingKernels()
+{
+    static const SmoothingKernels kernels = SelectSmoothingKernels();
+    return kernels;
+}
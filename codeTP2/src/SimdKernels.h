@@ -0,0 +1,104 @@
+#ifndef SIMD_KERNELS_H
+#define SIMD_KERNELS_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <memory>
+#include <new>
+#include <utility>
+
+
+/**
+ * @brief The UninitializedAllocator struct.
+ * Allocator leaving the elements of trivial types uninitialized on resize, so
+ * that the pages of a large array are first touched, hence placed on a NUMA
+ * node, by the threads which fill it rather than by the allocating thread.
+ */
+template <typename T>
+struct UninitializedAllocator : std::allocator<T>
+{
+    template <typename U> struct rebind { typedef UninitializedAllocator<U> other; };
+
+    UninitializedAllocator() {}
+    template <typename U> UninitializedAllocator(const UninitializedAllocator<U>&) {}
+
+    template <typename U> void construct(U* p) { ::new((void*)p) U; }
+    template <typename U, typename... Args> void construct(U* p, Args&&... args) { ::new((void*)p) U(std::forward<Args>(args)...); }
+};
+
+
+/**
+ * @brief The SoAPositions class.
+ * Positions stored as three separate x, y and z arrays (structure of arrays),
+ * each one padded to a multiple of SOA_PADDING floats so that the SIMD
+ * kernels can always work on full registers.
+ * The arrays are first touched by the threads of a static schedule over the
+ * rows, the one which the smoothing parts follow (see MeshPartition).
+ */
+class SoAPositions
+{
+public:
+
+    static const glm::uint SOA_PADDING = 8;     /// Number of floats in an AVX register
+
+    SoAPositions() : m_size(0), m_padded_size(0) {}
+
+    void Resize(const glm::uint size);                                  /// Resizes the three arrays (padding is zero filled)
+    void Load(const std::vector<glm::vec3>& positions);                 /// Resizes and copies interleaved positions in
+    void Store(std::vector<glm::vec3>& positions) const;                /// Copies back to interleaved positions
+    void Load(const std::vector<glm::vec3>& positions, const std::vector<glm::uint>& order);   /// Same, row r receiving positions[order[r]]
+    void Store(std::vector<glm::vec3>& positions, const std::vector<glm::uint>& order) const;  /// Same, positions[order[r]] receiving row r
+
+    glm::uint Size() const       { return m_size; }
+    glm::uint PaddedSize() const { return m_padded_size; }
+
+    float* X()             { return m_data.data(); }
+    float* Y()             { return m_data.data() + m_padded_size; }
+    float* Z()             { return m_data.data() + 2*m_padded_size; }
+    const float* X() const { return m_data.data(); }
+    const float* Y() const { return m_data.data() + m_padded_size; }
+    const float* Z() const { return m_data.data() + 2*m_padded_size; }
+
+private:
+
+    std::vector< float, UninitializedAllocator<float> > m_data;     /// x, y then z arrays, each of m_padded_size floats
+    glm::uint m_size;               /// Number of positions
+    glm::uint m_padded_size;        /// m_size rounded up to a multiple of SOA_PADDING
+};
+
+
+/**
+ * @brief The SmoothingKernels struct.
+ * Set of kernels used by the smoothing engine, in one instruction set.
+ * The kernels work on nb_rows consecutive rows: all the row indexed arrays
+ * are given already offset to the first row, so that the caller can split
+ * the work between threads and blocks. All the implementations perform the
+ * same floating point operations in the same order (no FMA contraction),
+ * hence give bit-identical results.
+ */
+struct SmoothingKernels
+{
+    const char* name;               /// "avx2", "sse4" or "scalar"
+
+    /// Sparse laplacian rows : l_r = sum(values[k] * p[columns[k]], k in [offsets[r], offsets[r+1])) - diagonal[r] * self_r
+    /// (x, y, z) are gathered through columns, (self_x, self_y, self_z) and the outputs are indexed by row
+    void (*spmv)(const float* x, const float* y, const float* z,
+                 const float* self_x, const float* self_y, const float* self_z,
+                 const glm::uint* offsets, const glm::uint* columns, const float* values, const float* diagonal,
+                 glm::uint nb_rows, float* lx, float* ly, float* lz);
+
+    /// Update step : dst_r = p_r + lambda * l_r
+    void (*update)(const float* x, const float* y, const float* z,
+                   const float* lx, const float* ly, const float* lz,
+                   float lambda, glm::uint nb_rows,
+                   float* dst_x, float* dst_y, float* dst_z);
+
+    /// Bounding box of nb_positions interleaved (x, y, z) positions (empty box at the origin if there are none)
+    void (*bounding_box)(const float* xyz, glm::uint nb_positions, float* bb_min, float* bb_max);
+};
+
+
+const SmoothingKernels& GetSmoothingKernels();  /// Best kernels for this CPU (can be forced with the MESH_SIMD environment variable: avx2, sse4 or scalar)
+
+#endif // SIMD_KERNELS_H
@@ -0,0 +1,202 @@
+#include <SmoothingWorker.h>
+#include <Trace.h>
+
+using namespace glm;
+using namespace std;
+
+const glm::uint SmoothingWorker::INDEX_MASK;
+const glm::uint SmoothingWorker::FRESH;
+
+
+SmoothingWorker::SmoothingWorker(const MeshHE &mesh, const size_t history_budget) :
+    m_mesh(mesh),
+    m_history(history_budget),
+    m_modified(false),
+    m_operation(IDLE),
+    m_lambda(0.5f),
+    m_mu(-0.53f),
+    m_nb_noise_requests(0),
+    m_history_requests(0),
+    m_stop(false),
+    m_middle(1),
+    m_back(0),
+    m_front(2),
+    m_nb_iterations(0),
+    m_thread(&SmoothingWorker::Run, this)
+{
+}
+
+SmoothingWorker::~SmoothingWorker()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+}
+
+void SmoothingWorker::SetOperation(const Operation operation, const float lambda, const float mu)
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        if(operation == m_operation && lambda == m_lambda && mu == m_mu)
+            return;
+
+        m_operation = operation;
+        m_lambda = lambda;
+        m_mu = mu;
+    }
+    m_wake.notify_one();
+}
+
+void SmoothingWorker::RequestNoise()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_nb_noise_requests++;
+    }
+    m_wake.notify_one();
+}
+
+void SmoothingWorker::RequestUndo()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_history_requests--;
+    }
+    m_wake.notify_one();
+}
+
+void SmoothingWorker::RequestRedo()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_history_requests++;
+    }
+    m_wake.notify_one();
+}
+
+/**
+ * @brief SmoothingWorker::Fetch
+ * The arrays are swapped, not copied: the previous arrays of mesh go back to
+ * the worker as storage for a next snapshot.
+ */
+bool SmoothingWorker::Fetch(MeshHE &mesh)
+{
+    if(!(m_middle.load(memory_order_acquire) & FRESH))
+        return false;
+
+    m_front = m_middle.exchange(m_front, memory_order_acq_rel) & INDEX_MASK;
+
+    Snapshot& snapshot = m_snapshots[m_front];
+    mesh.m_positions.swap(snapshot.positions);
+    mesh.m_normals.swap(snapshot.normals);
+    return true;
+}
+
+void SmoothingWorker::Publish()
+{
+    Snapshot& snapshot = m_snapshots[m_back];
+    snapshot.positions = m_mesh.m_positions;
+    snapshot.normals = m_mesh.m_normals;
+
+    m_back = m_middle.exchange(m_back | FRESH, memory_order_acq_rel) & INDEX_MASK;
+    m_nb_iterations++;
+}
+
+/**
+ * @brief SmoothingWorker::Run
+ * The pending changes are recorded when the worker has nothing else to do,
+ * before noise is added and before an undo / redo, and each noise is recorded
+ * as soon as it is added, so that each of them is its own step.
+ */
+void SmoothingWorker::Run()
+{
+    m_history.Reset(m_mesh);
+
+    while(true)
+    {
+        Operation operation;
+        float lambda, mu;
+        glm::uint nb_noise = 0;
+        int history_requests;
+
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_wake.wait(lock, [this]() { return m_stop || m_operation != IDLE || m_nb_noise_requests > 0 || m_history_requests != 0 || m_modified; });
+            if(m_stop)
+                return;
+
+            operation = m_operation;
+            lambda = m_lambda;
+            mu = m_mu;
+            history_requests = m_history_requests;
+            m_history_requests = 0;
+            if(history_requests == 0)       // Noise requested with an undo is added after it, on the next loop
+            {
+                nb_noise = m_nb_noise_requests;
+                m_nb_noise_requests = 0;
+            }
+        }
+
+        if(m_modified && (operation == IDLE || nb_noise > 0 || history_requests != 0))
+        {
+            m_history.Record(m_mesh);
+            m_modified = false;
+        }
+
+        if(history_requests != 0)
+        {
+            bool changed = false;
+            for(; history_requests < 0; history_requests++)
+                changed |= m_history.Undo(m_mesh);
+            for(; history_requests > 0; history_requests--)
+                changed |= m_history.Redo(m_mesh);
+
+            if(changed)
+            {
+                m_mesh.ComputeNormals();
+                Publish();
+            }
+            continue;
+        }
+
+        if(operation == IDLE && nb_noise == 0)
+            continue;
+
+        TRACE_ZONE("worker iteration");
+
+        // Each noise is its own step, apart from the smoothing that follows it
+        for(glm::uint i = 0; i < nb_noise; i++)
+        {
+            m_mesh.NoiseNotBorder();
+            m_mesh.Normalize();
+            m_history.Record(m_mesh);
+        }
+
+        if(operation == IDLE)
+        {
+            m_mesh.ComputeNormals();
+            Publish();
+            continue;
+        }
+
+        switch(operation)
+        {
+        case LAPLACIAN:
+            m_mesh.LaplacianSmooth(lambda, 1);
+            break;
+        case TAUBIN:
+            m_mesh.TaubinSmooth(lambda, mu, 1);
+            break;
+        case IDLE:
+            break;
+        }
+
+        m_mesh.Normalize();
+        m_mesh.ComputeNormals();
+        Publish();
+        m_modified = true;
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef SMOOTHING_WORKER_H
+#define SMOOTHING_WORKER_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "MeshHE.h"
+#include "PositionHistory.h"
+
+
+/**
+ * @brief The SmoothingWorker class.
+ * Smooths a working copy of a mesh in a background thread, so that the
+ * render loop never waits for the smoothing.
+ * While an operation is set, the worker repeats it (one smoothing iteration,
+ * Normalize, ComputeNormals) and publishes the positions and normals after
+ * each iteration through a lock-free triple buffer: the worker fills the
+ * back slot and exchanges it with the middle one, the render loop exchanges
+ * its front slot with the middle one when a newer snapshot is there. Neither
+ * side ever waits for the other, and the render loop always gets the latest
+ * snapshot.
+ * The changes made by the worker are recorded in a PositionHistory: one
+ * undo step per noise and per run of an operation (until it is set back to
+ * IDLE or noise is added). Undo / redo requests are applied by the thread
+ * like the other commands, and only recompute the normals of the vertices
+ * they move before publishing.
+ */
+class SmoothingWorker
+{
+public:
+
+    enum Operation { IDLE, LAPLACIAN, TAUBIN };
+
+    SmoothingWorker(const MeshHE& mesh, const size_t history_budget = PositionHistory::DEFAULT_MEMORY_BUDGET);     /// Copies the mesh and starts the thread
+    ~SmoothingWorker();                         /// Stops the thread (after the current iteration)
+
+    void SetOperation(const Operation operation, const float lambda = 0.5, const float mu = -0.53);    /// Operation repeated until another one is set (IDLE pauses the worker)
+    void RequestNoise();                                                                                /// Adds noise to the interior vertices once, before the next iteration
+    void RequestUndo();                                                                                 /// Undoes the last recorded change (a running operation is recorded first)
+    void RequestRedo();
+
+    bool Fetch(MeshHE& mesh);                   /// Swaps the latest snapshot into the positions and normals of mesh, returns false if there is no new one
+    glm::uint NbIterations() const { return m_nb_iterations.load(); }      /// Number of snapshots published so far
+
+private:
+
+    SmoothingWorker(const SmoothingWorker&);    /// Not copyable
+    SmoothingWorker& operator=(const SmoothingWorker&);
+
+    /// Positions and normals published after an iteration
+    struct Snapshot
+    {
+        std::vector<glm::vec3> positions;
+        std::vector<glm::vec3> normals;
+    };
+
+    static const glm::uint INDEX_MASK = 3;      /// Slot index in m_middle
+    static const glm::uint FRESH = 4;           /// Set in m_middle when the middle slot has not been fetched yet
+
+    void Run();                                 /// Thread loop
+    void Publish();                             /// Copies the working mesh in the back slot and makes it the middle one
+
+    MeshHE m_mesh;                              /// Working copy, only used by the thread
+    PositionHistory m_history;                  /// Only used by the thread
+    bool m_modified;                            /// m_mesh changed since the last recorded step
+
+    // Commands (read by the thread once per iteration)
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    Operation m_operation;
+    float m_lambda;
+    float m_mu;
+    glm::uint m_nb_noise_requests;
+    int m_history_requests;                     /// Redo requests minus undo requests
+    bool m_stop;
+
+    // Triple buffer
+    Snapshot m_snapshots[3];
+    std::atomic<glm::uint> m_middle;            /// Index of the middle slot, and the FRESH flag
+    glm::uint m_back;                           /// Slot written by the thread
+    glm::uint m_front;                          /// Slot read by Fetch
+    std::atomic<glm::uint> m_nb_iterations;
+
+    std::thread m_thread;                       /// Started last, once everything above is initialized
+};
+
+#endif // SMOOTHING_WORKER_H
@@ -0,0 +1,182 @@
+#include <Trace.h>
+
+#ifdef MESH_TRACE
+
+#include <iostream>
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+using namespace glm;
+using namespace std;
+
+const glm::uint Trace::BUFFER_SIZE;
+
+
+//***************
+// Buffers
+
+struct TraceEvent
+{
+    const char* name;
+    glm::int64 begin;           /// Nanoseconds since the origin
+    glm::int64 duration;        /// Nanoseconds, negative for a counter
+    double value;               /// Value of a counter
+};
+
+/// Ring buffer of one thread: only this thread writes in it
+struct TraceBuffer
+{
+    TraceBuffer(glm::uint index) : events(Trace::BUFFER_SIZE), nb_events(0), thread_index(index) {}
+
+    void Push(const TraceEvent& e)
+    {
+        glm::uint64 n = nb_events.load(memory_order_relaxed);
+        events[n % Trace::BUFFER_SIZE] = e;
+        nb_events.store(n + 1, memory_order_release);
+    }
+
+    vector<TraceEvent> events;
+    atomic<glm::uint64> nb_events;          /// Number of events pushed since the last Clear (the oldest ones are overwritten)
+    glm::uint thread_index;
+};
+
+/// Buffers of all the threads which recorded something, kept after the threads end
+static mutex& RegistryMutex()
+{
+    static mutex m;
+    return m;
+}
+
+static vector< unique_ptr<TraceBuffer> >& Registry()
+{
+    static vector< unique_ptr<TraceBuffer> > buffers;
+    return buffers;
+}
+
+static thread_local TraceBuffer* t_buffer = NULL;
+
+static TraceBuffer& CurrentBuffer()
+{
+    if(t_buffer == NULL)
+    {
+        lock_guard<mutex> lock(RegistryMutex());
+        vector< unique_ptr<TraceBuffer> >& buffers = Registry();
+        buffers.push_back(unique_ptr<TraceBuffer>(new TraceBuffer(buffers.size())));
+        t_buffer = buffers.back().get();
+    }
+    return *t_buffer;
+}
+
+
+//***************
+// Recording
+
+glm::int64 Trace::Now()
+{
+    static const chrono::steady_clock::time_point origin = chrono::steady_clock::now();
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - origin).count();
+}
+
+void Trace::Zone(const char* name, glm::int64 begin, glm::int64 end)
+{
+    TraceEvent e = { name, begin, end - begin, 0.0 };
+    CurrentBuffer().Push(e);
+}
+
+void Trace::Counter(const char* name, double value)
+{
+    TraceEvent e = { name, Now(), -1, value };
+    CurrentBuffer().Push(e);
+}
+
+void Trace::Clear()
+{
+    lock_guard<mutex> lock(RegistryMutex());
+    vector< unique_ptr<TraceBuffer> >& buffers = Registry();
+    for(size_t i = 0; i < buffers.size(); i++)
+        buffers[i]->nb_events.store(0, memory_order_release);
+}
+
+
+//***************
+// Export
+
+static void WriteName(FILE* file, const char* name)
+{
+    fputc('"', file);
+    for(const char* c = name; *c != '\0'; c++)
+    {
+        if(*c == '"' || *c == '\\')
+            fputc('\\', file);
+        if(static_cast<unsigned char>(*c) >= 0x20)
+            fputc(*c, file);
+    }
+    fputc('"', file);
+}
+
+/**
+ * @brief Trace::WriteChrome
+ * Writes the events still in the buffers as a Chrome trace event JSON file:
+ * zones are complete ("X") events and counters "C" events, on one track per
+ * thread, with timestamps in microseconds. Counter values which are not
+ * finite (inf or NaN) are skipped.
+ * @return false if the file could not be written
+ */
+bool Trace::WriteChrome(const char* filename)
+{
+    FILE *file;
+
+    if((file=fopen(filename,"w"))==NULL)
+    {
+        std::cerr << "Unable to open : " << filename << std::endl;
+        return false;
+    }
+
+    lock_guard<mutex> lock(RegistryMutex());
+    vector< unique_ptr<TraceBuffer> >& buffers = Registry();
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+
+    for(size_t i = 0; i < buffers.size(); i++)
+    {
+        const TraceBuffer& buffer = *buffers[i];
+
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+                first ? "" : ",\n", buffer.thread_index, buffer.thread_index);
+        first = false;
+
+        glm::uint64 nb_events = buffer.nb_events.load(memory_order_acquire);
+        glm::uint64 begin = nb_events > BUFFER_SIZE ? nb_events - BUFFER_SIZE : 0;
+
+        for(glm::uint64 n = begin; n < nb_events; n++)
+        {
+            const TraceEvent& e = buffer.events[n % BUFFER_SIZE];
+            if(e.duration < 0 && !std::isfinite(e.value))      // not representable in JSON
+                continue;
+
+            fprintf(file, ",\n{\"name\":");
+            WriteName(file, e.name);
+            if(e.duration >= 0)
+            {
+                fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                        buffer.thread_index, e.begin * 1e-3, e.duration * 1e-3);
+            }
+            else
+            {
+                fprintf(file, ",\"ph\":\"C\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"args\":{\"value\":%.9g}}",
+                        buffer.thread_index, e.begin * 1e-3, e.value);
+            }
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
+
+#endif // MESH_TRACE
@@ -0,0 +1,78 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/**
+ * Lightweight tracing of the hot paths.
+ * Compiled only when MESH_TRACE is defined (cmake -DENABLE_TRACE=ON),
+ * the macros expand to nothing otherwise.
+ *
+ *   TRACE_ZONE("name")            times the enclosing scope
+ *   TRACE_COUNTER("name", value)  records the value of a counter
+ *   TRACE_WRITE("file.json")      writes the recorded events
+ *
+ * Each thread records its events in its own ring buffer (no lock, the oldest
+ * events are overwritten), the buffers are merged in the Chrome trace event
+ * format, which can be opened in chrome://tracing or https://ui.perfetto.dev.
+ * The names must be string literals (only their address is recorded).
+ */
+
+#ifdef MESH_TRACE
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp> // int64
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(trace_zone_, __LINE__)(name)
+#define TRACE_COUNTER(name, value) Trace::Counter(name, double(value))
+#define TRACE_WRITE(filename) Trace::WriteChrome(filename)
+
+
+/**
+ * @brief The Trace class.
+ * Per thread event buffers and their export.
+ */
+class Trace
+{
+public:
+
+    static const glm::uint BUFFER_SIZE = 1 << 16;      /// Number of events kept per thread
+
+    static glm::int64 Now();                                                    /// Nanoseconds since the first traced event
+    static void Zone(const char* name, glm::int64 begin, glm::int64 end);       /// Records a zone of the current thread
+    static void Counter(const char* name, double value);                        /// Records the value of a counter
+    static bool WriteChrome(const char* filename);                              /// Writes the events of all the threads (to call when the worker threads are idle)
+    static void Clear();                                                        /// Drops the recorded events
+};
+
+
+/**
+ * @brief The TraceZone class.
+ * Records the scope it lives in as a zone of the current thread.
+ */
+class TraceZone
+{
+public:
+
+    explicit TraceZone(const char* name) : m_name(name), m_begin(Trace::Now()) {}
+    ~TraceZone() { Trace::Zone(m_name, m_begin, Trace::Now()); }
+
+private:
+
+    TraceZone(const TraceZone&);                /// Not copyable
+    TraceZone& operator=(const TraceZone&);
+
+    const char* m_name;
+    glm::int64 m_begin;
+};
+
+#else
+
+#define TRACE_ZONE(name)
+#define TRACE_COUNTER(name, value)
+#define TRACE_WRITE(filename) (false)
+
+#endif // MESH_TRACE
+
+#endif // TRACE_H
@@ -2,6 +2,7 @@
 #include <iomanip>
 #include <vector>
 #include <string>
+#include <cstring>
 
 #include <shader.h> // Help to load shaders from files
 
@@ -17,7 +18,11 @@
 #include "GLFW_define.h"
 #include "Mesh.h"
 #include "MeshHE.h"
+#include "MeshCache.h"
+#include "MeshReorder.h"
 #include "Object.h"
+#include "SmoothingWorker.h"
+#include "Trace.h"
 
 
 // Window size :
@@ -30,11 +35,35 @@ using namespace std;
 
 void view_control(mat4& view_matrix, float dx);
 
-int main()
+int main(int argc, char** argv)
 {
 
     cout << "Starting program..." << endl;
 
+    // Options : --reorder morton|rcm renumbers the vertices (and the faces) for cache locality after loading,
+    //           --compact draws from a compact vertex buffer (16 bits positions, octahedral normals) decoded by the vertex shader
+    VertexOrdering ordering = KEEP_VERTEX_ORDER;
+    bool compact_vertices = false;
+
+    for(int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if(arg == "--reorder" && i+1 < argc && (strcmp(argv[i+1], "morton") == 0 || strcmp(argv[i+1], "rcm") == 0))
+        {
+            ordering = (strcmp(argv[i+1], "morton") == 0) ? MORTON_VERTEX_ORDER : RCM_VERTEX_ORDER;
+            i++;
+        }
+        else if(arg == "--compact")
+        {
+            compact_vertices = true;
+        }
+        else
+        {
+            cerr << "Usage : " << argv[0] << " [--reorder morton|rcm] [--compact]" << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
     //==================================================
     //============= Creation de la fenetre =============
     //==================================================
@@ -102,7 +131,7 @@ int main()
     //-------------------------------------------------
     // Shader program initialization
 
-    GLuint programID = LoadShaders("../shader/vertex.glsl", "../shader/fragment.glsl");
+    GLuint programID = LoadShaders(compact_vertices ? "../shader/vertex_compact.glsl" : "../shader/vertex.glsl", "../shader/fragment.glsl");
     cout << "programID = " << programID << endl;
 
 
@@ -111,34 +140,41 @@ int main()
 
     // Mesh creation
 
-//    Mesh m("../models/armadillo.off");
-  //  Mesh m("../models/buddha.off");
-//    Mesh m("../models/bunny.off");
-    //  Mesh m("../models/ceasar.off");
-    // Mesh m("../models/happy.off");
-//     Mesh m("../models/cube_closed.off");
-//    Mesh m("../models/cylindre.off");
-//   Mesh m("../models/dragon.off");
-//    Mesh m("../models/half_cylindre.off");
-  //  Mesh m("../models/max.off");
-//    Mesh m("../models/pipes_round.off");
-//    Mesh m("../models/pipes_squared.off");
-//    Mesh m("../models/sphere.off");
-//    Mesh m("../models/sphere_piece.off");
-   Mesh m("../models/test.off");
-// Mesh m("../models/tetrahedron.off");
-//    Mesh m("../models/tetrahedron_2.off");
-    // Mesh m("../models/thing_rounded.off");
-//    Mesh m("../models/thing_squared.off");
-  //  Mesh m("../models/triceratops.off");
-
-    m.normalize();
-    m.ComputeNormals();
-
-    cout << "half edge conversion... " << endl;
-
-    // Half edge conversion
-    MeshHE m_he(m);
+//    const char* model_filename = "../models/armadillo.off";
+  //  const char* model_filename = "../models/buddha.off";
+//    const char* model_filename = "../models/bunny.off";
+    //  const char* model_filename = "../models/ceasar.off";
+    // const char* model_filename = "../models/happy.off";
+//     const char* model_filename = "../models/cube_closed.off";
+//    const char* model_filename = "../models/cylindre.off";
+//   const char* model_filename = "../models/dragon.off";
+//    const char* model_filename = "../models/half_cylindre.off";
+  //  const char* model_filename = "../models/max.off";
+//    const char* model_filename = "../models/pipes_round.off";
+//    const char* model_filename = "../models/pipes_squared.off";
+//    const char* model_filename = "../models/sphere.off";
+//    const char* model_filename = "../models/sphere_piece.off";
+   const char* model_filename = "../models/test.off";
+// const char* model_filename = "../models/tetrahedron.off";
+//    const char* model_filename = "../models/tetrahedron_2.off";
+    // const char* model_filename = "../models/thing_rounded.off";
+//    const char* model_filename = "../models/thing_squared.off";
+  //  const char* model_filename = "../models/triceratops.off";
+
+    // Normalized mesh with normals and half edges, from the binary cache when it is up to date
+    MeshHE m_he;
+    if(!MeshCache::Load(model_filename, m_he))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    // Cache friendly numbering of the vertices (smoothing) and faces (drawing), if asked
+    if(ordering != KEEP_VERTEX_ORDER)
+    {
+        float acmr = MeshReorder::ComputeACMR(m_he);
+        MeshReorder::Reorder(m_he, ordering);
+        cout << "ACMR : " << acmr << " -> " << MeshReorder::ComputeACMR(m_he) << endl;
+    }
 
 
     /// TODO : test your neighborhood and laplacian computation here.
@@ -152,11 +188,14 @@ int main()
 
 
     // Object Generation
-    Object o;
+    Object o(compact_vertices);
     o.GenBuffers();
     o.SetMesh(&m_he);
     o.SetShader(programID);
 
+    // Smoothing thread, working on its own copy of the mesh
+    SmoothingWorker worker(m_he);
+
 
 
     //-------------------------------------------------
@@ -189,8 +228,12 @@ int main()
     double prec_time = init_time;
     double cur_time = init_time;
     double speed = 2.0;
+    bool undo_was_pressed = false;
+    bool redo_was_pressed = false;
 
     do{
+        TRACE_ZONE("frame");
+
         // Clearing Viewport
         glClear( GL_COLOR_BUFFER_BIT );
         glClear( GL_DEPTH_BUFFER_BIT );
@@ -206,35 +249,45 @@ int main()
 
         view_control(view_matrix, speed * delta_time);
 
-		// Smoothing control: press the space bar to see the effect of your smoothing in real time !
+		// Smoothing control: hold the space bar (Taubin) or the L key (laplacian) to see the effect of your smoothing in real time !
+        // The worker smooths continuously while the key is held, the frame only uploads its latest result
         if (glfwGetKey( GLFW_KEY_SPACE ) == GLFW_PRESS)
         {
-            o.m_mesh->TaubinSmooth(0.5,-0.53,1);
-            o.m_mesh->Normalize();
-            o.m_mesh->ComputeNormals();
-            o.UpdateGeometryBuffers();
+            worker.SetOperation(SmoothingWorker::TAUBIN, 0.5, -0.53);
+        }
+        else if (glfwGetKey( GLFW_KEY_L ) == GLFW_PRESS)
+        {
+            worker.SetOperation(SmoothingWorker::LAPLACIAN, 0.5);
+        }
+        else
+        {
+            worker.SetOperation(SmoothingWorker::IDLE);
+        }
 
+        // Noising control: press the N key to add noise !
+        if (glfwGetKey( GLFW_KEY_N ) == GLFW_PRESS)
+        {
+            worker.RequestNoise();
         }
 
-        // Smoothing control: press the space bar to see the effect of your smoothing in real time !
-        if (glfwGetKey( GLFW_KEY_L ) == GLFW_PRESS)
+        // History control: press the U key to undo the last smoothing or noise, the Y key to redo it (once per press)
+        bool undo_pressed = (glfwGetKey( GLFW_KEY_U ) == GLFW_PRESS);
+        if (undo_pressed && !undo_was_pressed)
         {
-            o.m_mesh->LaplacianSmooth(0.5,1);
-            o.m_mesh->Normalize();
-            o.m_mesh->ComputeNormals();
-            o.UpdateGeometryBuffers();
+            worker.RequestUndo();
+        }
+        undo_was_pressed = undo_pressed;
 
+        bool redo_pressed = (glfwGetKey( GLFW_KEY_Y ) == GLFW_PRESS);
+        if (redo_pressed && !redo_was_pressed)
+        {
+            worker.RequestRedo();
         }
+        redo_was_pressed = redo_pressed;
 
-        // Noising control: press the N key to add noise !
-        if (glfwGetKey( GLFW_KEY_N ) == GLFW_PRESS)
+        if (worker.Fetch(m_he))
         {
-            //o.m_mesh->Noise();
-            o.m_mesh->NoiseNotBorder();
-            o.m_mesh->Normalize();
-            o.m_mesh->ComputeNormals();
             o.UpdateGeometryBuffers();
-
         }
 
 
@@ -254,6 +307,11 @@ int main()
         //================== Stats Display =================
         //==================================================
 
+        if (delta_time > 0.0f)
+        {
+            TRACE_COUNTER("fps", 1.0 / delta_time);
+        }
+
         cout.precision(2);
         cout<< fixed  << "FPS: " << 1.0 / delta_time << "\t---\tElapsed time: " << setw(8) << cur_time << "\ts\r" << flush;
 
@@ -266,6 +324,9 @@ int main()
 
     cout << endl << endl << "Main loop ended." << endl;
 
+    if(TRACE_WRITE("smoothing_trace.json"))
+        cout << "Trace written in smoothing_trace.json" << endl;
+
 
     cout << "Program ended." << endl;
 
@@ -0,0 +1,465 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <new>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+#include "MeshHE.h"
+#include "MeshReorder.h"
+#include "SimdKernels.h"
+
+using namespace glm;
+using namespace std;
+
+
+/**
+ * bench : timings of the hot paths of the mesh processing, on every OFF file
+ * of a directory (../models by default).
+ * Each stage is repeated and reported with its min / median / p99 time, its
+ * throughput in vertices per second and the number of bytes it allocates.
+ * The results are written as JSON, and can be compared with a previous run
+ * (--baseline): the program then fails if the median time of a stage grew
+ * by more than the threshold.
+ */
+
+
+//***************
+// Allocation counting
+
+static atomic<unsigned long long> g_allocated_bytes(0);    /// Bytes allocated since the start of the program
+static atomic<unsigned long long> g_nb_allocations(0);
+
+void* operator new(size_t size)
+{
+    g_allocated_bytes += size;
+    g_nb_allocations++;
+    void* p = malloc(size ? size : 1);
+    if(p == NULL)
+        throw bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept                { free(p); }
+void operator delete[](void* p) noexcept              { free(p); }
+void operator delete(void* p, size_t) noexcept        { free(p); }
+void operator delete[](void* p, size_t) noexcept      { free(p); }
+
+
+//***************
+// Measures
+
+/// Timings of one stage on one model
+struct StageResult
+{
+    string model;
+    string stage;
+    glm::uint nb_vertices;
+    double min_ms;
+    double median_ms;
+    double p99_ms;
+    double vertices_per_second;        /// From the median time
+    unsigned long long bytes;           /// Allocated by one repetition
+    unsigned long long allocations;
+};
+
+/**
+ * @brief Runs nb_reps times setup() (not measured) then run() (measured).
+ */
+template <typename Setup, typename Run>
+static StageResult Measure(const string& model, const string& stage, const glm::uint nb_vertices,
+                           const int nb_reps, Setup setup, Run run)
+{
+    vector<double> times;
+    unsigned long long bytes = 0, allocations = 0;
+
+    for(int r = 0; r < nb_reps; r++)
+    {
+        setup();
+
+        unsigned long long bytes_start = g_allocated_bytes;
+        unsigned long long allocations_start = g_nb_allocations;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+        run();
+
+        times.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+        bytes = g_allocated_bytes - bytes_start;
+        allocations = g_nb_allocations - allocations_start;
+    }
+
+    sort(times.begin(), times.end());
+
+    StageResult result;
+    result.model = model;
+    result.stage = stage;
+    result.nb_vertices = nb_vertices;
+    result.min_ms = times.front();
+    result.median_ms = times[times.size() / 2];
+    result.p99_ms = times[std::min(times.size() - 1, size_t(ceil(0.99 * times.size())) - 1)];
+    result.vertices_per_second = (result.median_ms > 0.0) ? nb_vertices / (result.median_ms * 1e-3) : 0.0;
+    result.bytes = bytes;
+    result.allocations = allocations;
+    return result;
+}
+
+static void NoSetup() {}
+
+/// Runs all the stages on one model
+static void BenchModel(const string& filename, const int nb_reps, const string& tmp_obj, vector<StageResult>& results)
+{
+    string model = filesystem::path(filename).filename().string();
+
+    Mesh mesh;
+    if(!mesh.LoadOFF(filename.c_str()))
+        return;
+    mesh.normalize();
+    glm::uint n = mesh.vertices.size();
+
+    cerr << model << " (" << n << " vertices, " << mesh.faces.size() / 3 << " faces)" << endl;
+
+    Mesh parsed;
+    results.push_back(Measure(model, "parse", n, nb_reps, NoSetup, [&]() {
+        parsed.LoadOFF(filename.c_str());
+    }));
+
+    MeshHE he;
+    results.push_back(Measure(model, "build", n, nb_reps, [&]() { he = MeshHE(); }, [&]() {
+        he = MeshHE(mesh);
+    }));
+
+    MeshHE copy;
+    results.push_back(Measure(model, "copy", n, nb_reps, [&]() { copy = MeshHE(); }, [&]() {
+        copy = he;
+    }));
+
+    MeshSnapshot snapshot = he.TakeSnapshot();
+    results.push_back(Measure(model, "snapshot", n, nb_reps, NoSetup, [&]() {
+        snapshot = he.TakeSnapshot();
+    }));
+
+    results.push_back(Measure(model, "restore_snapshot", n, nb_reps, NoSetup, [&]() {
+        copy.RestoreSnapshot(snapshot);
+    }));
+
+    size_t checksum = 0;
+    results.push_back(Measure(model, "neighbors", n, nb_reps, NoSetup, [&]() {
+        for(glm::uint v = 0; v < n; v++)
+            checksum += he.GetVertexNeighbors(Vertex(v)).size();
+    }));
+
+    vec3 sum(0.0f);
+    results.push_back(Measure(model, "laplacian", n, nb_reps, NoSetup, [&]() {
+        for(glm::uint v = 0; v < n; v++)
+            sum += he.Laplacian(Vertex(v));
+    }));
+
+    results.push_back(Measure(model, "laplacian_smooth", n, nb_reps, NoSetup, [&]() {
+        he.LaplacianSmooth(0.5f, 1);
+    }));
+
+    results.push_back(Measure(model, "taubin_smooth", n, nb_reps, NoSetup, [&]() {
+        he.TaubinSmooth(0.33f, -0.34f, 1);
+    }));
+
+    results.push_back(Measure(model, "compute_normals", n, nb_reps, [&]() { he.MarkAllMoved(); }, [&]() {
+        he.ComputeNormals();
+    }));
+
+    // Same smoothing and normals once the vertices and faces are renumbered
+    MeshHE reordered;
+    results.push_back(Measure(model, "reorder", n, nb_reps, [&]() { reordered = he; }, [&]() {
+        MeshReorder::Reorder(reordered, MORTON_VERTEX_ORDER);
+    }));
+
+    cerr << "  ACMR " << MeshReorder::ComputeACMR(he) << " -> " << MeshReorder::ComputeACMR(reordered) << endl;
+
+    results.push_back(Measure(model, "laplacian_smooth_reordered", n, nb_reps, NoSetup, [&]() {
+        reordered.LaplacianSmooth(0.5f, 1);
+    }));
+
+    results.push_back(Measure(model, "compute_normals_reordered", n, nb_reps, [&]() { reordered.MarkAllMoved(); }, [&]() {
+        reordered.ComputeNormals();
+    }));
+
+    // Geometric weights: full assembly, then smoothing steps which only refresh them around the moved vertices
+    results.push_back(Measure(model, "cotangent_weights", n, nb_reps, NoSetup, [&]() {
+        reordered.SetLaplacianWeights(COTANGENT_WEIGHTS);
+    }));
+
+    results.push_back(Measure(model, "cotangent_smooth_reordered", n, nb_reps, NoSetup, [&]() {
+        reordered.LaplacianSmooth(0.5f, 1);
+    }));
+
+    reordered.SetLaplacianWeights(MEAN_VALUE_WEIGHTS);
+    results.push_back(Measure(model, "mean_value_smooth_reordered", n, nb_reps, NoSetup, [&]() {
+        reordered.LaplacianSmooth(0.5f, 1);
+    }));
+
+    Mesh welded;
+    results.push_back(Measure(model, "remove_double", n, nb_reps, [&]() { welded = mesh; }, [&]() {
+        welded.RemoveDouble();
+    }));
+
+    results.push_back(Measure(model, "write_obj", n, nb_reps, NoSetup, [&]() {
+        he.write_obj(tmp_obj.c_str());
+    }));
+
+    remove(tmp_obj.c_str());
+
+    // Keeps the loops above from being optimized out
+    if(checksum == 0 && sum.x == 1234.5f)
+        cout << " " << endl;
+}
+
+
+//***************
+// JSON
+
+static string BuildType()
+{
+#ifdef __OPTIMIZE__
+    return "optimized";
+#else
+    return "debug";
+#endif
+}
+
+static void WriteJSON(ostream& out, const vector<StageResult>& results, const int nb_reps)
+{
+    int nb_threads = 1;
+#ifdef _OPENMP
+    nb_threads = omp_get_max_threads();
+#endif
+
+    out << "{" << endl;
+    out << "  \"version\": 1," << endl;
+    out << "  \"build\": \"" << BuildType() << "\"," << endl;
+    out << "  \"simd\": \"" << GetSmoothingKernels().name << "\"," << endl;
+    out << "  \"threads\": " << nb_threads << "," << endl;
+    out << "  \"repetitions\": " << nb_reps << "," << endl;
+    out << "  \"results\": [" << endl;
+
+    // One result per line, which is what ReadJSON expects
+    for(size_t i = 0; i < results.size(); i++)
+    {
+        const StageResult& r = results[i];
+        out << "    {\"model\": \"" << r.model << "\", \"stage\": \"" << r.stage << "\""
+            << ", \"vertices\": " << r.nb_vertices
+            << setprecision(6) << fixed
+            << ", \"min_ms\": " << r.min_ms
+            << ", \"median_ms\": " << r.median_ms
+            << ", \"p99_ms\": " << r.p99_ms
+            << setprecision(0)
+            << ", \"vertices_per_second\": " << r.vertices_per_second
+            << ", \"bytes_allocated\": " << r.bytes
+            << ", \"allocations\": " << r.allocations << "}"
+            << (i + 1 < results.size() ? "," : "") << endl;
+        out.unsetf(ios::floatfield);
+    }
+
+    out << "  ]" << endl;
+    out << "}" << endl;
+}
+
+/// Value of "key": in a line of the results array
+static bool FindField(const string& line, const string& key, string& value)
+{
+    size_t p = line.find("\"" + key + "\":");
+    if(p == string::npos)
+        return false;
+
+    p += key.size() + 3;
+    while(p < line.size() && line[p] == ' ')
+        p++;
+
+    if(p < line.size() && line[p] == '"')
+    {
+        size_t end = line.find('"', p + 1);
+        if(end == string::npos)
+            return false;
+        value = line.substr(p + 1, end - p - 1);
+    }
+    else
+    {
+        size_t end = line.find_first_of(",}", p);
+        value = line.substr(p, end - p);
+    }
+    return true;
+}
+
+/// Reads the median times of a file written by WriteJSON, indexed by "model/stage"
+static bool ReadJSON(const char* filename, map<string, double>& medians, string& build)
+{
+    ifstream in(filename);
+    if(!in)
+        return false;
+
+    string line;
+    while(getline(in, line))
+    {
+        string model, stage, median;
+        if(FindField(line, "model", model) && FindField(line, "stage", stage) && FindField(line, "median_ms", median))
+            medians[model + "/" + stage] = atof(median.c_str());
+        else
+            FindField(line, "build", build);
+    }
+    return true;
+}
+
+
+//***************
+// Main
+
+static void PrintUsage(const char* program)
+{
+    cerr << "Usage : " << program << " [options] [files.off...]" << endl
+         << "  --models DIR         benchmarks every .off file of DIR (default ../models, when no file is given)" << endl
+         << "  --reps N             repetitions of each stage (default 10)" << endl
+         << "  --json FILE          writes the results to FILE (default: standard output)" << endl
+         << "  --baseline FILE      compares with the results of a previous run" << endl
+         << "  --threshold T        relative slowdown of a median time counted as a regression (default 0.10)" << endl;
+}
+
+int main(int argc, char** argv)
+{
+    string models_dir = "../models";
+    vector<string> files;
+    int nb_reps = 10;
+    const char* json_filename = NULL;
+    const char* baseline_filename = NULL;
+    double threshold = 0.10;
+
+    for(int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if(arg == "--models" && has_value)
+            models_dir = argv[++i];
+        else if(arg == "--reps" && has_value)
+            nb_reps = atoi(argv[++i]);
+        else if(arg == "--json" && has_value)
+            json_filename = argv[++i];
+        else if(arg == "--baseline" && has_value)
+            baseline_filename = argv[++i];
+        else if(arg == "--threshold" && has_value)
+            threshold = atof(argv[++i]);
+        else if(arg.size() > 0 && arg[0] != '-')
+            files.push_back(arg);
+        else
+        {
+            PrintUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(nb_reps < 1)
+    {
+        cerr << "The number of repetitions must be positive." << endl;
+        return EXIT_FAILURE;
+    }
+
+    if(files.empty())
+    {
+        error_code error;
+        for(filesystem::directory_iterator it(models_dir, error), end; !error && it != end; it.increment(error))
+        {
+            if(it->path().extension() == ".off")
+                files.push_back(it->path().string());
+        }
+        sort(files.begin(), files.end());
+
+        if(files.empty())
+        {
+            cerr << "No .off file found in " << models_dir << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(BuildType() == "debug")
+        cerr << "Warning : benchmarking a build without optimizations (use -DCMAKE_BUILD_TYPE=Release)" << endl;
+
+    string tmp_obj = (filesystem::temp_directory_path() / "mesh_bench.obj").string();
+
+    vector<StageResult> results;
+    for(size_t i = 0; i < files.size(); i++)
+        BenchModel(files[i], nb_reps, tmp_obj, results);
+
+    if(json_filename)
+    {
+        ofstream out(json_filename);
+        WriteJSON(out, results, nb_reps);
+        if(!out)
+        {
+            cerr << "Unable to write : " << json_filename << endl;
+            return EXIT_FAILURE;
+        }
+    }
+    else
+    {
+        WriteJSON(cout, results, nb_reps);
+    }
+
+    if(baseline_filename == NULL)
+        return EXIT_SUCCESS;
+
+    // Comparison with the baseline
+    map<string, double> baseline;
+    string baseline_build;
+    if(!ReadJSON(baseline_filename, baseline, baseline_build))
+    {
+        cerr << "Unable to read : " << baseline_filename << endl;
+        return EXIT_FAILURE;
+    }
+    if(baseline_build != BuildType())
+        cerr << "Warning : the baseline comes from a " << baseline_build << " build, this one is " << BuildType() << endl;
+
+    const double noise_floor_ms = 0.01;     // Differences below this are timer noise
+    int nb_regressions = 0;
+
+    cerr << endl << left << setw(40) << "stage" << right << setw(12) << "base (ms)" << setw(12) << "now (ms)" << setw(10) << "ratio" << endl;
+    for(size_t i = 0; i < results.size(); i++)
+    {
+        const StageResult& r = results[i];
+        string key = r.model + "/" + r.stage;
+        map<string, double>::const_iterator it = baseline.find(key);
+        if(it == baseline.end())
+            continue;
+
+        double ratio = (it->second > 0.0) ? r.median_ms / it->second : 1.0;
+        bool regression = ratio > 1.0 + threshold && r.median_ms - it->second > noise_floor_ms;
+        nb_regressions += regression ? 1 : 0;
+
+        cerr << left << setw(40) << key << right << fixed << setprecision(3) << setw(12) << it->second
+             << setw(12) << r.median_ms << setprecision(2) << setw(10) << ratio << (regression ? "  REGRESSION" : "") << endl;
+    }
+
+    if(nb_regressions > 0)
+    {
+        cerr << nb_regressions << " stage(s) slower than the baseline by more than " << threshold * 100.0 << "%" << endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,506 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+#include "MeshHE.h"
+#include "MeshCache.h"
+#include "MeshReorder.h"
+#include "OutOfCoreSmoother.h"
+#include "QuantizedMesh.h"
+#include "Trace.h"
+
+using namespace glm;
+using namespace std;
+
+
+/**
+ * smoothing-cli : headless version of the smoothing program.
+ * Loads an OFF file, applies the noising / smoothing operations given on the
+ * command line (in that order), then normalizes the mesh, recomputes its
+ * normals, writes it as OBJ or OFF and prints the time spent in each stage.
+ * With --out-of-core, the mesh is never loaded as a whole: it is smoothed
+ * chunk by chunk from work files (see OutOfCoreSmoother), and written back
+ * without normalization.
+ */
+
+
+/// One processing stage, from the command line
+struct Operation
+{
+    enum Type { NOISE, NOISE_NOT_BORDER, LAPLACIAN, TAUBIN, IMPLICIT };
+
+    Type type;
+    float lambda;           /// Laplacian / Taubin first factor, or implicit time step
+    float mu;               /// Taubin second factor
+    glm::uint nb_iter;
+};
+
+
+static void PrintUsage(const char* program)
+{
+    cerr << "Usage : " << program << " input.off|input.qmesh [options]" << endl
+         << "Operations (applied in command line order) :" << endl
+         << "  --noise                       random displacement of all the vertices" << endl
+         << "  --noise-not-border            random displacement of the interior vertices" << endl
+         << "  --laplacian LAMBDA N          N steps of laplacian smoothing" << endl
+         << "  --taubin LAMBDA MU N          N steps of Taubin smoothing" << endl
+         << "  --implicit DT N               N backward Euler steps of time DT" << endl
+         << "Options :" << endl
+         << "  -o, --output FILE             output mesh, .obj or .off (none by default)" << endl
+         << "  --weights uniform|cotangent|mean-value" << endl
+         << "                                laplacian weights (uniform by default)" << endl
+         << "  --weight-tolerance T          move, in mean edge lengths, after which geometric weights are" << endl
+         << "                                recomputed around a vertex (0.01 by default)" << endl
+         << "  --threads N                   number of threads (OpenMP default by default)" << endl
+         << "  --seed N                      seed of the noise (current time by default)" << endl
+         << "  --cache                       load through the binary mesh cache" << endl
+         << "  --reorder morton|rcm          renumbers the vertices (Morton curve or reverse Cuthill-McKee)" << endl
+         << "                                and the faces (Tipsify) after loading, prints the ACMR" << endl
+         << "  --quantize 16|21 FILE         archives the result in FILE (.qmesh) with quantized positions" << endl
+         << "                                (bits per axis) and octahedral normals, reads it back and prints" << endl
+         << "                                its size and error" << endl
+         << "  --trace FILE                  writes a Chrome trace of the run (needs -DENABLE_TRACE=ON)" << endl
+         << "  --out-of-core MB              smooths the mesh chunk by chunk within MB megabytes of memory" << endl
+         << "                                (laplacian / taubin with uniform weights, .off output, not normalized, 16 MB at least)" << endl
+         << "  --work-dir DIR                directory of the out of core work files ($TMPDIR or /tmp by default)" << endl;
+}
+
+static bool ParseFloat(const char* s, float& value)
+{
+    char* end;
+    value = strtof(s, &end);
+    return end != s && *end == '\0';
+}
+
+static bool ParseUInt(const char* s, glm::uint& value)
+{
+    char* end;
+    unsigned long v = strtoul(s, &end, 10);
+    value = glm::uint(v);
+    return end != s && *end == '\0' && s[0] != '-' && v <= 0xFFFFFFFFul;
+}
+
+static bool HasExtension(const string& filename, const char* extension)
+{
+    size_t n = strlen(extension);
+    if(filename.size() < n)
+        return false;
+
+    for(size_t i = 0; i < n; i++)
+    {
+        if(tolower(filename[filename.size() - n + i]) != extension[i])
+            return false;
+    }
+    return true;
+}
+
+
+/// Wall clock time of the successive stages
+class StageTimer
+{
+public:
+
+    StageTimer() : m_start(chrono::steady_clock::now()), m_last(m_start) {}
+
+    void Stage(const string& name)      /// Prints the time since the previous stage
+    {
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        cout << "  " << left << setw(32) << name << right << fixed << setprecision(2) << setw(10)
+             << chrono::duration<double, milli>(now - m_last).count() << " ms" << endl;
+        m_last = now;
+    }
+
+    void Total()
+    {
+        m_last = m_start;
+        Stage("total");
+    }
+
+private:
+
+    chrono::steady_clock::time_point m_start;
+    chrono::steady_clock::time_point m_last;
+};
+
+
+/// Smoothing of a mesh which does not need to fit in memory
+static int RunOutOfCore(const char* input_filename, const string& output_filename, const vector<Operation>& operations,
+                        const size_t memory_budget, const string& work_directory)
+{
+    StageTimer timer;
+    OutOfCoreSmoother smoother(memory_budget, work_directory);
+
+    cout << input_filename << endl;
+
+    if(!smoother.Open(input_filename))
+        return EXIT_FAILURE;
+    timer.Stage("convert and partition");
+
+    cout << "  " << smoother.NbVertices() << " vertices, " << smoother.NbFaces() << " faces, "
+         << smoother.NbChunks() << " chunks of at most " << smoother.MaxChunkVertices() << " vertices" << endl;
+
+    for(size_t i = 0; i < operations.size(); i++)
+    {
+        const Operation& op = operations[i];
+        ostringstream name;
+        bool ok;
+
+        if(op.type == Operation::LAPLACIAN)
+        {
+            ok = smoother.LaplacianSmooth(op.lambda, op.nb_iter);
+            name << "laplacian " << op.lambda << " x" << op.nb_iter;
+        }
+        else
+        {
+            ok = smoother.TaubinSmooth(op.lambda, op.mu, op.nb_iter);
+            name << "taubin " << op.lambda << " " << op.mu << " x" << op.nb_iter;
+        }
+        if(!ok)
+            return EXIT_FAILURE;
+        timer.Stage(name.str());
+    }
+
+    if(!smoother.WriteOFF(output_filename.c_str()))
+        return EXIT_FAILURE;
+    timer.Stage("write " + output_filename);
+
+    timer.Total();
+    return EXIT_SUCCESS;
+}
+
+
+int main(int argc, char** argv)
+{
+    if(argc < 2 || strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)
+    {
+        PrintUsage(argv[0]);
+        return (argc < 2) ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    //-------------------------------------------------
+    // Command line
+
+    const char* input_filename = argv[1];
+    string output_filename;
+    string trace_filename;
+    vector<Operation> operations;
+    LaplacianWeights weights = UNIFORM_WEIGHTS;
+    float weight_tolerance = LaplacianOperator::WEIGHT_TOLERANCE;
+    int nb_threads = 0;
+    bool use_cache = false;
+    bool reorder = false;
+    glm::uint quantize_bits = 0;            // 0 to keep float attributes
+    string quantize_filename;
+    VertexOrdering ordering = KEEP_VERTEX_ORDER;
+    bool has_seed = false;
+    glm::uint seed = 0;
+    glm::uint out_of_core_budget = 0;       // MB, 0 to load the whole mesh
+    string work_directory = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+
+    for(int i = 2; i < argc; i++)
+    {
+        string arg = argv[i];
+        int nb_values = argc - i - 1;
+        bool ok = true;
+        Operation op;
+        op.lambda = op.mu = 0.0f;
+        op.nb_iter = 1;
+
+        if(arg == "--noise" || arg == "--noise-not-border")
+        {
+            op.type = (arg == "--noise") ? Operation::NOISE : Operation::NOISE_NOT_BORDER;
+            operations.push_back(op);
+        }
+        else if(arg == "--laplacian" || arg == "--implicit")
+        {
+            op.type = (arg == "--laplacian") ? Operation::LAPLACIAN : Operation::IMPLICIT;
+            ok = nb_values >= 2 && ParseFloat(argv[i+1], op.lambda) && ParseUInt(argv[i+2], op.nb_iter);
+            operations.push_back(op);
+            i += 2;
+        }
+        else if(arg == "--taubin")
+        {
+            op.type = Operation::TAUBIN;
+            ok = nb_values >= 3 && ParseFloat(argv[i+1], op.lambda) && ParseFloat(argv[i+2], op.mu) && ParseUInt(argv[i+3], op.nb_iter);
+            operations.push_back(op);
+            i += 3;
+        }
+        else if(arg == "-o" || arg == "--output")
+        {
+            ok = nb_values >= 1 && (HasExtension(argv[i+1], ".obj") || HasExtension(argv[i+1], ".off"));
+            if(ok)
+                output_filename = argv[i+1];
+            i += 1;
+        }
+        else if(arg == "--weights")
+        {
+            ok = nb_values >= 1;
+            if(ok && strcmp(argv[i+1], "uniform") == 0)
+                weights = UNIFORM_WEIGHTS;
+            else if(ok && strcmp(argv[i+1], "cotangent") == 0)
+                weights = COTANGENT_WEIGHTS;
+            else if(ok && strcmp(argv[i+1], "mean-value") == 0)
+                weights = MEAN_VALUE_WEIGHTS;
+            else
+                ok = false;
+            i += 1;
+        }
+        else if(arg == "--weight-tolerance")
+        {
+            ok = nb_values >= 1 && ParseFloat(argv[i+1], weight_tolerance) && weight_tolerance >= 0.0f;
+            i += 1;
+        }
+        else if(arg == "--threads")
+        {
+            glm::uint n = 0;
+            ok = nb_values >= 1 && ParseUInt(argv[i+1], n) && n > 0;
+            nb_threads = n;
+            i += 1;
+        }
+        else if(arg == "--seed")
+        {
+            ok = nb_values >= 1 && ParseUInt(argv[i+1], seed);
+            has_seed = true;
+            i += 1;
+        }
+        else if(arg == "--trace")
+        {
+            ok = nb_values >= 1;
+            if(ok)
+                trace_filename = argv[i+1];
+            i += 1;
+        }
+        else if(arg == "--out-of-core")
+        {
+            ok = nb_values >= 1 && ParseUInt(argv[i+1], out_of_core_budget) && out_of_core_budget > 0;
+            if(ok && (size_t(out_of_core_budget) << 20) < OutOfCoreSmoother::MIN_MEMORY_BUDGET)
+            {
+                cerr << "--out-of-core needs a budget of at least " << (OutOfCoreSmoother::MIN_MEMORY_BUDGET >> 20) << " MB" << endl;
+                return EXIT_FAILURE;
+            }
+            i += 1;
+        }
+        else if(arg == "--work-dir")
+        {
+            ok = nb_values >= 1;
+            if(ok)
+                work_directory = argv[i+1];
+            i += 1;
+        }
+        else if(arg == "--reorder")
+        {
+            ok = nb_values >= 1 && (strcmp(argv[i+1], "morton") == 0 || strcmp(argv[i+1], "rcm") == 0);
+            if(ok)
+                ordering = (strcmp(argv[i+1], "morton") == 0) ? MORTON_VERTEX_ORDER : RCM_VERTEX_ORDER;
+            reorder = true;
+            i += 1;
+        }
+        else if(arg == "--quantize")
+        {
+            ok = nb_values >= 2 && ParseUInt(argv[i+1], quantize_bits) && (quantize_bits == 16 || quantize_bits == 21);
+            if(ok)
+                quantize_filename = argv[i+2];
+            i += 2;
+        }
+        else if(arg == "--cache")
+        {
+            use_cache = true;
+        }
+        else
+        {
+            ok = false;
+        }
+
+        if(!ok)
+        {
+            cerr << "Invalid argument : " << arg << endl;
+            PrintUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+#ifdef _OPENMP
+    if(nb_threads > 0)
+        omp_set_num_threads(nb_threads);
+#endif
+
+    if(out_of_core_budget > 0)
+    {
+        bool supported = weights == UNIFORM_WEIGHTS && !use_cache && !reorder && quantize_bits == 0
+                      && HasExtension(input_filename, ".off") && HasExtension(output_filename, ".off");
+        for(size_t i = 0; i < operations.size(); i++)
+            supported = supported && (operations[i].type == Operation::LAPLACIAN || operations[i].type == Operation::TAUBIN);
+
+        if(!supported)
+        {
+            cerr << "--out-of-core only supports --laplacian and --taubin with uniform weights, and .off input and output" << endl;
+            return EXIT_FAILURE;
+        }
+
+        int status = RunOutOfCore(input_filename, output_filename, operations, size_t(out_of_core_budget) << 20, work_directory);
+        if(status == EXIT_SUCCESS && !trace_filename.empty() && !TRACE_WRITE(trace_filename.c_str()))
+        {
+            cerr << "Unable to write the trace (tracing needs a build with -DENABLE_TRACE=ON)" << endl;
+            return EXIT_FAILURE;
+        }
+        return status;
+    }
+
+
+    //-------------------------------------------------
+    // Processing
+
+    StageTimer timer;
+    MeshHE mesh;
+
+    cout << input_filename << endl;
+
+    if(HasExtension(input_filename, ".qmesh"))
+    {
+        // Archived by --quantize, already normalized
+        QuantizedMesh quantized;
+        if(!quantized.Read(input_filename))
+            return EXIT_FAILURE;
+        timer.Stage("load");
+
+        quantized.DecodeMesh(mesh);
+        timer.Stage("decode");
+    }
+    else if(use_cache)
+    {
+        if(!MeshCache::Load(input_filename, mesh))
+            return EXIT_FAILURE;
+        timer.Stage("load (cache)");
+    }
+    else
+    {
+        Mesh m;
+        if(!m.LoadOFF(input_filename))
+            return EXIT_FAILURE;
+        timer.Stage("load");
+
+        // Same normalization as the viewer, the noise amplitude is absolute
+        m.normalize();
+        mesh = MeshHE(m);
+        timer.Stage("half edge conversion");
+    }
+
+    cout << "  " << mesh.NbVertices() << " vertices, " << mesh.NbFaces() << " faces" << endl;
+
+    if(reorder)
+    {
+        float acmr_before = MeshReorder::ComputeACMR(mesh);
+        timer.Stage("acmr");
+
+        MeshReorder::Reorder(mesh, ordering);
+        timer.Stage(string("reorder (") + MeshReorder::OrderingName(ordering) + " + tipsify)");
+
+        cout << "  ACMR (" << MeshReorder::VERTEX_CACHE_SIZE << " entries FIFO) : " << setprecision(3)
+             << acmr_before << " -> " << MeshReorder::ComputeACMR(mesh) << endl;
+    }
+
+    if(has_seed)
+        srand(seed);
+
+    if(weights != UNIFORM_WEIGHTS)
+    {
+        mesh.SetLaplacianWeights(weights, weight_tolerance);
+        timer.Stage("laplacian weights");
+    }
+
+    for(size_t i = 0; i < operations.size(); i++)
+    {
+        const Operation& op = operations[i];
+        ostringstream name;
+
+        switch(op.type)
+        {
+        case Operation::NOISE:
+            mesh.Noise();
+            name << "noise";
+            break;
+        case Operation::NOISE_NOT_BORDER:
+            mesh.NoiseNotBorder();
+            name << "noise (not border)";
+            break;
+        case Operation::LAPLACIAN:
+            mesh.LaplacianSmooth(op.lambda, op.nb_iter, nb_threads);
+            name << "laplacian " << op.lambda << " x" << op.nb_iter;
+            break;
+        case Operation::TAUBIN:
+            mesh.TaubinSmooth(op.lambda, op.mu, op.nb_iter, nb_threads);
+            name << "taubin " << op.lambda << " " << op.mu << " x" << op.nb_iter;
+            break;
+        case Operation::IMPLICIT:
+        {
+            glm::uint nb_solver_iter = mesh.ImplicitSmooth(op.lambda, op.nb_iter, nb_threads);
+            name << "implicit " << op.lambda << " x" << op.nb_iter << " (" << nb_solver_iter << " solver it.)";
+            break;
+        }
+        }
+        timer.Stage(name.str());
+    }
+
+    mesh.Normalize();
+    timer.Stage("normalize");
+
+    mesh.ComputeNormals();
+    timer.Stage("normals");
+
+    if(quantize_bits > 0)
+    {
+        QuantizedMesh quantized;
+        quantized.Encode(mesh, quantize_bits);
+        timer.Stage("quantize");
+
+        if(!quantized.Write(quantize_filename.c_str()))
+            return EXIT_FAILURE;
+        timer.Stage("write " + quantize_filename);
+
+        // The errors are those of the archive as read back
+        if(!quantized.Read(quantize_filename.c_str()))
+            return EXIT_FAILURE;
+        timer.Stage("read " + quantize_filename);
+
+        float position_error, normal_angle;
+        quantized.MeasureErrors(mesh, position_error, normal_angle);
+        quantized.Decode(mesh);
+        timer.Stage("decode");
+
+        size_t float_bytes = size_t(mesh.NbVertices()) * 2 * sizeof(vec3);
+        cout << "  attributes : " << float_bytes << " -> " << quantized.NbBytes() << " bytes" << endl
+             << scientific << setprecision(2)
+             << "  position error : " << position_error << " (bound " << quantized.PositionErrorBound() << ")" << endl
+             << "  normal error : " << normal_angle << " degrees" << endl;
+        cout.unsetf(ios::floatfield);
+    }
+
+    if(!output_filename.empty())
+    {
+        bool written = HasExtension(output_filename, ".obj") ? mesh.write_obj(output_filename.c_str())
+                                                             : mesh.write_off(output_filename.c_str());
+        if(!written)
+            return EXIT_FAILURE;
+        timer.Stage("write " + output_filename);
+    }
+
+    timer.Total();
+
+    if(!trace_filename.empty() && !TRACE_WRITE(trace_filename.c_str()))
+    {
+        cerr << "Unable to write the trace (tracing needs a build with -DENABLE_TRACE=ON)" << endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}